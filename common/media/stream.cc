@@ -211,3 +211,8 @@ Stream::GetStreamSub(AVMediaType type) const {
     throw StreamError(e.what());
   }
 }
+
+void Stream::SetStreamSub(AVMediaType type,
+                          const std::shared_ptr<stream_sub_t> &sub) {
+  stream_subs_[type] = sub;
+}
@@ -66,6 +66,8 @@ class Stream {
   StreamOptions GetOptions() const;
   stream_subs_t GetStreamSubs() const;
   std::shared_ptr<stream_sub_t> GetStreamSub(AVMediaType type) const;
+  // set the sub stream, e.g. for a stream not opened from the input
+  void SetStreamSub(AVMediaType type, const std::shared_ptr<stream_sub_t> &sub);
 
  private:
   StreamOptions options_;
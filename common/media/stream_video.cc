@@ -123,6 +123,7 @@ AVFrame *StreamVideoOp::GetFrame(AVPacket *packet) {
       av_image_fill_arrays(sws_frame_->data, sws_frame_->linesize, sws_buf_,
           pix_fmt, width, height, align);
 
+      sws_frame_->format = pix_fmt;
       sws_frame_->width = width;
       sws_frame_->height = height;
 
@@ -178,17 +178,22 @@ template <>
 struct adl_serializer<net::stream_map_t> {
   static void to_json(json &j, const net::stream_map_t &m) {
     for (auto &&e : m) {
-      json s;
-      s["id"] = e.first;
-      for (auto &&f : e.second->GetStreamSubs()) {
-        auto type = f.first;
-        auto sub = f.second;
-        s[av_get_media_type_string(type)] = {
-          {"codecpar", *sub->info->codecpar},
-        };
-      }
-      j.push_back(s);
+      j.push_back(to_json(e.first, e.second));
+    }
+  }
+
+  // the stream of the id, an element of the "streams"
+  static json to_json(const std::string &id, const net::stream_t &stream) {
+    json s;
+    s["id"] = id;
+    for (auto &&f : stream->GetStreamSubs()) {
+      auto type = f.first;
+      auto sub = f.second;
+      s[av_get_media_type_string(type)] = {
+        {"codecpar", *sub->info->codecpar},
+      };
     }
+    return s;
   }
 
   static void from_json(const json &j, net::stream_map_t &m) {
@@ -208,6 +213,11 @@ std::string to_string(const stream_map_t &m) {
   }.dump();
 }
 
+inline
+std::string to_string(const std::string &id, const stream_t &stream) {
+  return nlohmann::adl_serializer<stream_map_t>::to_json(id, stream).dump();
+}
+
 }  // namespace net
 
 #endif  // NET_JSON_STREAM_IGNORE
@@ -1,11 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#include <libavcodec/avcodec.h>
 #include <libavcodec/packet.h>
 #include <libavutil/avutil.h>
 
@@ -15,21 +21,33 @@ extern "C" {
 
 #include <boost/asio/buffer.hpp>
 
+#include "common/media/stream_def.h"
 #include "common/util/bytes.h"
 #include "common/util/log.h"
 
 namespace net {
 
+enum DataVersion {
+  DATA_VERSION_1 = 1,
+  DATA_VERSION_2 = 2,
+  DATA_BATCH     = 0x80,  // more than one data in a message
+  DATA_INIT      = 0x81,  // the codec parameters of the stream
+  DATA_MUX       = 0x82,  // a data tagged by the stream index
+};
+
 class Data {
  public:
   AVMediaType type;
   AVPacket *packet;
+  // the wall clock ingested by the server, us since epoch, 0 if not
+  //  v2 only, requested by clients, e.g. ws://<addr>/stream/<id>?ver=2&time=1
+  int64_t time_us;
 
   Data()
-    : type(AVMEDIA_TYPE_UNKNOWN), packet(av_packet_alloc()) {
+    : type(AVMEDIA_TYPE_UNKNOWN), packet(av_packet_alloc()), time_us(0) {
   }
-  Data(AVMediaType type, AVPacket *p)
-    : type(type), packet(av_packet_clone(p)) {
+  Data(AVMediaType type, AVPacket *p, int64_t time_us = 0)
+    : type(type), packet(av_packet_clone(p)), time_us(time_us) {
   }
   ~Data() {
     av_packet_free(&packet);
@@ -39,44 +57,162 @@ class Data {
     OK,
     ERROR_NOT_ENOUGH,
     ERROR_ALLOC_FAIL,
+    ERROR_VERSION,
+    ERROR_INVALID,
   };
 
-  std::vector<uint8_t> ToBytes();
-  int ToBytes(std::vector<uint8_t> &bytes);
-  int ToBytes(uint8_t *bytes, std::size_t bytes_n) {
-    return ToBytes(bytes, bytes_n, *this);
+  std::vector<uint8_t> ToBytes(int ver = DATA_VERSION_1);
+  int ToBytes(std::vector<uint8_t> &bytes, int ver = DATA_VERSION_1);
+  int ToBytes(uint8_t *bytes, std::size_t bytes_n, int ver = DATA_VERSION_1) {
+    return ToBytes(bytes, bytes_n, *this, ver);
   }
 
+  // the version is read from the bytes
   int FromBytes(const std::vector<uint8_t> &bytes);
   int FromBytes(const boost::asio::mutable_buffer &bytes);
   int FromBytes(const uint8_t *bytes, std::size_t bytes_n) {
     return FromBytes(bytes, bytes_n, *this);
   }
 
-  std::size_t GetByteSize() const;
+  std::size_t GetByteSize(int ver = DATA_VERSION_1) const;
 
  private:
-  int ToBytes(uint8_t *bytes, std::size_t bytes_n, const Data &data);
+  int ToBytes(uint8_t *bytes, std::size_t bytes_n, const Data &data, int ver);
   int FromBytes(const uint8_t *bytes, std::size_t bytes_n, Data &data);
+  int FromBytesV1(const uint8_t *bytes, std::size_t bytes_n, Data &data);
+  int FromBytesV2(const uint8_t *bytes, std::size_t bytes_n, Data &data);
+
+  // the bytes before and after the packet data
+  static std::size_t HeadByteSizeV1() { return (2+1+4) + (8+8+4); }
+  static std::size_t TailByteSizeV1(const AVPacket *p);
+  static std::size_t WriteHeadV1(uint8_t *bytes, AVMediaType type,
+      const AVPacket *p, std::size_t pkg_size);
+  static std::size_t WriteTailV1(uint8_t *bytes, const AVPacket *p);
+  static std::size_t HeadByteSizeV2(const AVPacket *p, int64_t time_us);
+  static std::size_t WriteHeadV2(uint8_t *bytes, AVMediaType type,
+      const AVPacket *p, int64_t time_us, std::size_t pkg_size);
+
+  // v2 fields present
+  enum FieldV2 {
+    FIELD_PTS           = 1 << 0,
+    FIELD_DTS           = 1 << 1,  // dts != pts
+    FIELD_STREAM_INDEX  = 1 << 2,  // stream_index != 0
+    FIELD_DURATION      = 1 << 3,  // duration != 0
+    FIELD_POS           = 1 << 4,  // pos != -1
+    FIELD_SIDE_DATA     = 1 << 5,  // side_data_elems > 0
+    FIELD_TIME          = 1 << 6,  // time_us != 0
+  };
+  static uint8_t FieldsV2(const AVPacket *p, int64_t time_us);
 
-  static const uint8_t ver_major = 1;
   static const uint8_t ver_minor = 0;
+
+  friend class DataRef;
+};
+
+/*
+mux, the data of a multiplexed session, e.g. ws://<addr>/stream/?ver=2
+  the index of the stream id is replied when subscribed, see README
+
+| version | minor | index | data (or init) |
+| 1       | 1     | 2     | -              |
+*/
+
+class DataMux {
+ public:
+  static constexpr std::size_t kHeadSize = 4;
+
+  static bool Is(const uint8_t *bytes, std::size_t bytes_n) {
+    return bytes_n >= kHeadSize && bytes[0] == DATA_MUX;
+  }
+
+  static std::size_t WriteHead(uint8_t *bytes, int index) {
+    bytes::toc<uint8_t>(bytes, DATA_MUX);
+    bytes::toc<uint8_t>(bytes+1, 0);
+    bytes::to_be<uint16_t>(bytes+2, index);
+    return kHeadSize;
+  }
+
+  // the stream index, and the data inside, return false if not mux
+  static bool FromBytes(const uint8_t *bytes, std::size_t bytes_n,
+                        int *index, const uint8_t **data,
+                        std::size_t *data_n) {
+    if (!Is(bytes, bytes_n)) return false;
+    *index = bytes::from_be<uint16_t>(bytes+2);
+    *data = bytes + kHeadSize;
+    *data_n = bytes_n - kHeadSize;
+    return true;
+  }
+
+  // the bytes tagged by the index, e.g. the init
+  static std::vector<uint8_t> ToBytes(int index,
+                                      const std::vector<uint8_t> &data) {
+    std::vector<uint8_t> v(kHeadSize + data.size());
+    WriteHead(v.data(), index);
+    std::copy(data.begin(), data.end(), v.begin() + kHeadSize);
+    return v;
+  }
+
+  // the max stream indexes
+  static constexpr int max_count() { return 0x10000; }
+};
+
+// Data to send without copying the packet data
+//  the same bytes as Data::ToBytes, but the packet data is only ref'ed, and
+//  sent as a buffer sequence: | head | packet data | tail |
+class DataRef {
+ public:
+  using buffers_t = std::array<boost::asio::const_buffer, 3>;
+
+  // index: tagged by DataMux if >= 0, for the multiplexed sessions
+  //  time_us: the ingest wall clock, v2 only, see Data::time_us
+  DataRef(AVMediaType type, AVPacket *p, int ver = DATA_VERSION_1,
+          int index = -1, int64_t time_us = 0);
+  ~DataRef() {
+    av_packet_free(&packet_);
+  }
+
+  DataRef(const DataRef &) = delete;
+  DataRef &operator=(const DataRef &) = delete;
+
+  AVMediaType type() const { return type_; }
+  const AVPacket *packet() const { return packet_; }
+  int version() const { return ver_; }
+  int64_t time_us() const { return time_us_; }
+
+  std::size_t size() const {
+    return head_.size() + packet_->size + tail_.size();
+  }
+  buffers_t buffers() const {
+    return buffers_t{
+      boost::asio::buffer(head_),
+      boost::asio::buffer(packet_->data, packet_->size),
+      boost::asio::buffer(tail_),
+    };
+  }
+
+ private:
+  AVMediaType type_;
+  AVPacket *packet_;
+  int ver_;
+  int64_t time_us_;
+  std::vector<uint8_t> head_;
+  std::vector<uint8_t> tail_;
 };
 
 inline
-std::vector<uint8_t> Data::ToBytes() {
+std::vector<uint8_t> Data::ToBytes(int ver) {
   std::vector<uint8_t> bytes;
-  ToBytes(bytes);
+  ToBytes(bytes, ver);
   return bytes;
 }
 
 inline
-int Data::ToBytes(std::vector<uint8_t> &bytes) {
-  auto n = GetByteSize();
+int Data::ToBytes(std::vector<uint8_t> &bytes, int ver) {
+  auto n = GetByteSize(ver);
   if (bytes.size() < n) {
     bytes.resize(n);
   }
-  return ToBytes(bytes.data(), bytes.size(), *this);
+  return ToBytes(bytes.data(), bytes.size(), *this, ver);
 }
 
 inline
@@ -103,15 +239,32 @@ pkg_data
 side_data
 | type | size | data |
 | 1    | 4    | -    |
+
+version 2.0, negotiated by clients, e.g. ws://<addr>/stream/<id>?ver=2
+
+data
+| version | type | fields | pkg_size | pkg_data |
+| 2       | 1    | 1      | 4        | -        |
+
+pkg_data, v: varint, z: zigzag varint, only the fields set are present
+| pts | dts - pts | flags | stream_index | duration | pos | side_data_elems | side_data ... | time | size | data |
+| z   | z         | v     | v            | v        | z   | v               | -             | v    | v    | -    |
+
+  absent: pts = AV_NOPTS_VALUE, dts = pts, stream_index = 0, duration = 0,
+    pos = -1, side_data_elems = 0, time = 0
+  time: the ingest wall clock in us since epoch, only if requested by ?time=1
+
+side_data
+| type | size | data |
+| 1    | v    | -    |
 */
 
 inline
-std::size_t Data::GetByteSize() const {
-  std::size_t n = (2+1+4) + (8*4+4*4) + packet->size;
-  for (int i = 0, end = packet->side_data_elems; i < end; ++i) {
-    n += 5 + (packet->side_data + i)->size;
+std::size_t Data::GetByteSize(int ver) const {
+  if (ver == DATA_VERSION_2) {
+    return HeadByteSizeV2(packet, time_us) + packet->size;
   }
-  return n;
+  return HeadByteSizeV1() + packet->size + TailByteSizeV1(packet);
 }
 
 template <typename T>
@@ -121,85 +274,512 @@ std::size_t to_bytes(uint8_t *bytes, const T &v) {
 }
 
 inline
-int Data::ToBytes(uint8_t *bytes, std::size_t bytes_n, const Data &data) {
-  auto pkg_size = GetByteSize();
-  if (bytes_n < pkg_size) {
-    return ERROR_NOT_ENOUGH;
+std::size_t Data::TailByteSizeV1(const AVPacket *p) {
+  std::size_t n = (4+4+4) + (8+8);
+  for (int i = 0, end = p->side_data_elems; i < end; ++i) {
+    n += 5 + (p->side_data + i)->size;
   }
+  return n;
+}
+
+inline
+std::size_t Data::WriteHeadV1(uint8_t *bytes, AVMediaType type,
+    const AVPacket *p, std::size_t pkg_size) {
   std::size_t pos = 0;
-  pos += bytes::toc<uint8_t>(bytes+pos, ver_major);
+  pos += bytes::toc<uint8_t>(bytes+pos, DATA_VERSION_1);
   pos += bytes::toc<uint8_t>(bytes+pos, ver_minor);
-  pos += bytes::toc<uint8_t>(bytes+pos, data.type);
-  pos += bytes::toc<uint32_t>(bytes+pos, pkg_size);
+  pos += bytes::toc<uint8_t>(bytes+pos, type);
+  pos += bytes::to_be<uint32_t>(bytes+pos, pkg_size);
   // pkg_data
-  pos += bytes::toc<int64_t>(bytes+pos, data.packet->pts);
-  pos += bytes::toc<int64_t>(bytes+pos, data.packet->dts);
-  pos += bytes::toc<int>(bytes+pos, data.packet->size);
-  pos += bytes::to(bytes+pos, data.packet->data, data.packet->size);
-  pos += bytes::toc<int>(bytes+pos, data.packet->stream_index);
-  pos += bytes::toc<int>(bytes+pos, data.packet->flags);
-  pos += bytes::toc<int>(bytes+pos, data.packet->side_data_elems);
-  for (int i = 0, end = packet->side_data_elems; i < end; ++i) {
-    auto side_data = packet->side_data + i;
+  pos += bytes::to_be<int64_t>(bytes+pos, p->pts);
+  pos += bytes::to_be<int64_t>(bytes+pos, p->dts);
+  pos += bytes::to_be<int32_t>(bytes+pos, p->size);
+  return pos;
+}
+
+inline
+std::size_t Data::WriteTailV1(uint8_t *bytes, const AVPacket *p) {
+  std::size_t pos = 0;
+  pos += bytes::to_be<int32_t>(bytes+pos, p->stream_index);
+  pos += bytes::to_be<int32_t>(bytes+pos, p->flags);
+  pos += bytes::to_be<int32_t>(bytes+pos, p->side_data_elems);
+  for (int i = 0, end = p->side_data_elems; i < end; ++i) {
+    auto side_data = p->side_data + i;
     pos += bytes::toc<uint8_t>(bytes+pos, side_data->type);
-    pos += bytes::toc<int>(bytes+pos, side_data->size);
-    pos += bytes::to(bytes+pos, side_data->data, side_data->size);
+    pos += bytes::to_be<int32_t>(bytes+pos, side_data->size);
+    std::memcpy(bytes+pos, side_data->data, side_data->size);
+    pos += side_data->size;
+  }
+  pos += bytes::to_be<int64_t>(bytes+pos, p->duration);
+  pos += bytes::to_be<int64_t>(bytes+pos, p->pos);
+  return pos;
+}
+
+inline
+uint8_t Data::FieldsV2(const AVPacket *p, int64_t time_us) {
+  uint8_t fields = 0;
+  if (p->pts != AV_NOPTS_VALUE) fields |= FIELD_PTS;
+  if (p->dts != p->pts) fields |= FIELD_DTS;
+  if (p->stream_index != 0) fields |= FIELD_STREAM_INDEX;
+  if (p->duration != 0) fields |= FIELD_DURATION;
+  if (p->pos != -1) fields |= FIELD_POS;
+  if (p->side_data_elems > 0) fields |= FIELD_SIDE_DATA;
+  if (time_us != 0) fields |= FIELD_TIME;
+  return fields;
+}
+
+// wrap around, as dts or pts may be AV_NOPTS_VALUE
+inline
+int64_t dts_delta(int64_t dts, int64_t pts) {
+  return static_cast<int64_t>(
+      static_cast<uint64_t>(dts) - static_cast<uint64_t>(pts));
+}
+
+inline
+std::size_t Data::HeadByteSizeV2(const AVPacket *p, int64_t time_us) {
+  auto fields = FieldsV2(p, time_us);
+  std::size_t n = (2+1+1+4);
+  if (fields & FIELD_PTS)
+    n += bytes::varint_size(bytes::zigzag(p->pts));
+  if (fields & FIELD_DTS)
+    n += bytes::varint_size(bytes::zigzag(dts_delta(p->dts, p->pts)));
+  n += bytes::varint_size(static_cast<uint32_t>(p->flags));
+  if (fields & FIELD_STREAM_INDEX)
+    n += bytes::varint_size(static_cast<uint32_t>(p->stream_index));
+  if (fields & FIELD_DURATION)
+    n += bytes::varint_size(static_cast<uint64_t>(p->duration));
+  if (fields & FIELD_POS)
+    n += bytes::varint_size(bytes::zigzag(p->pos));
+  if (fields & FIELD_SIDE_DATA) {
+    n += bytes::varint_size(static_cast<uint32_t>(p->side_data_elems));
+    for (int i = 0, end = p->side_data_elems; i < end; ++i) {
+      auto side_data = p->side_data + i;
+      n += 1 + bytes::varint_size(side_data->size) + side_data->size;
+    }
+  }
+  if (fields & FIELD_TIME)
+    n += bytes::varint_size(static_cast<uint64_t>(time_us));
+  n += bytes::varint_size(static_cast<uint32_t>(p->size));
+  return n;
+}
+
+inline
+std::size_t Data::WriteHeadV2(uint8_t *bytes, AVMediaType type,
+    const AVPacket *p, int64_t time_us, std::size_t pkg_size) {
+  auto fields = FieldsV2(p, time_us);
+  std::size_t pos = 0;
+  pos += bytes::toc<uint8_t>(bytes+pos, DATA_VERSION_2);
+  pos += bytes::toc<uint8_t>(bytes+pos, ver_minor);
+  pos += bytes::toc<uint8_t>(bytes+pos, type);
+  pos += bytes::to<uint8_t>(bytes+pos, fields);
+  pos += bytes::to_be<uint32_t>(bytes+pos, pkg_size);
+  // pkg_data
+  if (fields & FIELD_PTS)
+    pos += bytes::to_varint(bytes+pos, bytes::zigzag(p->pts));
+  if (fields & FIELD_DTS)
+    pos += bytes::to_varint(bytes+pos,
+        bytes::zigzag(dts_delta(p->dts, p->pts)));
+  pos += bytes::to_varint(bytes+pos, static_cast<uint32_t>(p->flags));
+  if (fields & FIELD_STREAM_INDEX)
+    pos += bytes::to_varint(bytes+pos, static_cast<uint32_t>(p->stream_index));
+  if (fields & FIELD_DURATION)
+    pos += bytes::to_varint(bytes+pos, static_cast<uint64_t>(p->duration));
+  if (fields & FIELD_POS)
+    pos += bytes::to_varint(bytes+pos, bytes::zigzag(p->pos));
+  if (fields & FIELD_SIDE_DATA) {
+    pos += bytes::to_varint(bytes+pos,
+        static_cast<uint32_t>(p->side_data_elems));
+    for (int i = 0, end = p->side_data_elems; i < end; ++i) {
+      auto side_data = p->side_data + i;
+      pos += bytes::toc<uint8_t>(bytes+pos, side_data->type);
+      pos += bytes::to_varint(bytes+pos, side_data->size);
+      std::memcpy(bytes+pos, side_data->data, side_data->size);
+      pos += side_data->size;
+    }
+  }
+  if (fields & FIELD_TIME)
+    pos += bytes::to_varint(bytes+pos, static_cast<uint64_t>(time_us));
+  pos += bytes::to_varint(bytes+pos, static_cast<uint32_t>(p->size));
+  return pos;
+}
+
+inline
+int Data::ToBytes(uint8_t *bytes, std::size_t bytes_n, const Data &data,
+    int ver) {
+  auto pkg_size = data.GetByteSize(ver);
+  if (bytes_n < pkg_size) {
+    return ERROR_NOT_ENOUGH;
+  }
+  auto p = data.packet;
+  std::size_t pos = 0;
+  if (ver == DATA_VERSION_2) {
+    pos += WriteHeadV2(bytes+pos, data.type, p, data.time_us, pkg_size);
+    std::memcpy(bytes+pos, p->data, p->size);
+    pos += p->size;
+  } else {
+    pos += WriteHeadV1(bytes+pos, data.type, p, pkg_size);
+    std::memcpy(bytes+pos, p->data, p->size);
+    pos += p->size;
+    pos += WriteTailV1(bytes+pos, p);
   }
-  pos += bytes::toc<int64_t>(bytes+pos, data.packet->duration);
-  pos += bytes::toc<int64_t>(bytes+pos, data.packet->pos);
   LOG_IF(FATAL, pkg_size != pos) << "Packet to bytes fail, pkg_size="
       << pkg_size << ", pos=" << pos;
   return OK;
 }
 
+inline
+DataRef::DataRef(AVMediaType type, AVPacket *p, int ver, int index,
+    int64_t time_us)
+  : type_(type), packet_(av_packet_alloc()), ver_(ver), time_us_(time_us) {
+  // ref the buffer if ref counted, otherwise copy it
+  if (av_packet_ref(packet_, p) != 0) {
+    LOG(ERROR) << "Packet ref fail, size=" << p->size;
+  }
+
+  if (ver_ == DATA_VERSION_2) {
+    head_.resize(Data::HeadByteSizeV2(packet_, time_us_));
+    Data::WriteHeadV2(head_.data(), type_, packet_, time_us_,
+        head_.size() + packet_->size);
+  } else {
+    ver_ = DATA_VERSION_1;
+    time_us_ = 0;
+    head_.resize(Data::HeadByteSizeV1());
+    tail_.resize(Data::TailByteSizeV1(packet_));
+    Data::WriteHeadV1(head_.data(), type_, packet_,
+        head_.size() + packet_->size + tail_.size());
+    Data::WriteTailV1(tail_.data(), packet_);
+  }
+
+  if (index >= 0) {
+    head_.insert(head_.begin(), DataMux::kHeadSize, 0);
+    DataMux::WriteHead(head_.data(), index);
+  }
+}
+
+/*
+batch, requested by clients, e.g. ws://<addr>/stream/<id>?batch=1
+  a message of one data is sent as it is, not in a batch
+
+| version | minor | count | (size | data) ... |
+| 1       | 1     | 2     | 4     | -     |
+*/
+
+// Datas sent as one message, zero copy as DataRef
+//  or the bytes of other messages, e.g. DataInit
+class DataBatch {
+ public:
+  using buffers_t = std::vector<boost::asio::const_buffer>;
+
+  explicit DataBatch(std::vector<std::shared_ptr<DataRef>> datas)
+    : datas_(std::move(datas)), size_(0) {
+    if (datas_.size() > 1) {
+      head_.resize(4 + 4 * datas_.size());
+      auto bytes = head_.data();
+      bytes::toc<uint8_t>(bytes, DATA_BATCH);
+      bytes::toc<uint8_t>(bytes+1, 0);
+      bytes::to_be<uint16_t>(bytes+2, datas_.size());
+      buffers_.reserve(datas_.size() * 4 + 1);
+      buffers_.push_back(boost::asio::buffer(bytes, 4));
+      size_ = 4;
+      for (std::size_t i = 0; i < datas_.size(); ++i) {
+        auto prefix = bytes + 4 + 4 * i;
+        bytes::to_be<uint32_t>(prefix, datas_[i]->size());
+        buffers_.push_back(boost::asio::buffer(prefix, 4));
+        size_ += 4;
+        for (auto &&b : datas_[i]->buffers()) buffers_.push_back(b);
+        size_ += datas_[i]->size();
+      }
+    } else if (datas_.size() == 1) {
+      for (auto &&b : datas_[0]->buffers()) buffers_.push_back(b);
+      size_ = datas_[0]->size();
+    }
+  }
+
+  // text: sent as a text message, e.g. the json replies
+  explicit DataBatch(std::shared_ptr<const std::vector<uint8_t>> bytes,
+                     bool text = false)
+    : raw_(std::move(bytes)), size_(raw_->size()), text_(text) {
+    buffers_.push_back(boost::asio::buffer(*raw_));
+  }
+
+  DataBatch(const DataBatch &) = delete;
+  DataBatch &operator=(const DataBatch &) = delete;
+
+  std::size_t count() const { return datas_.size(); }
+  std::size_t size() const { return size_; }
+  const buffers_t &buffers() const { return buffers_; }
+  bool is_text() const { return text_; }
+
+  // the max datas in a batch
+  static constexpr std::size_t max_count() { return 0xffff; }
+
+ private:
+  std::vector<std::shared_ptr<DataRef>> datas_;
+  std::vector<uint8_t> head_;
+  std::shared_ptr<const std::vector<uint8_t>> raw_;
+  buffers_t buffers_;
+  std::size_t size_;
+  bool text_ = false;
+};
+
+// call f(bytes, bytes_n) for each data in a message, a batch or not
+//  return false if the batch is broken
+template <typename F>
+bool ForEachData(const uint8_t *bytes, std::size_t bytes_n, F f) {
+  if (bytes_n < 1 || bytes[0] != DATA_BATCH) {
+    f(bytes, bytes_n);
+    return true;
+  }
+  if (bytes_n < 4) return false;
+  auto count = bytes::from_be<uint16_t>(bytes+2);
+  std::size_t pos = 4;
+  for (int i = 0; i < count; ++i) {
+    if (bytes_n - pos < 4) return false;
+    std::size_t size = bytes::from_be<uint32_t>(bytes+pos);
+    pos += 4;
+    if (bytes_n - pos < size) return false;
+    f(bytes+pos, size);
+    pos += size;
+  }
+  return true;
+}
+
+/*
+init, the codec parameters of the stream, if requested by ?init=1
+  sent first on connect, and again if changed, before the datas with them
+
+| version | minor | subs_n | (type | codecpar_size | codecpar) ... |
+| 1       | 1     | 1      | 1     | 4             | -        |
+
+codecpar, int32 if not noted
+| codec_type (1) | codec_id | codec_tag | format | bit_rate (8) |
+| bits_per_coded_sample | bits_per_raw_sample | profile | level |
+| width | height | sample_aspect_ratio (num, den) | field_order |
+| color_range | color_primaries | color_trc | color_space | chroma_location |
+| video_delay | channel_layout (8) | channels | sample_rate | block_align |
+| frame_size | initial_padding | trailing_padding | seek_preroll |
+| extradata_size | extradata |
+*/
+
+class DataInit {
+ public:
+  using subs_t = decltype(StreamInfo::subs);
+
+  static bool Is(const uint8_t *bytes, std::size_t bytes_n) {
+    return bytes_n > 0 && bytes[0] == DATA_INIT;
+  }
+
+  static std::vector<uint8_t> ToBytes(const subs_t &subs);
+  // return Data::Status
+  static int FromBytes(const uint8_t *bytes, std::size_t bytes_n,
+                       subs_t *subs);
+
+ private:
+  static constexpr std::size_t kCodecparSize = 1 + 26*4 + 2*8;
+};
+
+inline
+std::vector<uint8_t> DataInit::ToBytes(const subs_t &subs) {
+  std::size_t n = 3;
+  for (auto &&e : subs) {
+    n += 1 + 4 + kCodecparSize + e.second->codecpar->extradata_size;
+  }
+  std::vector<uint8_t> v(n);
+  auto bytes = v.data();
+  std::size_t pos = 0;
+  pos += bytes::toc<uint8_t>(bytes+pos, DATA_INIT);
+  pos += bytes::toc<uint8_t>(bytes+pos, 0);
+  pos += bytes::toc<uint8_t>(bytes+pos, subs.size());
+  for (auto &&e : subs) {
+    auto par = e.second->codecpar;
+    pos += bytes::toc<uint8_t>(bytes+pos, e.first);
+    pos += bytes::to_be<uint32_t>(bytes+pos,
+        kCodecparSize + par->extradata_size);
+    pos += bytes::toc<uint8_t>(bytes+pos, par->codec_type);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->codec_id);
+    pos += bytes::to_be<uint32_t>(bytes+pos, par->codec_tag);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->format);
+    pos += bytes::to_be<int64_t>(bytes+pos, par->bit_rate);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->bits_per_coded_sample);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->bits_per_raw_sample);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->profile);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->level);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->width);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->height);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->sample_aspect_ratio.num);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->sample_aspect_ratio.den);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->field_order);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->color_range);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->color_primaries);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->color_trc);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->color_space);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->chroma_location);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->video_delay);
+    pos += bytes::to_be<uint64_t>(bytes+pos, par->channel_layout);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->channels);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->sample_rate);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->block_align);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->frame_size);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->initial_padding);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->trailing_padding);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->seek_preroll);
+    pos += bytes::to_be<int32_t>(bytes+pos, par->extradata_size);
+    if (par->extradata_size > 0) {
+      std::memcpy(bytes+pos, par->extradata, par->extradata_size);
+      pos += par->extradata_size;
+    }
+  }
+  LOG_IF(FATAL, n != pos) << "Init to bytes fail, size=" << n
+      << ", pos=" << pos;
+  return v;
+}
+
+inline
+int DataInit::FromBytes(const uint8_t *bytes, std::size_t bytes_n,
+                        subs_t *subs) {
+  if (bytes_n < 3) return Data::ERROR_NOT_ENOUGH;
+  if (bytes[0] != DATA_INIT) return Data::ERROR_VERSION;
+  auto subs_n = bytes::from<uint8_t>(bytes+2);
+  std::size_t pos = 3;
+  subs_t result;
+  for (int i = 0; i < subs_n; ++i) {
+    if (bytes_n - pos < 5) return Data::ERROR_NOT_ENOUGH;
+    auto type = bytes::fromc<AVMediaType, uint8_t>(bytes+pos);
+    std::size_t size = bytes::from_be<uint32_t>(bytes+pos+1);
+    pos += 5;
+    if (bytes_n - pos < size) return Data::ERROR_NOT_ENOUGH;
+    if (size < kCodecparSize) return Data::ERROR_INVALID;
+
+    auto info = std::make_shared<StreamSubInfo>();
+    auto par = info->codecpar;
+    auto p = bytes + pos;
+    par->codec_type = bytes::fromc<AVMediaType, uint8_t>(p);
+    p += 1;
+    auto next32 = [&p]() {
+      auto v = bytes::from_be<int32_t>(p);
+      p += 4;
+      return v;
+    };
+    auto next64 = [&p]() {
+      auto v = bytes::from_be<int64_t>(p);
+      p += 8;
+      return v;
+    };
+    par->codec_id = static_cast<AVCodecID>(next32());
+    par->codec_tag = static_cast<uint32_t>(next32());
+    par->format = next32();
+    par->bit_rate = next64();
+    par->bits_per_coded_sample = next32();
+    par->bits_per_raw_sample = next32();
+    par->profile = next32();
+    par->level = next32();
+    par->width = next32();
+    par->height = next32();
+    par->sample_aspect_ratio.num = next32();
+    par->sample_aspect_ratio.den = next32();
+    par->field_order = static_cast<AVFieldOrder>(next32());
+    par->color_range = static_cast<AVColorRange>(next32());
+    par->color_primaries = static_cast<AVColorPrimaries>(next32());
+    par->color_trc = static_cast<AVColorTransferCharacteristic>(next32());
+    par->color_space = static_cast<AVColorSpace>(next32());
+    par->chroma_location = static_cast<AVChromaLocation>(next32());
+    par->video_delay = next32();
+    par->channel_layout = static_cast<uint64_t>(next64());
+    par->channels = next32();
+    par->sample_rate = next32();
+    par->block_align = next32();
+    par->frame_size = next32();
+    par->initial_padding = next32();
+    par->trailing_padding = next32();
+    par->seek_preroll = next32();
+    auto extradata_size = next32();
+    if (extradata_size < 0 ||
+        static_cast<std::size_t>(extradata_size) != size - kCodecparSize) {
+      return Data::ERROR_INVALID;
+    }
+    if (extradata_size > 0) {
+      par->extradata = static_cast<uint8_t *>(
+          av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE));
+      if (par->extradata == nullptr) return Data::ERROR_ALLOC_FAIL;
+      std::memcpy(par->extradata, p, extradata_size);
+      par->extradata_size = extradata_size;
+    }
+    pos += size;
+    result[type] = info;
+  }
+  *subs = std::move(result);
+  return Data::OK;
+}
+
+// alloc with the padding decoders need
+inline
+uint8_t *packet_data_alloc(std::size_t size) {
+  auto buf = static_cast<uint8_t *>(
+      av_malloc(size + AV_INPUT_BUFFER_PADDING_SIZE));
+  if (buf) std::memset(buf + size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+  return buf;
+}
+
 inline
 int Data::FromBytes(const uint8_t *bytes, std::size_t bytes_n, Data &data) {
+  if (bytes_n < 1) {
+    return ERROR_NOT_ENOUGH;
+  }
+  switch (bytes[0]) {
+    case DATA_VERSION_1: return FromBytesV1(bytes, bytes_n, data);
+    case DATA_VERSION_2: return FromBytesV2(bytes, bytes_n, data);
+    default:
+      LOG(ERROR) << "Packet from bytes fail, version="
+          << static_cast<int>(bytes[0]) << " not supported";
+      return ERROR_VERSION;
+  }
+}
+
+inline
+int Data::FromBytesV1(const uint8_t *bytes, std::size_t bytes_n, Data &data) {
   if (bytes_n < 7) {
     return ERROR_NOT_ENOUGH;
   }
   std::size_t pos = 0;
-  auto ver_major = bytes::from<uint8_t>(bytes+pos);
-  auto ver_minor = bytes::from<uint8_t>(bytes+pos+1);
-  (void)ver_major;
-  (void)ver_minor;
-
   data.type = bytes::fromc<decltype(data.type), uint8_t>(bytes+pos+2);
-  std::size_t pkg_size = bytes::from<uint32_t>(bytes+pos+3);
+  std::size_t pkg_size = bytes::from_be<uint32_t>(bytes+pos+3);
   pos += 7;
+  data.time_us = 0;
   if (bytes_n < pkg_size) {
     return ERROR_NOT_ENOUGH;
   }
 
   // pkg_data
-  data.packet->pts = bytes::from<int64_t>(bytes+pos);
-  data.packet->dts = bytes::from<int64_t>(bytes+pos+8);
-  auto data_size = bytes::from<int>(bytes+pos+16);
-  auto data_buf = static_cast<uint8_t *>(av_malloc(data_size));
+  data.packet->pts = bytes::from_be<int64_t>(bytes+pos);
+  data.packet->dts = bytes::from_be<int64_t>(bytes+pos+8);
+  auto data_size = bytes::from_be<int32_t>(bytes+pos+16);
+  auto data_buf = packet_data_alloc(data_size);
   pos += 20;
   if (data_buf) {
-    pos += bytes::from(bytes+pos, data_buf, data_size);
+    std::memcpy(data_buf, bytes+pos, data_size);
+    pos += data_size;
     av_packet_from_data(data.packet, data_buf, data_size);
   } else {
     return ERROR_ALLOC_FAIL;
   }
-  data.packet->stream_index = bytes::from<int>(bytes+pos);
-  data.packet->flags = bytes::from<int>(bytes+pos+4);
-  auto side_data_elems = bytes::from<int>(bytes+pos+8);
+  data.packet->stream_index = bytes::from_be<int32_t>(bytes+pos);
+  data.packet->flags = bytes::from_be<int32_t>(bytes+pos+4);
+  auto side_data_elems = bytes::from_be<int32_t>(bytes+pos+8);
   pos += 12;
   for (int i = 0, end = side_data_elems; i < end; ++i) {
     auto type = bytes::fromc<AVPacketSideDataType, uint8_t>(bytes+pos);
-    auto size = bytes::from<int>(bytes+pos+1);
+    auto size = bytes::from_be<int32_t>(bytes+pos+1);
     auto data_buf = static_cast<uint8_t *>(av_malloc(size));
     if (data_buf) {
-      bytes::from(bytes+pos+5, data_buf, size);
+      std::memcpy(data_buf, bytes+pos+5, size);
       av_packet_add_side_data(data.packet, type, data_buf, size);
     } else {
       return ERROR_ALLOC_FAIL;
     }
     pos += 5 + size;
   }
-  data.packet->duration = bytes::from<int64_t>(bytes+pos);
-  data.packet->pos = bytes::from<int64_t>(bytes+pos);
+  data.packet->duration = bytes::from_be<int64_t>(bytes+pos);
+  data.packet->pos = bytes::from_be<int64_t>(bytes+pos+8);
   pos += 16;
 
   LOG_IF(FATAL, pkg_size != pos) << "Packet from bytes fail, pkg_size="
@@ -207,4 +787,98 @@ int Data::FromBytes(const uint8_t *bytes, std::size_t bytes_n, Data &data) {
   return OK;
 }
 
+inline
+int Data::FromBytesV2(const uint8_t *bytes, std::size_t bytes_n, Data &data) {
+  if (bytes_n < 8) {
+    return ERROR_NOT_ENOUGH;
+  }
+  std::size_t pkg_size = bytes::from_be<uint32_t>(bytes+4);
+  // the head at least, as from the network, not to read before the fields
+  if (pkg_size < 8) {
+    return ERROR_INVALID;
+  }
+  if (bytes_n < pkg_size) {
+    return ERROR_NOT_ENOUGH;
+  }
+  data.type = bytes::fromc<decltype(data.type), uint8_t>(bytes+2);
+  auto fields = bytes::from<uint8_t>(bytes+3);
+
+  std::size_t pos = 8;
+  uint64_t v = 0;
+  auto read = [bytes, pkg_size, &pos, &v]() {
+    auto n = bytes::from_varint(bytes+pos, pkg_size-pos, &v);
+    pos += n;
+    return n > 0;
+  };
+  auto p = data.packet;
+
+  // pkg_data
+  p->pts = AV_NOPTS_VALUE;
+  if (fields & FIELD_PTS) {
+    if (!read()) return ERROR_INVALID;
+    p->pts = bytes::unzigzag(v);
+  }
+  p->dts = p->pts;
+  if (fields & FIELD_DTS) {
+    if (!read()) return ERROR_INVALID;
+    p->dts = static_cast<int64_t>(
+        static_cast<uint64_t>(p->pts) +
+        static_cast<uint64_t>(bytes::unzigzag(v)));
+  }
+  if (!read()) return ERROR_INVALID;
+  p->flags = static_cast<int>(v);
+  p->stream_index = 0;
+  if (fields & FIELD_STREAM_INDEX) {
+    if (!read()) return ERROR_INVALID;
+    p->stream_index = static_cast<int>(v);
+  }
+  p->duration = 0;
+  if (fields & FIELD_DURATION) {
+    if (!read()) return ERROR_INVALID;
+    p->duration = static_cast<int64_t>(v);
+  }
+  p->pos = -1;
+  if (fields & FIELD_POS) {
+    if (!read()) return ERROR_INVALID;
+    p->pos = bytes::unzigzag(v);
+  }
+  if (fields & FIELD_SIDE_DATA) {
+    if (!read()) return ERROR_INVALID;
+    for (uint64_t i = 0, end = v; i < end; ++i) {
+      if (pos >= pkg_size) return ERROR_INVALID;
+      auto type = bytes::fromc<AVPacketSideDataType, uint8_t>(bytes+pos);
+      pos += 1;
+      if (!read() || v > pkg_size - pos) return ERROR_INVALID;
+      auto size = static_cast<std::size_t>(v);
+      auto data_buf = static_cast<uint8_t *>(av_malloc(size));
+      if (data_buf) {
+        std::memcpy(data_buf, bytes+pos, size);
+        av_packet_add_side_data(p, type, data_buf, size);
+      } else {
+        return ERROR_ALLOC_FAIL;
+      }
+      pos += size;
+    }
+  }
+  data.time_us = 0;
+  if (fields & FIELD_TIME) {
+    if (!read()) return ERROR_INVALID;
+    data.time_us = static_cast<int64_t>(v);
+  }
+  if (!read() || v != pkg_size - pos) return ERROR_INVALID;
+  auto data_size = static_cast<int>(v);
+
+  // keep the fields set above, av_packet_from_data only sets the buf
+  auto data_buf = packet_data_alloc(data_size);
+  if (data_buf == nullptr) return ERROR_ALLOC_FAIL;
+  std::memcpy(data_buf, bytes+pos, data_size);
+  pos += data_size;
+  int ret = av_packet_from_data(p, data_buf, data_size);
+  if (ret < 0) {
+    av_free(data_buf);
+    return ERROR_ALLOC_FAIL;
+  }
+  return OK;
+}
+
 }  // namespace net
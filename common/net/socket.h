@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef __linux__
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#endif
+
+#include "common/net/asio.hpp"
+#include "common/net/beast.hpp"
+
+namespace net {
+
+struct SocketOptions {
+  bool tcp_nodelay = true;
+  // the send buffer, the kernel default and auto tuned if <= 0
+  int sndbuf = 0;
+  // TCP_NOTSENT_LOWAT, writable only if the unsent bytes below it, so the
+  //  data waits in the send queue of the session, disabled if <= 0
+  int notsent_lowat = 0;
+};
+
+// the options of the socket accepted, the ones not supported ignored
+inline void set_socket_options(tcp::socket &socket,
+    const SocketOptions &options, beast::error_code &ec) {
+  if (options.tcp_nodelay) {
+    socket.set_option(tcp::no_delay(true), ec);
+    if (ec) return;
+  }
+  if (options.sndbuf > 0) {
+    socket.set_option(asio::socket_base::send_buffer_size(options.sndbuf), ec);
+    if (ec) return;
+  }
+#if defined(__linux__) && defined(TCP_NOTSENT_LOWAT)
+  if (options.notsent_lowat > 0) {
+    using notsent_lowat =
+        asio::detail::socket_option::integer<IPPROTO_TCP, TCP_NOTSENT_LOWAT>;
+    socket.set_option(notsent_lowat(options.notsent_lowat), ec);
+  }
+#endif
+}
+
+// the kernel state of the socket, sampled by the session
+struct SocketInfo {
+  uint32_t rtt_us = 0;
+  uint32_t rttvar_us = 0;
+  uint32_t outq_bytes = 0;    // not sent and not acked
+  uint32_t unsent_bytes = 0;  // not sent
+};
+
+// TCP_INFO and SIOCOUTQ/SIOCOUTQNSD, linux only
+inline bool get_socket_info(tcp::socket &socket, SocketInfo *info) {
+#ifdef __linux__
+  auto fd = socket.native_handle();
+  struct tcp_info ti;
+  socklen_t len = sizeof(ti);
+  if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) != 0) return false;
+  info->rtt_us = ti.tcpi_rtt;
+  info->rttvar_us = ti.tcpi_rttvar;
+  int n = 0;
+  if (ioctl(fd, SIOCOUTQ, &n) == 0) info->outq_bytes = n;
+#ifdef SIOCOUTQNSD
+  if (ioctl(fd, SIOCOUTQNSD, &n) == 0) info->unsent_bytes = n;
+#endif
+  return true;
+#else
+  (void)socket;
+  (void)info;
+  return false;
+#endif
+}
+
+}  // namespace net
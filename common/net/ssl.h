@@ -0,0 +1,120 @@
+#pragma once
+
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__linux__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
+
+#include <boost/asio/ssl.hpp>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#include "common/net/beast.hpp"
+
+namespace net {
+
+struct SslOptions {
+  // the server cache of the sessions, resumed by the session id of tls 1.2
+  //  or the stateful tickets, disabled if <= 0
+  //  notice the session is removed if the connection is not shut down
+  int session_cache_size  = 20480;
+  int session_timeout_s   = 600;
+  // the stateless tickets, resumed without the cache, even if the connection
+  //  was broken, e.g. a network blip, the keys per context
+  bool session_tickets    = true;
+  // tls 1.2 ~ 1.3, or tls 1.2 only
+  bool tls13              = true;
+  // the cipher list of tls 1.2 and the suites of tls 1.3, server preferred
+  //  AES-GCM first if the cpu has AES, otherwise ChaCha20, if empty
+  std::string ciphers       = "";
+  std::string ciphersuites  = "";
+};
+
+// the cpu has the AES instructions, AES-NI or ARMv8 AES
+inline bool cpu_has_aes() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+  return (ecx & bit_AES) != 0;
+#elif defined(__aarch64__) && defined(__linux__) && defined(HWCAP_AES)
+  return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+  return false;
+#endif
+}
+
+inline const char *default_ciphers(bool aes) {
+  return aes
+      ? "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+        "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384:"
+        "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305"
+      : "ECDHE-ECDSA-CHACHA20-POLY1305:ECDHE-RSA-CHACHA20-POLY1305:"
+        "ECDHE-ECDSA-AES128-GCM-SHA256:ECDHE-RSA-AES128-GCM-SHA256:"
+        "ECDHE-ECDSA-AES256-GCM-SHA384:ECDHE-RSA-AES256-GCM-SHA384";
+}
+
+inline const char *default_ciphersuites(bool aes) {
+  return aes
+      ? "TLS_AES_128_GCM_SHA256:TLS_AES_256_GCM_SHA384:"
+        "TLS_CHACHA20_POLY1305_SHA256"
+      : "TLS_CHACHA20_POLY1305_SHA256:TLS_AES_128_GCM_SHA256:"
+        "TLS_AES_256_GCM_SHA384";
+}
+
+// the versions, the ciphers and the resumption of the server context
+//  before any stream created by it
+inline void set_ssl_options(boost::asio::ssl::context &ctx,
+    const SslOptions &options, beast::error_code &ec) {
+  auto fail = [&ec]() {
+    ec.assign(static_cast<int>(ERR_get_error()),
+              boost::asio::error::get_ssl_category());
+  };
+  auto native = ctx.native_handle();
+
+  if (!SSL_CTX_set_min_proto_version(native, TLS1_2_VERSION)) return fail();
+#ifdef TLS1_3_VERSION
+  if (!SSL_CTX_set_max_proto_version(native,
+      options.tls13 ? TLS1_3_VERSION : TLS1_2_VERSION)) return fail();
+#endif
+
+  auto aes = cpu_has_aes();
+  SSL_CTX_set_options(native, SSL_OP_CIPHER_SERVER_PREFERENCE);
+  if (!SSL_CTX_set_cipher_list(native, options.ciphers.empty()
+      ? default_ciphers(aes) : options.ciphers.c_str())) return fail();
+#ifdef TLS1_3_VERSION
+  if (!SSL_CTX_set_ciphersuites(native, options.ciphersuites.empty()
+      ? default_ciphersuites(aes) : options.ciphersuites.c_str()))
+    return fail();
+#endif
+  // X25519 the cheapest key exchange
+  if (!SSL_CTX_set1_groups_list(native, "X25519:P-256:P-384")) return fail();
+
+  // resumption, the id context required if the sessions are cached
+  static const unsigned char kSessionIdContext[] = "net";
+  if (!SSL_CTX_set_session_id_context(native, kSessionIdContext,
+      sizeof(kSessionIdContext) - 1)) return fail();
+  if (options.session_cache_size > 0) {
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(native, options.session_cache_size);
+  } else {
+    SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+  }
+  if (options.session_timeout_s > 0) {
+    SSL_CTX_set_timeout(native, options.session_timeout_s);
+  }
+  if (!options.session_tickets) {
+    SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+  }
+#ifdef TLS1_3_VERSION
+  // a ticket per handshake is enough, the clients reconnect one at a time
+  //  none if neither stateless nor stateful ones could be resumed
+  SSL_CTX_set_num_tickets(native,
+      options.session_tickets || options.session_cache_size > 0 ? 1 : 0);
+#endif
+}
+
+}  // namespace net
@@ -0,0 +1,475 @@
+#pragma once
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+#include "common/net/asio.hpp"
+#include "common/net/beast.hpp"
+#include "common/net/ext.h"
+
+namespace net {
+
+struct StaticCacheOptions {
+  bool enable = true;
+  // cached if the file <= it, else streamed, e.g. by sendfile
+  std::size_t file_max_bytes = 8 * 1024 * 1024;
+  // of all the files cached, the others streamed
+  std::size_t max_bytes = 128 * 1024 * 1024;
+  // stat the file again if checked before it, the mtime and the size
+  int check_ms = 1000;
+  std::string cache_control = "no-cache";
+};
+
+// if the file could be sent by send_file, see the overloads of the senders
+template <class Send>
+bool can_send_file(const Send &) {
+  return false;
+}
+
+template <class Send>
+void send_file(const Send &, http::response<http::empty_body> &&,
+    const std::string &, uint64_t, uint64_t) {
+}
+
+#ifdef __linux__
+// sendfile the range of the file, not copied to the user space
+inline void sendfile(beast::tcp_stream &stream, const std::string &path,
+    uint64_t offset, uint64_t n, asio::yield_context yield,
+    beast::error_code &ec) {
+  auto fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    ec.assign(errno, beast::system_category());
+    return;
+  }
+  auto &socket = stream.socket();
+  socket.native_non_blocking(true, ec);
+  auto off = static_cast<off_t>(offset);
+  while (!ec && n > 0) {
+    auto r = ::sendfile(socket.native_handle(), fd, &off,
+        static_cast<std::size_t>(std::min<uint64_t>(n, 1 << 20)));
+    if (r > 0) {
+      n -= r;
+    } else if (r < 0 && errno == EINTR) {
+      continue;
+    } else if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // wait writable, canceled if not within the timeout
+      asio::steady_timer timer(socket.get_executor());
+      timer.expires_after(std::chrono::seconds(30));
+      timer.async_wait([&socket](beast::error_code e) {
+        if (!e) socket.cancel();
+      });
+      socket.async_wait(tcp::socket::wait_write, yield[ec]);
+      timer.cancel();
+    } else if (r == 0) {
+      ec = asio::error::eof;  // truncated
+    } else {
+      ec.assign(errno, beast::system_category());
+    }
+  }
+  ::close(fd);
+}
+#endif
+
+// the static files of the doc root in memory, the precompressed variants
+//  <file>.br and <file>.gz if newer, ETag/304 and a single Range
+class StaticCache {
+ public:
+  explicit StaticCache(std::string doc_root,
+      const StaticCacheOptions &options = StaticCacheOptions{})
+    : doc_root_(std::move(doc_root)), options_(options), bytes_(0) {
+  }
+
+  // false if not handled, e.g. not found, by net::handle_request then
+  template <class Body, class Allocator, class Send>
+  bool Handle(const http::request<Body, http::basic_fields<Allocator>> &req,
+              Send &&send);
+
+  // if the etag in the If-None-Match list, weak compared
+  static bool EtagMatch(beast::string_view list, const std::string &etag);
+
+ private:
+  struct Variant {
+    std::shared_ptr<const std::string> data;
+    std::string etag;
+  };
+
+  struct File {
+    std::string mime;
+    uint64_t size;
+    int64_t mtime;
+    std::string etag;
+    std::shared_ptr<const std::string> data;  // nullptr if not cached
+    Variant br;
+    Variant gz;
+  };
+
+  struct Entry {
+    // the stat and the load of the path, the others of it wait
+    std::mutex mutex;
+    // under the cache lock
+    std::shared_ptr<const File> file;
+    std::chrono::steady_clock::time_point checked;
+  };
+
+  // the file of the path, checked by the mtime, nullptr if not found
+  //  stated and loaded out of the cache lock, by one thread per path
+  std::shared_ptr<const File> Get(const std::string &path);
+  // the bytes reserved under the cache lock, nullptr if over the limits
+  std::shared_ptr<const std::string> Read(const std::string &path,
+                                          uint64_t size);
+  void Release(const std::shared_ptr<const File> &f);
+
+  static bool Stat(const std::string &path, uint64_t *size, int64_t *mtime);
+  static bool AcceptEncoding(beast::string_view list, beast::string_view enc);
+  // false if not a single range, else n 0 if not satisfiable
+  static bool ParseRange(beast::string_view range, uint64_t size,
+                         uint64_t *offset, uint64_t *n);
+
+  std::string doc_root_;
+  StaticCacheOptions options_;
+
+  std::unordered_map<std::string, std::shared_ptr<Entry>> entries_;
+  std::size_t bytes_;
+  // the entries and the bytes only, never held by the file io
+  std::mutex mutex_;
+};
+
+template <class Body, class Allocator, class Send>
+bool StaticCache::Handle(
+    const http::request<Body, http::basic_fields<Allocator>> &req,
+    Send &&send) {
+  if (req.method() != http::verb::get && req.method() != http::verb::head)
+    return false;
+  auto target = req.target();
+  if (target.empty() || target[0] != '/' ||
+      target.find("..") != beast::string_view::npos || doc_root_.empty())
+    return false;
+  // the query, e.g. ?v=<hash> to bust the browser caches
+  auto pos = target.find('?');
+  if (pos != beast::string_view::npos) target = target.substr(0, pos);
+
+  auto path = path_cat(doc_root_, target);
+  if (target.back() == '/') path.append("index.html");
+  auto file = Get(path);
+  if (file == nullptr) return false;
+
+  // the precompressed variant if accepted, but the ranges of the identity
+  auto range = req[http::field::range];
+  auto data = file->data;
+  auto etag = file->etag;
+  auto size = file->size;
+  beast::string_view encoding;
+  auto accept = req[http::field::accept_encoding];
+  if (range.empty() && data != nullptr) {
+    if (file->br.data != nullptr && AcceptEncoding(accept, "br")) {
+      data = file->br.data;
+      etag = file->br.etag;
+      encoding = "br";
+    } else if (file->gz.data != nullptr && AcceptEncoding(accept, "gzip")) {
+      data = file->gz.data;
+      etag = file->gz.etag;
+      encoding = "gzip";
+    }
+    size = data->size();
+  }
+  auto vary = file->br.data != nullptr || file->gz.data != nullptr;
+
+  auto set_headers = [&](http::response_header<> &res) {
+    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+    res.set(http::field::etag, etag);
+    res.set(http::field::cache_control, options_.cache_control);
+    if (vary) res.set(http::field::vary, "Accept-Encoding");
+  };
+
+  auto inm = req[http::field::if_none_match];
+  if (!inm.empty() && EtagMatch(inm, etag)) {
+    http::response<http::empty_body> res{
+        http::status::not_modified, req.version()};
+    set_headers(res);
+    res.keep_alive(req.keep_alive());
+    send(std::move(res));
+    return true;
+  }
+
+  // the ranges of the large file streamed by sendfile only
+  auto by_sendfile = data == nullptr && can_send_file(send);
+  auto status = http::status::ok;
+  uint64_t offset = 0, n = size;
+  auto if_range = req[http::field::if_range];
+  if (!range.empty() && (data != nullptr || by_sendfile) &&
+      (if_range.empty() || if_range == etag) &&
+      ParseRange(range, size, &offset, &n)) {
+    if (n == 0) {
+      http::response<http::empty_body> res{
+          http::status::range_not_satisfiable, req.version()};
+      set_headers(res);
+      res.set(http::field::content_range,
+          "bytes */" + std::to_string(size));
+      res.content_length(0);
+      res.keep_alive(req.keep_alive());
+      send(std::move(res));
+      return true;
+    }
+    status = http::status::partial_content;
+  }
+
+  http::response<http::empty_body> head{status, req.version()};
+  set_headers(head);
+  head.set(http::field::content_type, file->mime);
+  head.set(http::field::accept_ranges, "bytes");
+  head.set("Cross-Origin-Embedder-Policy", "require-corp");
+  head.set("Cross-Origin-Opener-Policy", "same-origin");
+  if (!encoding.empty()) head.set(http::field::content_encoding, encoding);
+  if (status == http::status::partial_content) {
+    head.set(http::field::content_range, "bytes " + std::to_string(offset) +
+        "-" + std::to_string(offset + n - 1) + "/" + std::to_string(size));
+  }
+  head.content_length(n);
+  head.keep_alive(req.keep_alive());
+
+  if (req.method() == http::verb::head) {
+    send(std::move(head));
+    return true;
+  }
+  if (data != nullptr) {
+    http::response<http::span_body<char const>> res{
+        std::move(head.base()),
+        http::span_body<char const>::value_type{data->data() + offset,
+            static_cast<std::size_t>(n)}};
+    send(std::move(res));
+    return true;
+  }
+  if (by_sendfile) {
+    send_file(send, std::move(head), path, offset, n);
+    return true;
+  }
+  // the large file, read by the io thread
+  beast::error_code ec;
+  http::file_body::value_type body;
+  body.open(path.c_str(), beast::file_mode::scan, ec);
+  if (ec) return false;
+  http::response<http::file_body> res{
+      std::move(head.base()), std::move(body)};
+  res.content_length(res.body().size());
+  send(std::move(res));
+  return true;
+}
+
+inline std::shared_ptr<const StaticCache::File> StaticCache::Get(
+    const std::string &path) {
+  using clock = std::chrono::steady_clock;
+  auto check = std::chrono::milliseconds(options_.check_ms);
+  std::shared_ptr<Entry> entry;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    auto &&e = entries_[path];
+    if (e == nullptr) {
+      e = std::make_shared<Entry>();
+    } else if (e->file != nullptr && clock::now() - e->checked < check) {
+      return e->file;
+    }
+    entry = e;
+  }
+
+  std::lock_guard<std::mutex> load(entry->mutex);
+  std::shared_ptr<const File> old;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    // checked by the other one while waiting
+    if (entry->file != nullptr && clock::now() - entry->checked < check) {
+      return entry->file;
+    }
+    old = entry->file;
+  }
+
+  uint64_t size;
+  int64_t mtime;
+  auto found = Stat(path, &size, &mtime);
+  if (old != nullptr && found && old->size == size && old->mtime == mtime) {
+    std::lock_guard<std::mutex> _(mutex_);
+    entry->checked = clock::now();
+    return old;
+  }
+  // changed or removed, the old one kept by the responses not done
+  if (old != nullptr) Release(old);
+
+  std::shared_ptr<File> f = nullptr;
+  if (found) {
+    f = std::make_shared<File>();
+    f->mime = std::string(mime_type(path));
+    f->size = size;
+    f->mtime = mtime;
+    char etag[48];
+    std::snprintf(etag, sizeof(etag), "\"%llx-%llx\"",
+        static_cast<unsigned long long>(mtime),  // NOLINT
+        static_cast<unsigned long long>(size));  // NOLINT
+    f->etag = etag;
+    f->data = Read(path, size);
+    if (f->data != nullptr) {
+      // the variants of the same content, not older than it
+      auto variant = [this, &f, &path](const char *ext, Variant *v) {
+        uint64_t n;
+        int64_t t;
+        if (!Stat(path + ext, &n, &t) || t < f->mtime) return;
+        v->data = Read(path + ext, n);
+        if (v->data == nullptr) return;
+        v->etag = f->etag;
+        v->etag.insert(v->etag.size() - 1, ext);
+      };
+      variant(".br", &f->br);
+      variant(".gz", &f->gz);
+    }
+  }
+
+  std::lock_guard<std::mutex> _(mutex_);
+  entry->file = f;
+  entry->checked = clock::now();
+  if (f == nullptr) {
+    // not kept, not to grow by the paths not found
+    auto it = entries_.find(path);
+    if (it != entries_.end() && it->second == entry) entries_.erase(it);
+  }
+  return f;
+}
+
+inline std::shared_ptr<const std::string> StaticCache::Read(
+    const std::string &path, uint64_t size) {
+  if (size > options_.file_max_bytes) return nullptr;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (bytes_ + size > options_.max_bytes) return nullptr;
+    bytes_ += size;
+  }
+  std::shared_ptr<std::string> data = nullptr;
+  std::ifstream ifs(path, std::ios::binary);
+  if (ifs.is_open()) {
+    data = std::make_shared<std::string>();
+    data->reserve(static_cast<std::size_t>(size));
+    data->assign(std::istreambuf_iterator<char>(ifs),
+                 std::istreambuf_iterator<char>());
+    if (data->size() != size) data = nullptr;  // changing, stat next time
+  }
+  if (data == nullptr) {
+    std::lock_guard<std::mutex> _(mutex_);
+    bytes_ -= size;
+  }
+  return data;
+}
+
+inline void StaticCache::Release(const std::shared_ptr<const File> &f) {
+  std::lock_guard<std::mutex> _(mutex_);
+  for (auto &&d : {f->data, f->br.data, f->gz.data}) {
+    if (d != nullptr) bytes_ -= d->size();
+  }
+}
+
+inline bool StaticCache::Stat(const std::string &path,
+    uint64_t *size, int64_t *mtime) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  *size = static_cast<uint64_t>(st.st_size);
+#ifdef __linux__
+  *mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+      st.st_mtim.tv_nsec;
+#else
+  *mtime = static_cast<int64_t>(st.st_mtime) * 1000000000;
+#endif
+  return true;
+}
+
+inline bool StaticCache::EtagMatch(beast::string_view list,
+    const std::string &etag) {
+  if (list == "*") return true;
+  // the weak comparison, W/ ignored
+  std::size_t pos = 0;
+  while (pos < list.size()) {
+    auto end = list.find(',', pos);
+    if (end == beast::string_view::npos) end = list.size();
+    auto tag = list.substr(pos, end - pos);
+    while (!tag.empty() && tag.front() == ' ') tag.remove_prefix(1);
+    while (!tag.empty() && tag.back() == ' ') tag.remove_suffix(1);
+    if (tag.starts_with("W/")) tag.remove_prefix(2);
+    if (tag == etag) return true;
+    pos = end + 1;
+  }
+  return false;
+}
+
+inline bool StaticCache::AcceptEncoding(beast::string_view list,
+    beast::string_view enc) {
+  for (auto &&e : http::ext_list{list}) {
+    if (!beast::iequals(e.first, enc)) continue;
+    for (auto &&p : e.second) {
+      if (beast::iequals(p.first, "q") &&
+          std::strtod(std::string(p.second).c_str(), nullptr) <= 0) {
+        return false;
+      }
+    }
+    return true;
+  }
+  return false;
+}
+
+inline bool StaticCache::ParseRange(beast::string_view range, uint64_t size,
+    uint64_t *offset, uint64_t *n) {
+  if (!range.starts_with("bytes=")) return false;
+  range.remove_prefix(6);
+  if (range.find(',') != beast::string_view::npos) return false;
+  auto dash = range.find('-');
+  if (dash == beast::string_view::npos) return false;
+  auto parse = [](beast::string_view s, uint64_t *v) {
+    if (s.empty() || s.size() > 19) return false;
+    *v = 0;
+    for (auto c : s) {
+      if (c < '0' || c > '9') return false;
+      *v = *v * 10 + (c - '0');
+    }
+    return true;
+  };
+  uint64_t first, last;
+  auto s_first = range.substr(0, dash), s_last = range.substr(dash + 1);
+  if (s_first.empty()) {
+    // the suffix, the last n bytes
+    if (!parse(s_last, &last)) return false;
+    if (last == 0 || size == 0) {
+      *n = 0;
+      return true;
+    }
+    *n = std::min(last, size);
+    *offset = size - *n;
+    return true;
+  }
+  if (!parse(s_first, &first)) return false;
+  if (s_last.empty()) {
+    last = size - 1;
+  } else if (!parse(s_last, &last) || last < first) {
+    return false;
+  }
+  if (first >= size) {
+    *n = 0;
+    return true;
+  }
+  *offset = first;
+  *n = std::min(last, size - 1) - first + 1;
+  return true;
+}
+
+}  // namespace net
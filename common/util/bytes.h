@@ -2,7 +2,9 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <string>
+#include <type_traits>
 
 namespace bytes {
 
@@ -63,12 +65,14 @@ size_t toc(byte_t *bytes, T value) {
 
 template <typename T>
 T from(const byte_t *bytes) {
+  // shift in unsigned and wide enough, not overflow the promoted int
+  using U = typename std::make_unsigned<T>::type;
   size_t size = sizeof(T) / sizeof(byte_t);
-  T value = 0;
+  U value = 0;
   for (size_t i = 0; i < size; i++) {  // big endian
-    value |= bytes[i] << (8 * (size - i - 1));
+    value |= static_cast<U>(bytes[i]) << (8 * (size - i - 1));
   }
-  return value;
+  return static_cast<T>(value);
 }
 
 template <>
@@ -109,4 +113,111 @@ C fromc(const byte_t *bytes) {
   return static_cast<C>(from<T>(bytes));
 }
 
+// fast big endian, memcpy and bswap instead of shift loops
+
+inline std::uint16_t bswap(std::uint16_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap16(v);
+#else
+  return static_cast<std::uint16_t>((v >> 8) | (v << 8));
+#endif
+}
+
+inline std::uint32_t bswap(std::uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap32(v);
+#else
+  return ((v & 0xff000000u) >> 24) | ((v & 0x00ff0000u) >> 8) |
+         ((v & 0x0000ff00u) << 8)  | ((v & 0x000000ffu) << 24);
+#endif
+}
+
+inline std::uint64_t bswap(std::uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap64(v);
+#else
+  return (static_cast<std::uint64_t>(bswap(static_cast<std::uint32_t>(v)))
+      << 32) | bswap(static_cast<std::uint32_t>(v >> 32));
+#endif
+}
+
+inline constexpr bool is_little_endian() {
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return false;
+#else
+  return true;
+#endif
+}
+
+template <typename T>
+size_t to_be(byte_t *bytes, T value) {
+  static_assert(std::is_integral<T>::value && sizeof(T) >= 2, "int16+ only");
+  using U = typename std::make_unsigned<T>::type;
+  U v = static_cast<U>(value);
+  if (is_little_endian()) v = bswap(v);
+  std::memcpy(bytes, &v, sizeof(v));
+  return sizeof(v);
+}
+
+template <typename T>
+T from_be(const byte_t *bytes) {
+  static_assert(std::is_integral<T>::value && sizeof(T) >= 2, "int16+ only");
+  using U = typename std::make_unsigned<T>::type;
+  U v;
+  std::memcpy(&v, bytes, sizeof(v));
+  if (is_little_endian()) v = bswap(v);
+  return static_cast<T>(v);
+}
+
+// varint, 7 bits a byte, little end first, at most 10 bytes
+
+constexpr size_t kVarintMaxSize = 10;
+
+inline
+size_t to_varint(byte_t *bytes, std::uint64_t value) {
+  size_t i = 0;
+  while (value >= 0x80) {
+    bytes[i++] = static_cast<byte_t>(value | 0x80);
+    value >>= 7;
+  }
+  bytes[i++] = static_cast<byte_t>(value);
+  return i;
+}
+
+inline
+size_t varint_size(std::uint64_t value) {
+  size_t n = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++n;
+  }
+  return n;
+}
+
+// return the bytes read, 0 if not enough or overlong
+inline
+size_t from_varint(const byte_t *bytes, size_t bytes_n, std::uint64_t *value) {
+  std::uint64_t v = 0;
+  for (size_t i = 0; i < bytes_n && i < kVarintMaxSize; i++) {
+    v |= static_cast<std::uint64_t>(bytes[i] & 0x7f) << (7 * i);
+    if (!(bytes[i] & 0x80)) {
+      *value = v;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+// zigzag, small negatives as small unsigned: 0, -1, 1, -2 > 0, 1, 2, 3
+
+inline constexpr std::uint64_t zigzag(std::int64_t v) {
+  return (static_cast<std::uint64_t>(v) << 1) ^
+      static_cast<std::uint64_t>(v >> 63);
+}
+
+inline constexpr std::int64_t unzigzag(std::uint64_t v) {
+  return static_cast<std::int64_t>((v >> 1) ^ (~(v & 1) + 1));
+}
+
 }  // namespace bytes
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// the metrics in the prometheus text format, updated lock free by the hot
+//  paths, the registry locked only by the creation and the scrape
+namespace metrics {
+
+using labels_t = std::vector<std::pair<std::string, std::string>>;
+
+class Metric {
+ public:
+  virtual ~Metric() = default;
+  // the samples of it, name{labels} value per line
+  virtual void Write(std::string *out, const std::string &name,
+                     const std::string &labels) const = 0;
+};
+
+class Counter : public Metric {
+ public:
+  Counter() : value_(0) {}
+
+  void Add(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+  uint64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+  void Write(std::string *out, const std::string &name,
+             const std::string &labels) const override;
+
+ private:
+  std::atomic<uint64_t> value_;
+};
+
+class Gauge : public Metric {
+ public:
+  Gauge() : value_(0) {}
+
+  void Set(int64_t v) { value_.store(v, std::memory_order_relaxed); }
+  void Add(int64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+  int64_t Value() const { return value_.load(std::memory_order_relaxed); }
+
+  void Write(std::string *out, const std::string &name,
+             const std::string &labels) const override;
+
+ private:
+  std::atomic<int64_t> value_;
+};
+
+// the fixed buckets of the integer values (e.g. us), exported * scale
+//  (e.g. 1e-6 as seconds)
+class Histogram : public Metric {
+ public:
+  Histogram(std::vector<int64_t> bounds, double scale = 1);
+
+  void Observe(int64_t v);
+
+  void Write(std::string *out, const std::string &name,
+             const std::string &labels) const override;
+
+  // 0.5ms ~ 10s, in us
+  static std::vector<int64_t> LatencyBounds() {
+    return {500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+            500000, 1000000, 2500000, 5000000, 10000000};
+  }
+
+ private:
+  std::vector<int64_t> bounds_;
+  double scale_;
+  // the last one is +Inf
+  std::unique_ptr<std::atomic<uint64_t>[]> buckets_;
+  std::atomic<uint64_t> count_;
+  std::atomic<int64_t> sum_;
+};
+
+class Registry {
+ public:
+  static Registry &Instance() {
+    static Registry instance;
+    return instance;
+  }
+
+  // the same one if the name and the labels are the same
+  //  throw std::invalid_argument if the name is of another type
+  std::shared_ptr<Counter> GetCounter(const std::string &name,
+      const std::string &help, const labels_t &labels = {});
+  std::shared_ptr<Gauge> GetGauge(const std::string &name,
+      const std::string &help, const labels_t &labels = {});
+  std::shared_ptr<Histogram> GetHistogram(const std::string &name,
+      const std::string &help, const std::vector<int64_t> &bounds,
+      double scale = 1, const labels_t &labels = {});
+
+  // the text format 0.0.4, with the process ones
+  std::string Serialize() const;
+
+  static constexpr const char *kContentType =
+      "text/plain; version=0.0.4; charset=utf-8";
+
+ private:
+  Registry() = default;
+  Registry(const Registry &) = delete;
+  Registry &operator=(const Registry &) = delete;
+
+  struct Family {
+    std::string type;
+    std::string help;
+    std::map<std::string, std::shared_ptr<Metric>> metrics;  // by labels
+  };
+
+  template <typename T, typename Create>
+  std::shared_ptr<T> Get(const std::string &name, const std::string &type,
+      const std::string &help, const labels_t &labels, Create create);
+
+  static std::string ToString(const labels_t &labels);
+  static void WriteProcess(std::string *out);
+
+  std::map<std::string, Family> families_;
+  mutable std::mutex mutex_;
+};
+
+// helpers
+
+namespace detail {
+
+inline void append(std::string *out, double v) {
+  char s[32];
+  std::snprintf(s, sizeof(s), "%.6g", v);
+  out->append(s);
+}
+
+inline void append_sample(std::string *out, const std::string &name,
+    const std::string &labels, const std::string &value) {
+  out->append(name);
+  if (!labels.empty()) out->append("{").append(labels).append("}");
+  out->append(" ").append(value).append("\n");
+}
+
+}  // namespace detail
+
+// Counter, Gauge
+
+inline void Counter::Write(std::string *out, const std::string &name,
+    const std::string &labels) const {
+  detail::append_sample(out, name, labels, std::to_string(Value()));
+}
+
+inline void Gauge::Write(std::string *out, const std::string &name,
+    const std::string &labels) const {
+  detail::append_sample(out, name, labels, std::to_string(Value()));
+}
+
+// Histogram
+
+inline Histogram::Histogram(std::vector<int64_t> bounds, double scale)
+  : bounds_(std::move(bounds)), scale_(scale),
+    buckets_(new std::atomic<uint64_t>[bounds_.size() + 1]),
+    count_(0), sum_(0) {
+  std::sort(bounds_.begin(), bounds_.end());
+  for (std::size_t i = 0; i <= bounds_.size(); ++i) buckets_[i] = 0;
+}
+
+inline void Histogram::Observe(int64_t v) {
+  // the bounds are few, the linear search is enough
+  std::size_t i = 0;
+  while (i < bounds_.size() && v > bounds_[i]) ++i;
+  buckets_[i].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(v, std::memory_order_relaxed);
+}
+
+inline void Histogram::Write(std::string *out, const std::string &name,
+    const std::string &labels) const {
+  auto sep = labels.empty() ? "" : ",";
+  uint64_t n = 0;
+  for (std::size_t i = 0; i <= bounds_.size(); ++i) {
+    n += buckets_[i].load(std::memory_order_relaxed);
+    std::string le;
+    if (i < bounds_.size()) {
+      detail::append(&le, bounds_[i] * scale_);
+    } else {
+      le = "+Inf";
+    }
+    detail::append_sample(out, name + "_bucket",
+        labels + sep + "le=\"" + le + "\"", std::to_string(n));
+  }
+  std::string sum;
+  detail::append(&sum, sum_.load(std::memory_order_relaxed) * scale_);
+  detail::append_sample(out, name + "_sum", labels, sum);
+  // not less than the buckets, if observed while writing
+  detail::append_sample(out, name + "_count", labels, std::to_string(
+      std::max(n, count_.load(std::memory_order_relaxed))));
+}
+
+// Registry
+
+template <typename T, typename Create>
+std::shared_ptr<T> Registry::Get(const std::string &name,
+    const std::string &type, const std::string &help, const labels_t &labels,
+    Create create) {
+  std::lock_guard<std::mutex> _(mutex_);
+  auto &&family = families_[name];
+  if (family.type.empty()) {
+    family.type = type;
+    family.help = help;
+  } else if (family.type != type) {
+    throw std::invalid_argument("metric " + name + " is a " + family.type);
+  }
+  auto &&metric = family.metrics[ToString(labels)];
+  if (metric == nullptr) metric = create();
+  return std::static_pointer_cast<T>(metric);
+}
+
+inline std::shared_ptr<Counter> Registry::GetCounter(const std::string &name,
+    const std::string &help, const labels_t &labels) {
+  return Get<Counter>(name, "counter", help, labels,
+      []() { return std::make_shared<Counter>(); });
+}
+
+inline std::shared_ptr<Gauge> Registry::GetGauge(const std::string &name,
+    const std::string &help, const labels_t &labels) {
+  return Get<Gauge>(name, "gauge", help, labels,
+      []() { return std::make_shared<Gauge>(); });
+}
+
+inline std::shared_ptr<Histogram> Registry::GetHistogram(
+    const std::string &name, const std::string &help,
+    const std::vector<int64_t> &bounds, double scale, const labels_t &labels) {
+  return Get<Histogram>(name, "histogram", help, labels,
+      [&bounds, scale]() { return std::make_shared<Histogram>(bounds, scale); });
+}
+
+inline std::string Registry::Serialize() const {
+  std::string out;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    for (auto &&f : families_) {
+      out.append("# HELP ").append(f.first).append(" ")
+          .append(f.second.help).append("\n");
+      out.append("# TYPE ").append(f.first).append(" ")
+          .append(f.second.type).append("\n");
+      for (auto &&m : f.second.metrics) {
+        m.second->Write(&out, f.first, m.first);
+      }
+    }
+  }
+  WriteProcess(&out);
+  return out;
+}
+
+inline std::string Registry::ToString(const labels_t &labels) {
+  std::string s;
+  for (auto &&l : labels) {
+    if (!s.empty()) s += ',';
+    s.append(l.first).append("=\"");
+    for (auto c : l.second) {
+      if (c == '\\' || c == '"') {
+        s += '\\';
+        s += c;
+      } else if (c == '\n') {
+        s += "\\n";
+      } else {
+        s += c;
+      }
+    }
+    s += '"';
+  }
+  return s;
+}
+
+// the threads and the memory, read from /proc when scraped, linux only
+inline void Registry::WriteProcess(std::string *out) {
+#ifdef __linux__
+  std::ifstream status("/proc/self/status");
+  if (!status) return;
+  int64_t rss_kb = -1, vm_kb = -1, threads = -1;
+  std::string key;
+  while (status >> key) {
+    if (key == "VmRSS:") {
+      status >> rss_kb;
+    } else if (key == "VmSize:") {
+      status >> vm_kb;
+    } else if (key == "Threads:") {
+      status >> threads;
+    }
+    status.ignore(256, '\n');
+  }
+  auto write = [out](const char *name, const char *help, int64_t v) {
+    if (v < 0) return;
+    out->append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out->append("# TYPE ").append(name).append(" gauge\n");
+    detail::append_sample(out, name, "", std::to_string(v));
+  };
+  write("process_resident_memory_bytes", "Resident memory size in bytes.",
+        rss_kb < 0 ? -1 : rss_kb * 1024);
+  write("process_virtual_memory_bytes", "Virtual memory size in bytes.",
+        vm_kb < 0 ? -1 : vm_kb * 1024);
+  write("process_threads", "Number of OS threads in the process.", threads);
+#else
+  (void)out;
+#endif
+}
+
+}  // namespace metrics
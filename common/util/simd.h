@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define UTIL_SIMD_SSE2
+# include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+# define UTIL_SIMD_NEON
+# include <arm_neon.h>
+#endif
+
+namespace simd {
+
+// sum of absolute differences of two byte arrays
+inline
+std::uint32_t sad_u8(const std::uint8_t *a, const std::uint8_t *b,
+                     std::size_t n) {
+  std::size_t i = 0;
+  std::uint32_t sum = 0;
+#if defined(UTIL_SIMD_SSE2)
+  __m128i acc = _mm_setzero_si128();
+  for (; i + 16 <= n; i += 16) {
+    __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+  }
+  sum = static_cast<std::uint32_t>(
+      _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+#elif defined(UTIL_SIMD_NEON)
+  uint32x4_t acc = vdupq_n_u32(0);
+  for (; i + 16 <= n; i += 16) {
+    uint8x16_t diff = vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i));
+    acc = vpadalq_u16(acc, vpaddlq_u8(diff));
+  }
+  uint64x2_t acc64 = vpaddlq_u32(acc);
+  sum = static_cast<std::uint32_t>(
+      vgetq_lane_u64(acc64, 0) + vgetq_lane_u64(acc64, 1));
+#endif
+  for (; i < n; ++i) {
+    sum += (a[i] > b[i]) ? (a[i] - b[i]) : (b[i] - a[i]);
+  }
+  return sum;
+}
+
+// downscale a byte plane by 8x, each dst byte is the mean of a 8x8 block
+//  dst size: (width / 8) x (height / 8), the remainder is ignored
+inline
+void downscale8_u8(const std::uint8_t *src, int src_stride,
+                   int width, int height,
+                   std::uint8_t *dst, int dst_stride) {
+  const int dst_w = width / 8;
+  const int dst_h = height / 8;
+  for (int y = 0; y < dst_h; ++y) {
+    const std::uint8_t *s =
+        src + static_cast<std::ptrdiff_t>(y) * 8 * src_stride;
+    std::uint8_t *d = dst + static_cast<std::ptrdiff_t>(y) * dst_stride;
+    int x = 0;
+#if defined(UTIL_SIMD_SSE2)
+    // two blocks a time, psadbw against zero sums each 8 bytes
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 2 <= dst_w; x += 2) {
+      __m128i acc = _mm_setzero_si128();
+      for (int r = 0; r < 8; ++r) {
+        __m128i v = _mm_loadu_si128(
+            reinterpret_cast<const __m128i *>(s + r * src_stride + x * 8));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+      }
+      d[x] = static_cast<std::uint8_t>((_mm_cvtsi128_si32(acc) + 32) >> 6);
+      d[x + 1] = static_cast<std::uint8_t>(
+          (_mm_cvtsi128_si32(_mm_srli_si128(acc, 8)) + 32) >> 6);
+    }
+#elif defined(UTIL_SIMD_NEON)
+    for (; x + 2 <= dst_w; x += 2) {
+      uint16x8_t acc = vdupq_n_u16(0);
+      for (int r = 0; r < 8; ++r) {
+        acc = vpadalq_u8(acc, vld1q_u8(s + r * src_stride + x * 8));
+      }
+      uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(acc));
+      d[x] = static_cast<std::uint8_t>((vgetq_lane_u64(sum, 0) + 32) >> 6);
+      d[x + 1] = static_cast<std::uint8_t>((vgetq_lane_u64(sum, 1) + 32) >> 6);
+    }
+#endif
+    for (; x < dst_w; ++x) {
+      std::uint32_t sum = 0;
+      for (int r = 0; r < 8; ++r) {
+        const std::uint8_t *p = s + r * src_stride + x * 8;
+        for (int c = 0; c < 8; ++c) sum += p[c];
+      }
+      d[x] = static_cast<std::uint8_t>((sum + 32) >> 6);
+    }
+  }
+}
+
+}  // namespace simd
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "common/net/asio.hpp"
+#include "common/net/packet.h"
+
+#include "rtsp-ws-proxy/ws_stream_room.h"
+
+// the session of the benches, as WsStreamSession to WsStreamRoomBase, but
+//  only counts the sends on the strand, without the websocket writes
+class CountingSession {
+ public:
+  using strand_t = asio::strand<asio::io_context::executor_type>;
+  // on the strand, by the send
+  using on_sent_t = std::function<void(const WsSendMeta &meta)>;
+
+  explicit CountingSession(const strand_t &strand,
+      int data_ver = net::DATA_VERSION_1, on_sent_t on_sent = nullptr)
+    : strand_(strand), data_ver_(data_ver), on_sent_(std::move(on_sent)) {}
+
+  const strand_t &GetStrand() const { return strand_; }
+
+  int GetDataVersion() const { return data_ver_; }
+  bool IsBatchEnabled() const { return false; }
+  bool IsInitEnabled() const { return false; }
+  bool IsTimeEnabled() const { return false; }
+  bool IsFmp4() const { return false; }
+  bool IsMux() const { return false; }
+
+  bool Accept(const std::string &, AVMediaType, bool, uint32_t *epoch) {
+    *epoch = 0;
+    return true;
+  }
+  void SendInit(const std::shared_ptr<net::DataBatch> &) {}
+
+  void SendOnStrand(const std::shared_ptr<net::DataRef> &data,
+                    const std::shared_ptr<net::DataBatch> &message,
+                    const WsSendMeta &meta, uint32_t) {
+    // kept as queued, until the next one
+    data_ = data;
+    message_ = message;
+    sent_.fetch_add(1, std::memory_order_relaxed);
+    if (on_sent_) on_sent_(meta);
+  }
+
+  uint64_t GetSent() const { return sent_; }
+
+ private:
+  strand_t strand_;
+  int data_ver_;
+  on_sent_t on_sent_;
+
+  std::shared_ptr<net::DataRef> data_;
+  std::shared_ptr<net::DataBatch> message_;
+  std::atomic<uint64_t> sent_{0};
+};
+
+using CountingRoom = WsStreamRoomBase<CountingSession>;
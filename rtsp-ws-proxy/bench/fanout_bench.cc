@@ -0,0 +1,156 @@
+// Fan-out cost of the room posts per packet, per session vs per strand
+//  fanout_bench [packets] [sessions] [threads]
+//
+// The room is WsStreamRoomBase as the server, its Send serializes and posts
+//  the packet, the sessions only count the sends on the strands, so the
+//  numbers are of the fan-out, without the websocket writes:
+//  session: a strand per session, a post per session per packet
+//  strand: the strands shared by the sessions, a post per strand per packet
+// The allocations are of the Send per packet, the handlers posted and the
+//  datas, the latency of a packet is from the send to the last session
+//  queued it.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <thread>
+#include <vector>
+
+#include "common/net/asio.hpp"
+#include "common/net/packet.h"
+
+#include "counting_session.h"
+
+namespace {
+
+std::atomic<uint64_t> g_allocs{0};
+
+}  // namespace
+
+void *operator new(std::size_t n) {
+  g_allocs.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(n)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+
+// the latencies of the packets by the pts, done by the last session queued it
+//  allocated before the sends, not counted
+class Latency {
+ public:
+  Latency(int packets, int sessions_n)
+    : packets_(new Packet[packets]), values_(packets, 0) {
+    for (int i = 0; i < packets; ++i) packets_[i].left = sessions_n;
+  }
+
+  void Sent(int64_t pts) { packets_[pts].time = steady_clock::now(); }
+
+  void Done(int64_t pts) {
+    auto &&p = packets_[pts];
+    if (p.left.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+    values_[pts] = std::chrono::duration<double, std::micro>(
+        steady_clock::now() - p.time).count();
+  }
+
+  double Percentile(double p) {
+    std::sort(values_.begin(), values_.end());
+    auto i = static_cast<std::size_t>(p * (values_.size() - 1));
+    return values_[i];
+  }
+
+ private:
+  struct Packet {
+    steady_clock::time_point time;
+    std::atomic<int> left;
+  };
+  std::unique_ptr<Packet[]> packets_;
+  std::vector<double> values_;
+};
+
+AVPacket *MakePacket(int size) {
+  auto p = av_packet_alloc();
+  av_new_packet(p, size);
+  std::memset(p->data, 0x5a, size);
+  p->pts = p->dts = 0;
+  return p;
+}
+
+void Bench(const char *name, bool shared, int packets,
+    int sessions_n, int threads_n) {
+  asio::io_context ioc(threads_n);
+  auto work = asio::make_work_guard(ioc);
+
+  Latency latency(packets, sessions_n);
+  CountingRoom room(shared ? threads_n : sessions_n);
+  std::vector<std::shared_ptr<CountingSession>> sessions;
+  for (int i = 0; i < sessions_n; ++i) {
+    sessions.push_back(std::make_shared<CountingSession>(
+        room.GetStrand(ioc.get_executor()), net::DATA_VERSION_1,
+        [&latency](const WsSendMeta &meta) { latency.Done(meta.pts); }));
+    room.Join("stream", sessions.back());
+  }
+
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threads_n; ++i) {
+    threads.emplace_back([&ioc]() { ioc.run(); });
+  }
+
+  auto packet = MakePacket(8 * 1024);
+  auto allocs_beg = g_allocs.load();
+  auto t_beg = steady_clock::now();
+  for (int n = 0; n < packets; ++n) {
+    packet->pts = packet->dts = n;
+    packet->flags = (n % 50 == 0) ? AV_PKT_FLAG_KEY : 0;
+    latency.Sent(n);
+    room.Send("stream", AVMEDIA_TYPE_VIDEO, packet);
+    // the frame interval, not to measure the queueing only
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  work.reset();
+  for (auto &&t : threads) t.join();
+  auto t_end = steady_clock::now();
+  auto allocs = g_allocs.load() - allocs_beg;
+  av_packet_free(&packet);
+
+  uint64_t sent = 0;
+  for (auto &&s : sessions) sent += s->GetSent();
+  auto ms = std::chrono::duration<double, std::milli>(t_end - t_beg).count();
+  std::cout << std::setw(8) << name
+      << "  total=" << std::fixed << std::setprecision(1)
+      << std::setw(8) << ms << "ms"
+      << "  allocs per packet=" << std::setw(8)
+      << static_cast<double>(allocs) / packets
+      << "  p50=" << std::setw(7) << latency.Percentile(0.5) << "us"
+      << "  p99=" << std::setw(7) << latency.Percentile(0.99) << "us"
+      << "  sends=" << sent
+      << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  int packets = argc >= 2 ? std::atoi(argv[1]) : 1000;
+  int sessions_n = argc >= 3 ? std::atoi(argv[2]) : 1000;
+  int threads_n = argc >= 4 ? std::atoi(argv[3]) :
+      static_cast<int>(std::thread::hardware_concurrency());
+  if (packets <= 0) packets = 1000;
+  if (sessions_n <= 0) sessions_n = 1000;
+  if (threads_n <= 0) threads_n = 1;
+  std::cout << "packets: " << packets
+      << ", sessions: " << sessions_n
+      << ", threads: " << threads_n << std::endl;
+  Bench("session", false, packets, sessions_n, threads_n);
+  Bench("strand", true, packets, sessions_n, threads_n);
+  return 0;
+}
@@ -0,0 +1,99 @@
+// Encode/decode cost of net::Data per packet, v1 vs v2
+//  packet_bench [iterations]
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common/net/packet.h"
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+
+struct Sample {
+  std::string name;
+  AVMediaType type;
+  int size;
+  int flags;
+  int64_t pts_step;
+};
+
+// typical packets of a 1080p h264 stream and an aac stream, 90kHz
+const std::vector<Sample> kSamples{
+  {"audio 256B", AVMEDIA_TYPE_AUDIO, 256, AV_PKT_FLAG_KEY, 1920},
+  {"video P 8KB", AVMEDIA_TYPE_VIDEO, 8 * 1024, 0, 3600},
+  {"video I 200KB", AVMEDIA_TYPE_VIDEO, 200 * 1024, AV_PKT_FLAG_KEY, 3600},
+};
+
+AVPacket *MakePacket(const Sample &s) {
+  auto p = av_packet_alloc();
+  av_new_packet(p, s.size);
+  std::memset(p->data, 0x5a, s.size);
+  p->pts = 90000 * 3600LL;  // 1 hour in
+  p->dts = p->pts;
+  p->flags = s.flags;
+  p->duration = s.pts_step;
+  p->pos = -1;
+  return p;
+}
+
+// ns per op
+double Measure(int n, const std::function<void()> &op) {
+  for (int i = 0; i < n / 10 + 1; ++i) op();  // warm up
+  auto t_beg = steady_clock::now();
+  for (int i = 0; i < n; ++i) op();
+  auto t_end = steady_clock::now();
+  return std::chrono::duration<double, std::nano>(t_end - t_beg).count() / n;
+}
+
+void Bench(const Sample &s, int n) {
+  auto packet = MakePacket(s);
+  net::Data data(s.type, packet);
+
+  std::cout << s.name << std::endl;
+  for (auto ver : {net::DATA_VERSION_1, net::DATA_VERSION_2}) {
+    auto bytes_n = data.GetByteSize(ver);
+    std::vector<uint8_t> bytes(bytes_n);
+
+    auto to_bytes = Measure(n, [&]() {
+      data.packet->pts += s.pts_step;
+      data.packet->dts = data.packet->pts;
+      data.ToBytes(bytes.data(), bytes.size(), ver);
+    });
+    // head and tail only, the packet data is ref'ed
+    auto data_ref = Measure(n, [&]() {
+      net::DataRef ref(s.type, packet, ver);
+    });
+    auto from_bytes = Measure(n, [&]() {
+      net::Data d;
+      d.FromBytes(bytes.data(), bytes.size());
+    });
+
+    std::cout << "  v" << ver
+        << "  overhead=" << std::setw(3) << (bytes_n - s.size) << "B"
+        << "  ToBytes=" << std::fixed << std::setprecision(1)
+        << std::setw(9) << to_bytes << "ns"
+        << "  DataRef=" << std::setw(7) << data_ref << "ns"
+        << "  FromBytes=" << std::setw(9) << from_bytes << "ns"
+        << std::endl;
+  }
+  av_packet_free(&packet);
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  int n = argc >= 2 ? std::atoi(argv[1]) : 100000;
+  if (n <= 0) n = 100000;
+  std::cout << "iterations: " << n << std::endl;
+  for (auto &&s : kSamples) {
+    Bench(s, n);
+  }
+  return 0;
+}
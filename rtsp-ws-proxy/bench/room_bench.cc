@@ -0,0 +1,143 @@
+// Fan-out cost of the room subscribers per packet, of WsStreamRoom itself
+//  room_bench [packets per stream] [sessions] [streams]
+//
+// The room is WsStreamRoomBase as the server, the sessions only count the
+//  sends on the strands, so the numbers are of the room, without the
+//  websocket writes:
+//  demand: the HasSubscribers of the server, by the stream handler per packet
+//  send: the demand, then the outputs and the room Send, as the server Send
+// One thread per stream sends, another joins and leaves meanwhile.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/net/asio.hpp"
+#include "common/net/packet.h"
+
+#include "rtsp-ws-proxy/stream_outputs.h"
+#include "counting_session.h"
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+
+AVPacket *MakePacket(int size) {
+  auto p = av_packet_alloc();
+  av_new_packet(p, size);
+  std::memset(p->data, 0x5a, size);
+  p->pts = p->dts = 0;
+  return p;
+}
+
+void Bench(const char *name, bool send, int packets,
+    int sessions_n, int streams_n) {
+  auto threads_n = std::max(
+      static_cast<int>(std::thread::hardware_concurrency()), 1);
+  asio::io_context ioc(threads_n);
+  auto work = asio::make_work_guard(ioc);
+
+  CountingRoom room(threads_n);
+  StreamOutputs outputs(std::chrono::seconds(10), std::chrono::seconds(10));
+  std::vector<std::string> ids;
+  for (int i = 0; i < streams_n; ++i) {
+    ids.push_back("stream" + std::to_string(i));
+  }
+  std::vector<std::shared_ptr<CountingSession>> sessions;
+  for (int i = 0; i < sessions_n; ++i) {
+    sessions.push_back(std::make_shared<CountingSession>(
+        room.GetStrand(ioc.get_executor())));
+    room.Join(ids[i % streams_n], sessions.back());
+  }
+
+  std::vector<std::thread> io_threads;
+  for (int i = 0; i < threads_n; ++i) {
+    io_threads.emplace_back([&ioc]() { ioc.run(); });
+  }
+
+  // the join and leave of the other sessions, while sending
+  std::atomic_bool done{false};
+  std::atomic<uint64_t> churns{0};
+  std::thread churn([&]() {
+    auto s = std::make_shared<CountingSession>(
+        room.GetStrand(ioc.get_executor()));
+    for (int i = 0; !done; ++i) {
+      auto &&id = ids[i % streams_n];
+      room.Join(id, s);
+      room.Leave(id, s);
+      churns.fetch_add(1, std::memory_order_relaxed);
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  });
+
+  std::atomic<uint64_t> demanded{0};
+  auto t_beg = steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < streams_n; ++i) {
+    threads.emplace_back([&, i]() {
+      auto &&id = ids[i];
+      auto packet = MakePacket(8 * 1024);
+      uint64_t n_demanded = 0;
+      for (int n = 0; n < packets; ++n) {
+        packet->pts = packet->dts = n;
+        packet->flags = (n % 50 == 0) ? AV_PKT_FLAG_KEY : 0;
+        // as WsStreamServer::HasSubscribers
+        if (!room.Empty(id) || outputs.IsDemanded(id)) ++n_demanded;
+        if (!send) continue;
+        // as WsStreamServer::Send, the outputs loaded once, none here
+        outputs.Get(id);
+        room.Send(id, AVMEDIA_TYPE_VIDEO, packet);
+      }
+      av_packet_free(&packet);
+      demanded.fetch_add(n_demanded, std::memory_order_relaxed);
+    });
+  }
+  for (auto &&t : threads) t.join();
+  auto t_sent = steady_clock::now();
+  done = true;
+  churn.join();
+  work.reset();
+  for (auto &&t : io_threads) t.join();
+  auto t_end = steady_clock::now();
+
+  uint64_t sent = 0;
+  for (auto &&s : sessions) sent += s->GetSent();
+  auto ns = std::chrono::duration<double, std::nano>(t_sent - t_beg).count();
+  auto ns_all = std::chrono::duration<double, std::nano>(t_end - t_beg).count();
+  auto packets_n = static_cast<double>(packets) * streams_n;
+  std::cout << std::setw(7) << name
+      << "  total=" << std::fixed << std::setprecision(1)
+      << std::setw(8) << ns / 1e6 << "ms"
+      << "  per packet=" << std::setw(8) << ns / packets_n << "ns"
+      << "  drained=" << std::setw(8) << ns_all / 1e6 << "ms"
+      << "  per send=" << std::setw(6) << (sent ? ns_all / sent : 0) << "ns"
+      << "  demanded=" << demanded
+      << "  sends=" << sent
+      << "  churns=" << churns
+      << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  int packets = argc >= 2 ? std::atoi(argv[1]) : 1000;
+  int sessions_n = argc >= 3 ? std::atoi(argv[2]) : 10000;
+  int streams_n = argc >= 4 ? std::atoi(argv[3]) : 100;
+  if (packets <= 0) packets = 1000;
+  if (sessions_n <= 0) sessions_n = 10000;
+  if (streams_n <= 0) streams_n = 100;
+  std::cout << "packets per stream: " << packets
+      << ", sessions: " << sessions_n
+      << ", streams: " << streams_n
+      << ", threads: " << std::thread::hardware_concurrency() << std::endl;
+  Bench("demand", false, packets, sessions_n, streams_n);
+  Bench("send", true, packets, sessions_n, streams_n);
+  return 0;
+}
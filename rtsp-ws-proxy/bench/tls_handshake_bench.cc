@@ -0,0 +1,263 @@
+// Handshake rate of the server ssl context, full vs resumed, and the record
+//  throughput of the ciphers
+//  tls_handshake_bench [handshakes] [threads] [ec|rsa]
+//
+// The server context is tuned by net::set_ssl_options, as WsServerSSL. The
+//  clients and the server run in memory, a bio pair per connection, so the
+//  cost is of both sides, without the network round trips.
+// A client reconnects with the session of its last connection, which is:
+//  clean: shut down, as a client closed
+//  broken: not shut down by the server, as a network blip, so removed from
+//    the server cache, the client kept it as a browser
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "common/net/ssl.h"
+
+namespace ssl = boost::asio::ssl;
+
+namespace {
+
+using steady_clock = std::chrono::steady_clock;
+
+void Check(bool ok, const char *what) {
+  if (ok) return;
+  char err[256];
+  ERR_error_string_n(ERR_get_error(), err, sizeof(err));
+  throw std::runtime_error(std::string(what) + ": " + err);
+}
+
+// a self-signed certificate, P-256 or RSA 2048
+struct Certificate {
+  EVP_PKEY *key = nullptr;
+  X509 *x509 = nullptr;
+
+  explicit Certificate(bool rsa) {
+    auto ctx = EVP_PKEY_CTX_new_id(rsa ? EVP_PKEY_RSA : EVP_PKEY_EC, nullptr);
+    Check(ctx != nullptr && EVP_PKEY_keygen_init(ctx) > 0, "keygen init");
+    if (rsa) {
+      Check(EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, 2048) > 0, "rsa bits");
+    } else {
+      Check(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(
+          ctx, NID_X9_62_prime256v1) > 0, "ec curve");
+    }
+    Check(EVP_PKEY_keygen(ctx, &key) > 0, "keygen");
+    EVP_PKEY_CTX_free(ctx);
+
+    x509 = X509_new();
+    X509_set_version(x509, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+    X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+    X509_gmtime_adj(X509_getm_notAfter(x509), 86400);
+    X509_set_pubkey(x509, key);
+    auto name = X509_get_subject_name(x509);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+        reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(x509, name);
+    Check(X509_sign(x509, key, EVP_sha256()) > 0, "sign");
+  }
+
+  ~Certificate() {
+    X509_free(x509);
+    EVP_PKEY_free(key);
+  }
+};
+
+struct Case {
+  const char *name;
+  bool tls13;
+  bool cache;
+  bool tickets;
+};
+
+const std::vector<Case> kCases{
+  {"tls1.2 none",    false, false, false},
+  {"tls1.2 cache",   false, true,  false},
+  {"tls1.2 tickets", false, false, true},
+  {"tls1.3 none",    true,  false, false},
+  {"tls1.3 cache",   true,  true,  false},
+  {"tls1.3 tickets", true,  false, true},
+};
+
+void ServerContext(ssl::context &ctx, const Certificate &cert,
+    const net::SslOptions &options) {
+  Check(SSL_CTX_use_certificate(ctx.native_handle(), cert.x509) > 0, "cert");
+  Check(SSL_CTX_use_PrivateKey(ctx.native_handle(), cert.key) > 0, "key");
+  beast::error_code ec;
+  net::set_ssl_options(ctx, options, ec);
+  if (ec) throw std::runtime_error("set_ssl_options: " + ec.message());
+}
+
+// a connection over a bio pair, the handshake driven by turns
+struct Connection {
+  SSL *client;
+  SSL *server;
+
+  Connection(SSL_CTX *client_ctx, SSL_CTX *server_ctx, SSL_SESSION *session)
+    : client(SSL_new(client_ctx)), server(SSL_new(server_ctx)) {
+    BIO *c, *s;
+    Check(BIO_new_bio_pair(&c, 0, &s, 0) > 0, "bio pair");
+    SSL_set_bio(client, c, c);
+    SSL_set_bio(server, s, s);
+    SSL_set_connect_state(client);
+    SSL_set_accept_state(server);
+    if (session != nullptr) SSL_set_session(client, session);
+  }
+
+  ~Connection() {
+    SSL_free(client);
+    SSL_free(server);
+  }
+
+  void Handshake() {
+    bool client_done = false, server_done = false;
+    for (int i = 0; !(client_done && server_done); ++i) {
+      Check(i < 16, "handshake stalled");
+      if (!client_done) client_done = Step(client);
+      if (!server_done) server_done = Step(server);
+    }
+    // the tls 1.3 tickets are after the handshake
+    char c;
+    SSL_read(client, &c, 1);
+  }
+
+  void Shutdown(bool broken) {
+    SSL_shutdown(client);
+    if (!broken) SSL_shutdown(server);
+  }
+
+  static bool Step(SSL *ssl) {
+    auto ret = SSL_do_handshake(ssl);
+    if (ret == 1) return true;
+    auto err = SSL_get_error(ssl, ret);
+    Check(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE,
+        "handshake");
+    return false;
+  }
+};
+
+struct Result {
+  std::atomic<int> handshakes{0};
+  std::atomic<int> resumed{0};
+};
+
+void Reconnect(SSL_CTX *client_ctx, SSL_CTX *server_ctx, bool broken,
+    int handshakes, Result *result) {
+  SSL_SESSION *session = nullptr;
+  for (int i = 0; i < handshakes; ++i) {
+    Connection conn(client_ctx, server_ctx, session);
+    conn.Handshake();
+    if (SSL_session_reused(conn.server)) ++result->resumed;
+    ++result->handshakes;
+    if (session != nullptr) SSL_SESSION_free(session);
+    session = SSL_get1_session(conn.client);
+    conn.Shutdown(broken);
+  }
+  if (session != nullptr) SSL_SESSION_free(session);
+}
+
+void BenchHandshake(const Case &c, bool broken, const Certificate &cert,
+    int handshakes, int threads_n) {
+  ssl::context server_ctx{ssl::context::tls_server};
+  net::SslOptions options;
+  options.tls13 = c.tls13;
+  options.session_cache_size = c.cache ? 20480 : 0;
+  options.session_tickets = c.tickets;
+  ServerContext(server_ctx, cert, options);
+
+  ssl::context client_ctx{ssl::context::tls_client};
+  SSL_CTX_set_session_cache_mode(client_ctx.native_handle(),
+      SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+
+  Result result;
+  auto t_beg = steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < threads_n; ++i) {
+    threads.emplace_back(Reconnect, client_ctx.native_handle(),
+        server_ctx.native_handle(), broken, handshakes, &result);
+  }
+  for (auto &&t : threads) t.join();
+  auto s = std::chrono::duration<double>(steady_clock::now() - t_beg).count();
+
+  auto n = result.handshakes.load();
+  std::cout << std::setw(15) << c.name << std::setw(8)
+      << (broken ? "broken" : "clean")
+      << std::fixed << std::setprecision(1)
+      << "  rate=" << std::setw(9) << n / s << "/s"
+      << "  cost=" << std::setw(7) << s * 1e6 * threads_n / n << "us"
+      << "  resumed=" << std::setw(5) << 100.0 * result.resumed / n << "%"
+      << std::endl;
+}
+
+// the bytes written by the server and read by the client, 16KB records
+void BenchRecord(const char *suite, const Certificate &cert, int mbytes) {
+  ssl::context server_ctx{ssl::context::tls_server};
+  net::SslOptions options;
+  options.ciphersuites = suite;
+  ServerContext(server_ctx, cert, options);
+  ssl::context client_ctx{ssl::context::tls_client};
+
+  Connection conn(client_ctx.native_handle(), server_ctx.native_handle(),
+      nullptr);
+  conn.Handshake();
+
+  std::vector<char> buf(16 * 1024, 'x');
+  auto t_beg = steady_clock::now();
+  for (int i = 0, n = mbytes * 64; i < n; ++i) {
+    Check(SSL_write(conn.server, buf.data(), buf.size()) > 0, "write");
+    for (std::size_t left = buf.size(); left > 0;) {
+      auto ret = SSL_read(conn.client, buf.data(), left);
+      Check(ret > 0, "read");
+      left -= ret;
+    }
+  }
+  auto s = std::chrono::duration<double>(steady_clock::now() - t_beg).count();
+  std::cout << std::setw(30) << suite
+      << std::fixed << std::setprecision(1)
+      << "  " << std::setw(8) << mbytes / s << " MB/s" << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char const *argv[]) {
+  int handshakes = argc >= 2 ? std::atoi(argv[1]) : 1000;
+  int threads_n = argc >= 3 ? std::atoi(argv[2]) : 1;
+  bool rsa = argc >= 4 && std::strcmp(argv[3], "rsa") == 0;
+  if (handshakes <= 0) handshakes = 1000;
+  if (threads_n <= 0) threads_n = 1;
+  std::cout << OpenSSL_version(OPENSSL_VERSION)
+      << ", cpu aes: " << (net::cpu_has_aes() ? "yes" : "no") << std::endl;
+  std::cout << "handshakes: " << handshakes << " per thread"
+      << ", threads: " << threads_n
+      << ", key: " << (rsa ? "rsa 2048" : "ec p-256") << std::endl;
+
+  try {
+    Certificate cert(rsa);
+    for (auto &&c : kCases) {
+      BenchHandshake(c, false, cert, handshakes, threads_n);
+      BenchHandshake(c, true, cert, handshakes, threads_n);
+    }
+    std::cout << "records:" << std::endl;
+    for (auto suite : {"TLS_AES_128_GCM_SHA256", "TLS_AES_256_GCM_SHA384",
+                       "TLS_CHACHA20_POLY1305_SHA256"}) {
+      BenchRecord(suite, cert, 256);
+    }
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -4,6 +4,7 @@ extern "C" {
 
 #include <libavcodec/version.h>
 #include <libavdevice/version.h>
+#include <libavfilter/version.h>
 #include <libavformat/version.h>
 #include <libavutil/version.h>
 #include <libswscale/version.h>
@@ -13,6 +14,7 @@ extern "C" {
 #endif
 
 #include <map>
+#include <stdexcept>
 #include <vector>
 
 #include <boost/version.hpp>
@@ -22,6 +24,7 @@ extern "C" {
 #include "common/util/config.h"
 #include "common/util/log.h"
 
+#include "stream_composite.h"
 #include "stream_handler.h"
 #include "stream_player.h"
 #include "ws_stream_server.h"
@@ -30,6 +33,7 @@ struct Config {
   WsServerOptions options{};
   std::map<std::string, StreamOptions> stream_options;
   std::map<std::string, std::vector<StreamFilterOptions>> stream_filters_options;  // NOLINT
+  std::vector<StreamCompositeOptions> composites_options;
   int stream_get_frequency = 20;
   bool stream_ui_enable = false;
 };
@@ -42,6 +46,7 @@ int main(int argc, char const *argv[]) {
   LOG(INFO) << "ffmpeg version";
   LOG(INFO) << "  libavcodec: " << AV_STRINGIFY(LIBAVCODEC_VERSION);
   LOG(INFO) << "  libavdevice: " << AV_STRINGIFY(LIBAVDEVICE_VERSION);
+  LOG(INFO) << "  libavfilter: " << AV_STRINGIFY(LIBAVFILTER_VERSION);
   LOG(INFO) << "  libavformat: " << AV_STRINGIFY(LIBAVFORMAT_VERSION);
   LOG(INFO) << "  libavutil: " << AV_STRINGIFY(LIBAVUTIL_VERSION);
   LOG(INFO) << "  libswscale: " << AV_STRINGIFY(LIBSWSCALE_VERSION);
@@ -57,12 +62,42 @@ int main(int argc, char const *argv[]) {
     return ret;
   }
 
+  std::unordered_map<std::string, std::shared_ptr<StreamHandler>> streams;
+  std::unordered_map<std::string, std::shared_ptr<StreamComposite>> composites;
+
   config.options.on_fail = [](boost::beast::error_code ec, char const *what) {
     LOG(ERROR) << what << ": " << ec.message();
   };
+  // new viewers needn't wait a whole gop if transcoded
+  config.options.on_stream_join =
+      [&streams, &composites](const std::string &id) {
+    auto it = streams.find(id);
+    if (it != streams.end()) it->second->RequestKeyFrame();
+    auto it_c = composites.find(id);
+    if (it_c != composites.end()) it_c->second->RequestKeyFrame();
+  };
   WsStreamServer server(config.options);
 
-  std::vector<std::shared_ptr<StreamHandler>> streams;
+  // the composites of each source
+  std::unordered_map<std::string, std::vector<std::shared_ptr<StreamComposite>>>
+      source_composites;
+  for (auto &&opts : config.composites_options) {
+    auto id = opts.id;
+    auto composite = std::make_shared<StreamComposite>(opts,
+      [id, &server](
+          const std::shared_ptr<Stream> &stream,
+          const AVMediaType &type, AVPacket *packet) {
+        server.Send(id, stream, type, packet);
+      },
+      [id, &server]() {
+        return server.HasSubscribers(id);
+      });
+    for (auto &&source : opts.sources) {
+      source_composites[source].push_back(composite);
+    }
+    composites[id] = composite;
+  }
+
   std::unordered_map<std::string, std::shared_ptr<StreamPlayer>> players;
   for (auto &&entry : config.stream_options) {
     auto id = entry.first;
@@ -72,72 +107,106 @@ int main(int argc, char const *argv[]) {
       player->Start();
       players[id] = player;
     }
+    auto comps = source_composites[id];
     auto stream = std::make_shared<StreamHandler>(
       id, entry.second, config.stream_filters_options[id],
       config.stream_get_frequency,
-      [id, &server, player](
+      [id, &server, player, comps](
           const std::shared_ptr<Stream> &stream,
           const AVMediaType &type, AVPacket *packet) {
         server.Send(id, stream, type, packet);
         if (player != nullptr) {
           player->Send(id, stream, type, packet);
         }
+        for (auto &&c : comps) {
+          c->Send(id, stream, type, packet);
+        }
+      },
+      [id, &server, player, comps]() {
+        if (player != nullptr || server.HasSubscribers(id)) return true;
+        for (auto &&c : comps) {
+          if (c->IsDemanded()) return true;
+        }
+        return false;
       });
     stream->Start();
-    streams.push_back(stream);
+    streams[id] = stream;
   }
+  for (auto &&c : composites)
+    c.second->Start();
 
   server.Run();
 
   for (auto &&s : streams)
-    s->Stop();
+    s.second->Stop();
+  for (auto &&c : composites)
+    c.second->Stop();
   for (auto &&p : players)
     p.second->Stop();
   return EXIT_SUCCESS;
 }
 
+StreamFilterOptions LoadFilterOptions(const YAML::Node &node) {
+  StreamFilterOptions opt{};
+  if (node["type"])
+    opt.type = StreamFilterTypeFromString(node["type"].as<std::string>());
+  // bsf options
+  if (node["bsf_name"])
+    opt.bsf_name = node["bsf_name"].as<std::string>();
+  // framerate options
+  if (node["enc_name"])
+    opt.enc_name = node["enc_name"].as<std::string>();
+  if (node["enc_bit_rate"])
+    opt.enc_bit_rate = node["enc_bit_rate"].as<int>();
+  if (node["enc_framerate"])
+    opt.enc_framerate = node["enc_framerate"].as<int>();
+  if (node["enc_gop_size"])
+    opt.enc_gop_size = node["enc_gop_size"].as<int>();
+  if (node["enc_max_b_frames"])
+    opt.enc_max_b_frames = node["enc_max_b_frames"].as<int>();
+  if (node["enc_qmin"])
+    opt.enc_qmin = node["enc_qmin"].as<int>();
+  if (node["enc_qmax"])
+    opt.enc_qmax = node["enc_qmax"].as<int>();
+  if (node["enc_thread_count"])
+    opt.enc_thread_count = node["enc_thread_count"].as<int>();
+  auto node_enc_open_options = node["enc_open_options"];
+  if (node_enc_open_options && node_enc_open_options.IsMap()) {
+    for (auto it = node_enc_open_options.begin();
+        it != node_enc_open_options.end(); ++it) {
+      opt.enc_open_options[it->first.as<std::string>()] =
+          it->second.as<std::string>();
+    }
+  }
+  if (node["enc_on_demand"])
+    opt.enc_on_demand = node["enc_on_demand"].as<bool>();
+  if (node["enc_key_frame_min_interval_ms"])
+    opt.enc_key_frame_min_interval_ms =
+        node["enc_key_frame_min_interval_ms"].as<int>();
+  if (node["dec_name"])
+    opt.dec_name = node["dec_name"].as<std::string>();
+  if (node["dec_thread_count"])
+    opt.dec_thread_count = node["dec_thread_count"].as<int>();
+  if (node["dec_thread_type"])
+    opt.dec_thread_type = node["dec_thread_type"].as<int>();
+  // motion gate options
+  if (node["motion_threshold"])
+    opt.motion_threshold = node["motion_threshold"].as<double>();
+  if (node["motion_hold_ms"])
+    opt.motion_hold_ms = node["motion_hold_ms"].as<int>();
+  if (node["motion_keepalive_fps"])
+    opt.motion_keepalive_fps = node["motion_keepalive_fps"].as<int>();
+  // graph options
+  if (node["graph_desc"])
+    opt.graph_desc = node["graph_desc"].as<std::string>();
+  if (node["graph_threads"])
+    opt.graph_threads = node["graph_threads"].as<int>();
+  return opt;
+}
+
 std::vector<StreamFilterOptions> LoadFiltersOptions(const YAML::Node &node) {
   std::vector<StreamFilterOptions> opts;
   if (!node.IsSequence()) return opts;
-  auto LoadFilterOptions = [](const YAML::Node &node) {
-    StreamFilterOptions opt{};
-    opt.type = StreamFilterTypeFromString(node["type"].as<std::string>());
-    // bsf options
-    if (node["bsf_name"])
-      opt.bsf_name = node["bsf_name"].as<std::string>();
-    // framerate options
-    if (node["enc_name"])
-      opt.enc_name = node["enc_name"].as<std::string>();
-    if (node["enc_bit_rate"])
-      opt.enc_bit_rate = node["enc_bit_rate"].as<int>();
-    if (node["enc_framerate"])
-      opt.enc_framerate = node["enc_framerate"].as<int>();
-    if (node["enc_gop_size"])
-      opt.enc_gop_size = node["enc_gop_size"].as<int>();
-    if (node["enc_max_b_frames"])
-      opt.enc_max_b_frames = node["enc_max_b_frames"].as<int>();
-    if (node["enc_qmin"])
-      opt.enc_qmin = node["enc_qmin"].as<int>();
-    if (node["enc_qmax"])
-      opt.enc_qmax = node["enc_qmax"].as<int>();
-    if (node["enc_thread_count"])
-      opt.enc_thread_count = node["enc_thread_count"].as<int>();
-    auto node_fr_open_options = node["fr_open_options"];
-    if (node_fr_open_options && node_fr_open_options.IsMap()) {
-      for (auto it = node_fr_open_options.begin();
-          it != node_fr_open_options.end(); ++it) {
-        opt.enc_open_options[it->first.as<std::string>()] =
-            it->second.as<std::string>();
-      }
-    }
-    if (node["dec_name"])
-      opt.dec_name = node["dec_name"].as<std::string>();
-    if (node["dec_thread_count"])
-      opt.dec_thread_count = node["dec_thread_count"].as<int>();
-    if (node["dec_thread_type"])
-      opt.dec_thread_type = node["dec_thread_type"].as<int>();
-    return opt;
-  };
   for (auto it = node.begin(); it != node.end(); ++it) {
     opts.push_back(std::move(LoadFilterOptions(*it)));
   }
@@ -149,6 +218,7 @@ int LoadConfig(const std::string &path, Config *config) {
   auto &options = config->options;
   auto &stream_options = config->stream_options;
   auto &stream_filters_options = config->stream_filters_options;
+  auto &composites_options = config->composites_options;
   auto &stream_get_frequency = config->stream_get_frequency;
   auto &stream_ui_enable = config->stream_ui_enable;
   try {
@@ -163,6 +233,8 @@ int LoadConfig(const std::string &path, Config *config) {
         options.port = node_server["port"].as<int>();
       if (node_server["threads"])
         options.threads = node_server["threads"].as<int>();
+      if (node_server["shard_enable"])
+        options.shard_enable = node_server["shard_enable"].as<bool>();
 
       if (node_server["http"]) {
         auto node_http = node_server["http"];
@@ -170,6 +242,25 @@ int LoadConfig(const std::string &path, Config *config) {
           options.http.enable = node_http["enable"].as<bool>();
         if (node_http["doc_root"])
           options.http.doc_root = node_http["doc_root"].as<std::string>();
+        if (node_http["cache"]) {
+          auto node_cache = node_http["cache"];
+          auto &&cache = options.http.cache;
+          if (node_cache["enable"])
+            cache.enable = node_cache["enable"].as<bool>();
+          if (node_cache["file_max_bytes"])
+            cache.file_max_bytes =
+                node_cache["file_max_bytes"].as<std::size_t>();
+          if (node_cache["max_bytes"])
+            cache.max_bytes = node_cache["max_bytes"].as<std::size_t>();
+          if (node_cache["check_ms"])
+            cache.check_ms = node_cache["check_ms"].as<int>();
+          if (node_cache["cache_control"])
+            cache.cache_control =
+                node_cache["cache_control"].as<std::string>();
+        }
+        if (node_http["metrics_target"])
+          options.http.metrics_target =
+              node_http["metrics_target"].as<std::string>();
 
         if (node_http["ssl_crt"])
           options.http.ssl_crt = node_http["ssl_crt"].as<std::string>();
@@ -177,11 +268,40 @@ int LoadConfig(const std::string &path, Config *config) {
           options.http.ssl_key = node_http["ssl_key"].as<std::string>();
         if (node_http["ssl_dh"])
           options.http.ssl_dh = node_http["ssl_dh"].as<std::string>();
+#ifdef MY_USE_SSL
+        if (node_http["ssl"]) {
+          auto node_ssl = node_http["ssl"];
+          auto &&ssl = options.http.ssl;
+          if (node_ssl["session_cache_size"])
+            ssl.session_cache_size = node_ssl["session_cache_size"].as<int>();
+          if (node_ssl["session_timeout_s"])
+            ssl.session_timeout_s = node_ssl["session_timeout_s"].as<int>();
+          if (node_ssl["session_tickets"])
+            ssl.session_tickets = node_ssl["session_tickets"].as<bool>();
+          if (node_ssl["tls13"])
+            ssl.tls13 = node_ssl["tls13"].as<bool>();
+          if (node_ssl["ciphers"])
+            ssl.ciphers = node_ssl["ciphers"].as<std::string>();
+          if (node_ssl["ciphersuites"])
+            ssl.ciphersuites = node_ssl["ciphersuites"].as<std::string>();
+        }
+#endif
       }
 
       if (node_server["cors"])
         options.cors = node_server["cors"].as<net::CorsOptions>();
 
+      if (node_server["socket"]) {
+        auto node_socket = node_server["socket"];
+        if (node_socket["tcp_nodelay"])
+          options.socket.tcp_nodelay = node_socket["tcp_nodelay"].as<bool>();
+        if (node_socket["sndbuf"])
+          options.socket.sndbuf = node_socket["sndbuf"].as<int>();
+        if (node_socket["notsent_lowat"])
+          options.socket.notsent_lowat =
+              node_socket["notsent_lowat"].as<int>();
+      }
+
       if (node_server["stream"]) {
         auto node_stream = node_server["stream"];
         if (node_stream["http_target"])
@@ -193,6 +313,72 @@ int LoadConfig(const std::string &path, Config *config) {
         if (node_stream["send_queue_max_size"])
           options.stream.send_queue_max_size =
               node_stream["send_queue_max_size"].as<int>();
+        if (node_stream["send_deadline_ms"])
+          options.stream.send_deadline_ms =
+              node_stream["send_deadline_ms"].as<int>();
+        if (node_stream["send_evict_drops"])
+          options.stream.send_evict_drops =
+              node_stream["send_evict_drops"].as<int>();
+        if (node_stream["send_evict_window_ms"])
+          options.stream.send_evict_window_ms =
+              node_stream["send_evict_window_ms"].as<int>();
+        if (node_stream["send_sample_ms"])
+          options.stream.send_sample_ms =
+              node_stream["send_sample_ms"].as<int>();
+        if (node_stream["send_unsent_max_bytes"])
+          options.stream.send_unsent_max_bytes =
+              node_stream["send_unsent_max_bytes"].as<int>();
+        if (node_stream["batch_window_ms"])
+          options.stream.batch_window_ms =
+              node_stream["batch_window_ms"].as<int>();
+        if (node_stream["batch_max_bytes"])
+          options.stream.batch_max_bytes =
+              node_stream["batch_max_bytes"].as<int>();
+        if (node_stream["mux_enable"])
+          options.stream.mux_enable =
+              node_stream["mux_enable"].as<bool>();
+        if (node_stream["fmp4_enable"])
+          options.stream.fmp4_enable =
+              node_stream["fmp4_enable"].as<bool>();
+        if (node_stream["fmp4_frag_per_frame"])
+          options.stream.fmp4_frag_per_frame =
+              node_stream["fmp4_frag_per_frame"].as<bool>();
+        if (node_stream["hls_enable"])
+          options.stream.hls_enable =
+              node_stream["hls_enable"].as<bool>();
+        if (node_stream["hls_part_target_ms"])
+          options.stream.hls_part_target_ms =
+              node_stream["hls_part_target_ms"].as<int>();
+        if (node_stream["hls_segment_target_ms"])
+          options.stream.hls_segment_target_ms =
+              node_stream["hls_segment_target_ms"].as<int>();
+        if (node_stream["hls_segments_max"])
+          options.stream.hls_segments_max =
+              node_stream["hls_segments_max"].as<int>();
+        if (node_stream["hls_idle_ms"])
+          options.stream.hls_idle_ms =
+              node_stream["hls_idle_ms"].as<int>();
+        if (node_stream["flv_enable"])
+          options.stream.flv_enable =
+              node_stream["flv_enable"].as<bool>();
+        if (node_stream["flv_queue_max_size"])
+          options.stream.flv_queue_max_size =
+              node_stream["flv_queue_max_size"].as<int>();
+        if (node_stream["snapshot_enable"])
+          options.stream.snapshot_enable =
+              node_stream["snapshot_enable"].as<bool>();
+        if (node_stream["snapshot_ttl_ms"])
+          options.stream.snapshot_ttl_ms =
+              node_stream["snapshot_ttl_ms"].as<int>();
+        if (node_stream["snapshot_idle_ms"])
+          options.stream.snapshot_idle_ms =
+              node_stream["snapshot_idle_ms"].as<int>();
+        if (node_stream["snapshot_max_width"])
+          options.stream.snapshot_max_width =
+              node_stream["snapshot_max_width"].as<int>();
+        if (node_stream["snapshot_threads"])
+          options.stream.snapshot_threads =
+              node_stream["snapshot_threads"].as<int>();
       }
     }
 
@@ -205,6 +391,37 @@ int LoadConfig(const std::string &path, Config *config) {
       }
     }
 
+    if (node["composites"]) {
+      auto node_composites = node["composites"];
+      for (auto it = node_composites.begin(); it != node_composites.end();
+          ++it) {
+        auto &&n = *it;
+        StreamCompositeOptions opts{};
+        opts.id = n["id"].as<std::string>();
+        if (stream_options.find(opts.id) != stream_options.end()) {
+          throw std::runtime_error("composite id is used by a stream: " +
+              opts.id);
+        }
+        auto node_sources = n["sources"];
+        for (auto it_s = node_sources.begin(); it_s != node_sources.end();
+            ++it_s) {
+          auto source = it_s->as<std::string>();
+          if (stream_options.find(source) == stream_options.end()) {
+            throw std::runtime_error(
+                "composite source not found: " + source);
+          }
+          opts.sources.push_back(source);
+        }
+        if (n["width"]) opts.width = n["width"].as<int>();
+        if (n["height"]) opts.height = n["height"].as<int>();
+        if (n["cols"]) opts.cols = n["cols"].as<int>();
+        if (n["framerate"]) opts.framerate = n["framerate"].as<int>();
+        if (n["key_only"]) opts.key_only = n["key_only"].as<bool>();
+        opts.enc = LoadFilterOptions(n);
+        composites_options.push_back(std::move(opts));
+      }
+    }
+
     if (node["stream_get_frequency"])
       stream_get_frequency = node["stream_get_frequency"].as<int>();
 
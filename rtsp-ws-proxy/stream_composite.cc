@@ -0,0 +1,333 @@
+#include "stream_composite.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+#include <utility>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libswscale/swscale.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "common/media/stream_video.h"
+#include "common/util/log.h"
+#include "common/util/rate.h"
+#include "common/util/throw_error.h"
+
+#include "stream_video_encoder.h"
+
+namespace {
+
+// decode with the codec parameters, not the input stream
+//  e.g. the source is transcoded by video_enc
+class StreamCodecparOpContext : public StreamOpContext {
+ public:
+  explicit StreamCodecparOpContext(const AVCodecParameters *par)
+    : par_(avcodec_parameters_alloc()) {
+    int ret = avcodec_parameters_copy(par_, par);
+    if (ret < 0) throw StreamError(ret);
+  }
+  ~StreamCodecparOpContext() override {
+    avcodec_parameters_free(&par_);
+  }
+
+  AVCodecID GetAVCodecID() override {
+    return par_->codec_id;
+  }
+  void InitAVCodecContext(AVCodecContext *codec_ctx) override {
+    int ret = avcodec_parameters_to_context(codec_ctx, par_);
+    if (ret < 0) throw StreamError(ret);
+  }
+
+ private:
+  AVCodecParameters *par_;
+};
+
+// fill the area with black, yuv420p
+void FillBlack(AVFrame *frame, int x, int y, int w, int h) {
+  for (int p = 0; p < 3; ++p) {
+    int shift = (p == 0) ? 0 : 1;
+    int value = (p == 0) ? 16 : 128;
+    for (int r = y >> shift, end = (y + h) >> shift; r < end; ++r) {
+      memset(frame->data[p] + r * frame->linesize[p] + (x >> shift),
+          value, w >> shift);
+    }
+  }
+}
+
+}  // namespace
+
+struct StreamComposite::Tile {
+  std::string id;
+  // the cell in canvas
+  int x, y, w, h;
+  // the frame scaled in cell, keep aspect ratio
+  int dst_x, dst_y, dst_w, dst_h;
+
+  std::shared_ptr<StreamVideoOp> op;
+  AVCodecParameters *codecpar;
+  bool wait_key;
+
+  Tile() : x(0), y(0), w(0), h(0), dst_x(0), dst_y(0), dst_w(0), dst_h(0),
+      op(nullptr), codecpar(avcodec_parameters_alloc()), wait_key(true) {}
+  ~Tile() { avcodec_parameters_free(&codecpar); }
+
+  bool IsCodecparChanged(const AVCodecParameters *par) const {
+    return codecpar->codec_id != par->codec_id ||
+        codecpar->width != par->width ||
+        codecpar->height != par->height ||
+        codecpar->extradata_size != par->extradata_size;
+  }
+};
+
+StreamComposite::StreamComposite(
+    const StreamCompositeOptions &options,
+    packet_callback_t cb,
+    demand_callback_t demand_cb)
+  : options_(options), packet_cb_(cb), demand_cb_(demand_cb),
+    canvas_(av_frame_alloc()), stream_(nullptr), encoder_(nullptr),
+    encode_frame_(nullptr), encode_frame_pts_(0), encoded_(false),
+    suspended_(false), key_frame_requested_(false), running_(false) {
+  std::stringstream ss;
+  ss << "Composite[" << options_.id << "]";
+  log_id_ = ss.str();
+
+  // yuv420p, even size
+  options_.width = std::max(2, options_.width & ~1);
+  options_.height = std::max(2, options_.height & ~1);
+  if (options_.framerate <= 0) options_.framerate = 5;
+
+  canvas_->width = options_.width;
+  canvas_->height = options_.height;
+  canvas_->format = AV_PIX_FMT_YUV420P;
+  int ret = av_frame_get_buffer(canvas_, 0);
+  if (ret < 0) throw StreamError(ret);
+  FillBlack(canvas_, 0, 0, canvas_->width, canvas_->height);
+
+  // grid
+  int n = static_cast<int>(options_.sources.size());
+  int cols = options_.cols > 0 ? options_.cols
+      : static_cast<int>(std::ceil(std::sqrt(std::max(n, 1))));
+  int rows = std::max((n + cols - 1) / cols, 1);
+  int cell_w = (options_.width / cols) & ~1;
+  int cell_h = (options_.height / rows) & ~1;
+  for (int i = 0; i < n; ++i) {
+    std::unique_ptr<Tile> tile(new Tile());
+    tile->id = options_.sources[i];
+    tile->x = (i % cols) * cell_w;
+    tile->y = (i / cols) * cell_h;
+    tile->w = cell_w;
+    tile->h = cell_h;
+    tiles_.push_back(std::move(tile));
+  }
+  LOG(INFO) << log_id_ << " " << options_.width << "x" << options_.height
+      << ", grid=" << cols << "x" << rows << ", tile=" << cell_w << "x"
+      << cell_h;
+}
+
+StreamComposite::~StreamComposite() {
+  Stop();
+  if (encode_frame_) {
+    av_frame_free(&encode_frame_);
+    encode_frame_ = nullptr;
+  }
+  av_frame_free(&canvas_);
+}
+
+const StreamCompositeOptions &StreamComposite::GetOptions() const {
+  return options_;
+}
+
+void StreamComposite::Start() {
+  if (running_) return;
+  running_ = true;
+  thread_ = std::thread(&StreamComposite::Run, this);
+}
+
+void StreamComposite::Stop() {
+  running_ = false;
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool StreamComposite::IsDemanded() const {
+  // run until the first packet encoded, as clients need the stream info
+  return !encoded_ || demand_cb_ == nullptr || demand_cb_();
+}
+
+void StreamComposite::Send(
+    const std::string &id,
+    const std::shared_ptr<Stream> &stream,
+    const AVMediaType &type,
+    AVPacket *packet) {
+  if (type != AVMEDIA_TYPE_VIDEO) return;
+  auto demanded = IsDemanded();
+  auto key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+  for (auto &&tile : tiles_) {
+    if (tile->id != id) continue;
+    if (!demanded) {
+      tile->wait_key = true;
+      continue;
+    }
+    if ((options_.key_only || tile->wait_key) && !key) continue;
+    tile->wait_key = false;
+
+    try {
+      auto par = stream->GetStreamSub(type)->info->codecpar;
+      if (tile->op == nullptr || tile->IsCodecparChanged(par)) {
+        int ret = avcodec_parameters_copy(tile->codecpar, par);
+        if (ret < 0) throw StreamError(ret);
+        // fit in the cell
+        int src_w = par->width > 0 ? par->width : tile->w;
+        int src_h = par->height > 0 ? par->height : tile->h;
+        double scale = std::min(static_cast<double>(tile->w) / src_w,
+                                static_cast<double>(tile->h) / src_h);
+        tile->dst_w = std::max(2, static_cast<int>(src_w * scale) & ~1);
+        tile->dst_h = std::max(2, static_cast<int>(src_h * scale) & ~1);
+        tile->dst_x = tile->x + (((tile->w - tile->dst_w) / 2) & ~1);
+        tile->dst_y = tile->y + (((tile->h - tile->dst_h) / 2) & ~1);
+
+        StreamVideoOptions options{};
+        options.dec_thread_count = 1;  // output as soon as decoded
+        options.sws_enable = true;
+        options.sws_dst_width = tile->dst_w;
+        options.sws_dst_height = tile->dst_h;
+        options.sws_dst_pix_fmt = AV_PIX_FMT_YUV420P;
+        options.sws_flags = SWS_FAST_BILINEAR;
+        tile->op = std::make_shared<StreamVideoOp>(options,
+            std::make_shared<StreamCodecparOpContext>(par));
+        {
+          std::lock_guard<std::mutex> _(canvas_mutex_);
+          FillBlack(canvas_, tile->x, tile->y, tile->w, tile->h);
+        }
+        VLOG(1) << log_id_ << " tile[" << id << "] " << src_w << "x" << src_h
+            << " > " << tile->dst_w << "x" << tile->dst_h;
+      }
+
+      auto frame = tile->op->GetFrame(packet);
+      if (frame != nullptr) Blit(tile.get(), frame);
+    } catch (const StreamError &e) {
+      // not break the source stream
+      LOG(ERROR) << log_id_ << " tile[" << id << "] " << e.what();
+      tile->op = nullptr;
+      tile->wait_key = true;
+    }
+  }
+}
+
+void StreamComposite::RequestKeyFrame() {
+  key_frame_requested_ = true;
+}
+
+void StreamComposite::Run() {
+  LOG(INFO) << log_id_ << " run";
+  Rate rate(options_.framerate);
+  while (running_) {
+    try {
+      Encode();
+    } catch (const StreamError &e) {
+      LOG(ERROR) << log_id_ << " " << e.what();
+    }
+    rate.Sleep();
+  }
+  LOG(INFO) << log_id_ << " over";
+}
+
+void StreamComposite::Encode() {
+  if (!IsDemanded()) {
+    LOG_IF(INFO, !suspended_) << log_id_ << " suspended, no one is watching";
+    suspended_ = true;
+    return;
+  }
+
+  if (encoder_ == nullptr) {
+    auto &&enc = options_.enc;
+    StreamVideoEncodeOptions options{};
+    options.codec_name = enc.enc_name;
+    options.codec_bit_rate = enc.enc_bit_rate;
+    options.codec_width = options_.width;
+    options.codec_height = options_.height;
+    options.codec_framerate = options_.framerate;
+    options.codec_pix_fmt = AV_PIX_FMT_YUV420P;
+    options.codec_gop_size = enc.enc_gop_size;
+    options.codec_max_b_frames = enc.enc_max_b_frames;
+    options.codec_qmin = enc.enc_qmin;
+    options.codec_qmax = enc.enc_qmax;
+    options.codec_thread_count = enc.enc_thread_count;
+    options.open_options = enc.enc_open_options;
+
+    encoder_ = std::make_shared<StreamVideoEncoder>(options);
+
+    // a stream not opened from input, only the info for clients
+    auto info = std::make_shared<StreamSubInfo>();
+    avcodec_parameters_from_context(info->codecpar,
+        encoder_->GetCodecContext());
+    stream_ = std::make_shared<Stream>();
+    stream_->SetStreamSub(AVMEDIA_TYPE_VIDEO, std::shared_ptr<StreamSub>(
+        new StreamSub{nullptr, nullptr, std::move(info)}));
+
+    encode_frame_ = av_frame_alloc();
+    encode_frame_->width  = options.codec_width;
+    encode_frame_->height = options.codec_height;
+    encode_frame_->format = options.codec_pix_fmt;
+    int ret = av_frame_get_buffer(encode_frame_, 0);
+    if (ret < 0) throw StreamError(ret);
+  }
+
+  if (suspended_) {
+    LOG(INFO) << log_id_ << " resumed";
+    suspended_ = false;
+    encoder_->RequestKeyFrame();
+    key_frame_requested_ = false;
+    key_frame_time_ = std::chrono::steady_clock::now();
+  } else if (key_frame_requested_) {
+    // rate limit, a reconnect storm shouldn't make every frame a key frame
+    auto t_now = std::chrono::steady_clock::now();
+    auto interval = options_.enc.enc_key_frame_min_interval_ms;
+    if (interval < 0) {
+      key_frame_requested_ = false;
+    } else if (t_now - key_frame_time_ >= std::chrono::milliseconds(interval)) {
+      encoder_->RequestKeyFrame();
+      key_frame_requested_ = false;
+      key_frame_time_ = t_now;
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> _(canvas_mutex_);
+    av_frame_make_writable(encode_frame_);
+    int ret = av_frame_copy(encode_frame_, canvas_);
+    if (ret < 0) throw StreamError(ret);
+  }
+  encode_frame_->pts = encode_frame_pts_++;
+
+  encoder_->Encode(encode_frame_, [this](AVPacket *packet) {
+    encoded_ = true;
+    if (packet_cb_) packet_cb_(stream_, AVMEDIA_TYPE_VIDEO, packet);
+  });
+}
+
+void StreamComposite::Blit(Tile *tile, const AVFrame *frame) {
+  int w = std::min(frame->width, tile->dst_w);
+  int h = std::min(frame->height, tile->dst_h);
+  std::lock_guard<std::mutex> _(canvas_mutex_);
+  for (int p = 0; p < 3; ++p) {
+    int shift = (p == 0) ? 0 : 1;
+    auto dst = canvas_->data[p] + (tile->dst_y >> shift) * canvas_->linesize[p]
+        + (tile->dst_x >> shift);
+    auto src = frame->data[p];
+    for (int r = 0, end = h >> shift; r < end; ++r) {
+      memcpy(dst + r * canvas_->linesize[p], src + r * frame->linesize[p],
+          w >> shift);
+    }
+  }
+}
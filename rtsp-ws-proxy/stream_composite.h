@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/media/stream.h"
+
+#include "stream_filter.h"
+
+struct StreamCompositeOptions {
+  std::string id;
+  // source stream ids, tiles in row-major order
+  std::vector<std::string> sources;
+
+  int width     = 1280;
+  int height    = 720;
+  int cols      = 0;  // ceil(sqrt(sources)) if <= 0
+  int framerate = 5;
+  // decode key frames only of the sources, otherwise decode all
+  bool key_only = true;
+
+  // encode options, only enc_* used
+  StreamFilterOptions enc{};
+};
+
+class StreamVideoEncoder;
+
+// Compose the sources into a grid, and encode it as a stream
+class StreamComposite {
+ public:
+  using packet_callback_t = std::function<void(
+      const std::shared_ptr<Stream> &, const AVMediaType &, AVPacket *)>;
+  // return true if the packets are needed by someone
+  using demand_callback_t = std::function<bool()>;
+
+  StreamComposite(const StreamCompositeOptions &options,
+                  packet_callback_t cb = nullptr,
+                  demand_callback_t demand_cb = nullptr);
+  ~StreamComposite();
+
+  const StreamCompositeOptions &GetOptions() const;
+
+  void Start();
+  void Stop();
+
+  // if the packets of the sources are needed now
+  bool IsDemanded() const;
+
+  // send the packets of a source, called by its stream thread
+  void Send(const std::string &id,
+            const std::shared_ptr<Stream> &stream,
+            const AVMediaType &type,
+            AVPacket *packet);
+
+  // encode the next frame as key frame, thread safe
+  void RequestKeyFrame();
+
+ private:
+  struct Tile;
+
+  void Run();
+  void Encode();
+  void Blit(Tile *tile, const AVFrame *frame);
+
+  StreamCompositeOptions options_;
+  packet_callback_t packet_cb_;
+  demand_callback_t demand_cb_;
+  std::string log_id_;
+
+  std::vector<std::unique_ptr<Tile>> tiles_;
+
+  // the grid frame, blit by the stream threads, encoded by the run thread
+  AVFrame *canvas_;
+  std::mutex canvas_mutex_;
+
+  std::shared_ptr<Stream> stream_;
+  std::shared_ptr<StreamVideoEncoder> encoder_;
+  AVFrame *encode_frame_;
+  int64_t encode_frame_pts_;
+  std::atomic_bool encoded_;
+  bool suspended_;
+
+  std::atomic_bool key_frame_requested_;
+  std::chrono::steady_clock::time_point key_frame_time_;
+
+  std::atomic_bool running_;
+  std::thread thread_;
+};
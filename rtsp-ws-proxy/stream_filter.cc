@@ -1,5 +1,7 @@
 #include "stream_filter.h"
 
+#include <algorithm>
+#include <sstream>
 #include <string>
 
 #ifdef __cplusplus
@@ -7,8 +9,12 @@ extern "C" {
 #endif
 
 #include <libavcodec/avcodec.h>
+#include <libavfilter/avfilter.h>
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
 #include <libavformat/avformat.h>
 #include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
 
 #ifdef __cplusplus
 }
@@ -17,6 +23,7 @@ extern "C" {
 #include "common/media/stream.h"
 #include "common/media/stream_video.h"
 #include "common/util/log.h"
+#include "common/util/simd.h"
 #include "common/util/throw_error.h"
 
 #include "stream_video_encoder.h"
@@ -26,6 +33,8 @@ std::string StreamFilterTypeToString(StreamFilterType type) {
     case STREAM_FILTER_NONE:      return "none";
     case STREAM_FILTER_VIDEO_BSF: return "video_bsf";
     case STREAM_FILTER_VIDEO_ENC: return "video_enc";
+    case STREAM_FILTER_VIDEO_MOTION_GATE: return "video_motion_gate";
+    case STREAM_FILTER_VIDEO_GRAPH: return "video_graph";
     default: throw StreamError("StreamFilterType unknown");
   }
 }
@@ -34,6 +43,8 @@ StreamFilterType StreamFilterTypeFromString(const std::string &type) {
   if (type == "none")       return STREAM_FILTER_NONE;
   if (type == "video_bsf")  return STREAM_FILTER_VIDEO_BSF;
   if (type == "video_enc")  return STREAM_FILTER_VIDEO_ENC;
+  if (type == "video_motion_gate") return STREAM_FILTER_VIDEO_MOTION_GATE;
+  if (type == "video_graph") return STREAM_FILTER_VIDEO_GRAPH;
   throw_error<StreamError>() << "StreamFilterType unknown: " << type;
   return STREAM_FILTER_NONE;
 }
@@ -52,6 +63,20 @@ const StreamFilterOptions &StreamFilter::GetOptions() const {
   return options_;
 }
 
+// StreamFrameFilter
+
+StreamFrameFilter::StreamFrameFilter(const std::shared_ptr<StreamSub> &stream,
+    const StreamFilterOptions &options)
+  : stream_(stream), options_(options) {
+}
+
+StreamFrameFilter::~StreamFrameFilter() {
+}
+
+const StreamFilterOptions &StreamFrameFilter::GetOptions() const {
+  return options_;
+}
+
 // StreamFilterVideoBSF
 
 StreamFilterVideoBSF::StreamFilterVideoBSF(
@@ -133,8 +158,10 @@ StreamFilterStatus StreamFilterVideoBSF::RecvPacket(AVPacket *pkt) {
 StreamFilterVideoEnc::StreamFilterVideoEnc(
     const std::shared_ptr<StreamSub> &stream,
     const StreamFilterOptions &options)
-  : StreamFilter(stream, options), decoder_(nullptr), encoder_(nullptr),
-    encode_frame_(nullptr), encode_frame_pts_(0) {
+  : StreamFilter(stream, options), graph_(false),
+    suspended_(false), resume_wait_key_(false),
+    encoded_(false), key_frame_pending_(false), decoder_(nullptr), encoder_(nullptr),
+    encode_frame_(nullptr), encode_frame_pts_(-1) {
   VLOG(2) << __func__;
   LOG_IF(FATAL, options.type != STREAM_FILTER_VIDEO_ENC);
 }
@@ -148,6 +175,20 @@ StreamFilterVideoEnc::~StreamFilterVideoEnc() {
 }
 
 StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
+  if (suspended_)
+    return STREAM_FILTER_STATUS_BREAK;
+  if (resume_wait_key_) {
+    // resume from the key frame, then encode it as key frame too
+    if ((pkt->flags & AV_PKT_FLAG_KEY) == 0)
+      return STREAM_FILTER_STATUS_BREAK;
+    resume_wait_key_ = false;
+    if (encoder_) {
+      encoder_->RequestKeyFrame();
+      key_frame_pending_ = false;
+      key_frame_time_ = std::chrono::steady_clock::now();
+    }
+  }
+
   // decode
 
   if (decoder_ == nullptr) {
@@ -164,7 +205,8 @@ StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
     //  https://developer.nvidia.com/blog/nvidia-ffmpeg-transcoding-guide/
     // nvenc
     //  YUVJ420P not support, need convert to YUV420P, then encode to H264/HEVC
-    options.sws_enable = true;
+    //  if video_graph, it converts at its end instead
+    options.sws_enable = !graph_;
     options.sws_dst_pix_fmt = AV_PIX_FMT_YUV420P;
     decoder_ = std::make_shared<StreamVideoOp>(
         options,
@@ -175,6 +217,23 @@ StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
   if (frame == nullptr)
     return STREAM_FILTER_STATUS_BREAK;
 
+  if (options_.enc_framerate > 0 && !graph_) {
+    // drop frame according to the framerate
+    auto t_now = std::chrono::system_clock::now();
+    auto t_interval = std::chrono::duration_cast<std::chrono::milliseconds>(
+        t_now - encode_frame_timestamp_).count();
+    if (t_interval < (1000 / options_.enc_framerate)) {
+      return STREAM_FILTER_STATUS_BREAK;
+    }
+    encode_frame_timestamp_ = t_now;
+  }
+
+  for (auto &&filter : frame_filters_) {
+    frame = filter->FilterFrame(frame);
+    if (frame == nullptr)
+      return STREAM_FILTER_STATUS_BREAK;
+  }
+
   // encode
 
   if (encoder_ == nullptr) {
@@ -207,17 +266,7 @@ StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
       LOG(ERROR) << "FR alloc frame fail";
       throw StreamError(ret);
     }
-  }
-
-  if (options_.enc_framerate > 0) {
-    // drop frame according to the framerate
-    auto t_now = std::chrono::system_clock::now();
-    auto t_interval = std::chrono::duration_cast<std::chrono::milliseconds>(
-        t_now - encode_frame_timestamp_).count();
-    if (t_interval < (1000 / options_.enc_framerate)) {
-      return STREAM_FILTER_STATUS_BREAK;
-    }
-    encode_frame_timestamp_ = t_now;
+    encode_time_beg_ = std::chrono::steady_clock::now();
   }
 
   /*{
@@ -240,6 +289,14 @@ StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
       }
     }
   }*/
+  // the encoder keeps the size of the first frame, never copy over it
+  if (frame->width != encode_frame_->width ||
+      frame->height != encode_frame_->height) {
+    LOG(WARNING) << "FR frame " << frame->width << "x" << frame->height
+        << " not the encoder " << encode_frame_->width << "x"
+        << encode_frame_->height << ", dropped";
+    return STREAM_FILTER_STATUS_BREAK;
+  }
   // av_frame_copy(encode_frame_, frame);  // not work
   {
     av_frame_make_writable(encode_frame_);
@@ -250,7 +307,26 @@ StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
                   static_cast<AVPixelFormat>(encode_frame_->format),
                   frame->width, frame->height);
   }
-  encode_frame_->pts = encode_frame_pts_++;
+  {
+    // pts from the wall clock, as frames may be dropped by the filters
+    auto t_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - encode_time_beg_).count();
+    auto pts = av_rescale_q(t_us, AVRational{1, 1000000},
+        encoder_->GetCodecContext()->time_base);
+    encode_frame_pts_ = std::max(pts, encode_frame_pts_ + 1);
+  }
+  encode_frame_->pts = encode_frame_pts_;
+
+  if (key_frame_pending_) {
+    // rate limit, a reconnect storm shouldn't make every frame a key frame
+    auto t_now = std::chrono::steady_clock::now();
+    if (t_now - key_frame_time_ >= std::chrono::milliseconds(
+        options_.enc_key_frame_min_interval_ms)) {
+      encoder_->RequestKeyFrame();
+      key_frame_pending_ = false;
+      key_frame_time_ = t_now;
+    }
+  }
 
   int ret = encoder_->Send(encode_frame_);
   if (ret < 0) throw StreamError(ret);
@@ -258,6 +334,38 @@ StreamFilterStatus StreamFilterVideoEnc::SendPacket(AVPacket *pkt) {
   return STREAM_FILTER_STATUS_OK;
 }
 
+void StreamFilterVideoEnc::SetSuspended(bool suspended) {
+  if (!options_.enc_on_demand || suspended == suspended_) return;
+  if (suspended) {
+    // run until the first packet encoded, as clients need the stream info
+    if (!encoded_) return;
+    // drop the decoded references, resume from key frame later
+    decoder_->Flush();
+    suspended_ = true;
+  } else {
+    suspended_ = false;
+    resume_wait_key_ = true;
+  }
+}
+
+bool StreamFilterVideoEnc::IsSuspended() const {
+  return suspended_;
+}
+
+void StreamFilterVideoEnc::RequestKeyFrame() {
+  if (options_.enc_key_frame_min_interval_ms < 0) return;
+  // not encoded yet, the first frame is a key frame
+  if (encoder_ == nullptr) return;
+  key_frame_pending_ = true;
+}
+
+void StreamFilterVideoEnc::AddFrameFilter(
+    const std::shared_ptr<StreamFrameFilter> &filter) {
+  LOG_IF(FATAL, decoder_ != nullptr) << "Add frame filters before running";
+  if (filter->GetOptions().type == STREAM_FILTER_VIDEO_GRAPH) graph_ = true;
+  frame_filters_.push_back(filter);
+}
+
 StreamFilterStatus StreamFilterVideoEnc::RecvPacket(AVPacket *pkt) {
   LOG_IF(FATAL, encoder_ == nullptr);
   int ret = encoder_->Recv(pkt);
@@ -266,5 +374,224 @@ StreamFilterStatus StreamFilterVideoEnc::RecvPacket(AVPacket *pkt) {
   } else if (ret < 0) {
     throw StreamError(ret);
   }
+  encoded_ = true;
   return STREAM_FILTER_STATUS_AGAIN;  // recv ok, recv again
 }
+
+// StreamFilterVideoMotionGate
+
+StreamFilterVideoMotionGate::StreamFilterVideoMotionGate(
+    const std::shared_ptr<StreamSub> &stream,
+    const StreamFilterOptions &options)
+  : StreamFrameFilter(stream, options), format_ok_(true), motion_(false) {
+  VLOG(2) << __func__;
+  LOG_IF(FATAL, options.type != STREAM_FILTER_VIDEO_MOTION_GATE);
+}
+
+StreamFilterVideoMotionGate::~StreamFilterVideoMotionGate() {
+  VLOG(2) << __func__;
+}
+
+AVFrame *StreamFilterVideoMotionGate::FilterFrame(AVFrame *frame) {
+  // data[0] must be luma, the sws dst pix_fmt of the video_enc decoder,
+  //  yuv420p by default, or the output of the graph
+  switch (frame->format) {
+  case AV_PIX_FMT_YUV420P: case AV_PIX_FMT_YUVJ420P:
+  case AV_PIX_FMT_YUV422P: case AV_PIX_FMT_YUVJ422P:
+  case AV_PIX_FMT_YUV444P: case AV_PIX_FMT_YUVJ444P:
+  case AV_PIX_FMT_NV12: case AV_PIX_FMT_NV21: case AV_PIX_FMT_GRAY8:
+    break;
+  default:
+    LOG_IF(WARNING, format_ok_) << "Motion gate disabled, pix_fmt="
+        << frame->format << " has no luma plane";
+    format_ok_ = false;
+    return frame;
+  }
+  int width = frame->width / 8;
+  int height = frame->height / 8;
+  if (width <= 0 || height <= 0) return frame;
+
+  auto now = clock::now();
+  luma_cur_.resize(width * height);
+  simd::downscale8_u8(frame->data[0], frame->linesize[0],
+      frame->width, frame->height, luma_cur_.data(), width);
+  ++stats_.frames;
+
+  bool pass = true;
+  if (luma_ref_.size() == luma_cur_.size()) {
+    auto sad = simd::sad_u8(luma_cur_.data(), luma_ref_.data(),
+        luma_cur_.size());
+    stats_.sad_mean = static_cast<double>(sad) / luma_cur_.size();
+    if (stats_.sad_mean > options_.motion_threshold) {
+      VLOG_IF(1, !motion_) << "motion start, sad_mean=" << stats_.sad_mean;
+      motion_ = true;
+      motion_time_ = now;
+      ++stats_.frames_motion;
+    } else if (motion_ && now - motion_time_ >=
+        std::chrono::milliseconds(options_.motion_hold_ms)) {
+      VLOG(1) << "motion stop, sad_mean=" << stats_.sad_mean;
+      motion_ = false;
+    }
+    pass = motion_ || (options_.motion_keepalive_fps > 0 &&
+        now - pass_time_ >= std::chrono::milliseconds(
+            1000 / options_.motion_keepalive_fps));
+  }
+
+  // compare with the last frame passed, so slow changes add up
+  if (pass) {
+    luma_ref_.swap(luma_cur_);
+    pass_time_ = now;
+  } else {
+    ++stats_.frames_dropped;
+  }
+  return pass ? frame : nullptr;
+}
+
+bool StreamFilterVideoMotionGate::IsMotion() const {
+  return motion_;
+}
+
+const StreamMotionStats &StreamFilterVideoMotionGate::GetStats() const {
+  return stats_;
+}
+
+// StreamFilterVideoGraph
+
+StreamFilterVideoGraph::StreamFilterVideoGraph(
+    const std::shared_ptr<StreamSub> &stream,
+    const StreamFilterOptions &options)
+  : StreamFrameFilter(stream, options), graph_(nullptr),
+    src_ctx_(nullptr), sink_ctx_(nullptr), frame_(av_frame_alloc()),
+    sink_frame_(av_frame_alloc()), frames_dropped_(0), src_width_(0),
+    src_height_(0), src_format_(AV_PIX_FMT_NONE), dst_width_(0),
+    dst_height_(0) {
+  VLOG(2) << __func__;
+  LOG_IF(FATAL, options.type != STREAM_FILTER_VIDEO_GRAPH);
+}
+
+StreamFilterVideoGraph::~StreamFilterVideoGraph() {
+  VLOG(2) << __func__;
+  FreeGraph();
+  av_frame_free(&frame_);
+  av_frame_free(&sink_frame_);
+}
+
+AVFrame *StreamFilterVideoGraph::FilterFrame(AVFrame *frame) {
+  if (graph_ == nullptr || frame->width != src_width_ ||
+      frame->height != src_height_ || frame->format != src_format_) {
+    InitGraph(frame);
+  }
+
+  int ret = av_buffersrc_add_frame_flags(src_ctx_, frame,
+      AV_BUFFERSRC_FLAG_KEEP_REF);
+  if (ret < 0) throw StreamError(ret);
+
+  // drain the sink, not to pile up the frames of the graphs output more
+  av_frame_unref(frame_);
+  bool got = false;
+  while (true) {
+    ret = av_buffersink_get_frame(sink_ctx_, sink_frame_);
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+      break;
+    } else if (ret < 0) {
+      throw StreamError(ret);
+    }
+    if (got) {
+      ++frames_dropped_;
+      VLOG_IF(1, frames_dropped_ % 100 == 1) << "Filter graph dropped "
+          << frames_dropped_ << " frames, more than one out per input";
+      av_frame_unref(frame_);
+    }
+    av_frame_move_ref(frame_, sink_frame_);
+    got = true;
+  }
+  return got ? frame_ : nullptr;
+}
+
+void StreamFilterVideoGraph::InitGraph(const AVFrame *frame) {
+  auto desc = options_.graph_desc.empty() ? "null" : options_.graph_desc;
+  CreateGraph(frame, desc);
+
+  auto width = av_buffersink_get_w(sink_ctx_);
+  auto height = av_buffersink_get_h(sink_ctx_);
+  if (dst_width_ <= 0 || dst_height_ <= 0) {
+    dst_width_ = width;
+    dst_height_ = height;
+  } else if (width != dst_width_ || height != dst_height_) {
+    LOG(INFO) << "Filter graph dst " << width << "x" << height
+        << " changed, scale to " << dst_width_ << "x" << dst_height_;
+    desc += ",scale=" + std::to_string(dst_width_) + ":" +
+        std::to_string(dst_height_);
+    CreateGraph(frame, desc);
+  }
+
+  src_width_ = frame->width;
+  src_height_ = frame->height;
+  src_format_ = frame->format;
+  VLOG(1) << "Filter graph: " << desc << ", src " << frame->width << "x"
+      << frame->height << ", dst " << av_buffersink_get_w(sink_ctx_) << "x"
+      << av_buffersink_get_h(sink_ctx_);
+}
+
+void StreamFilterVideoGraph::CreateGraph(const AVFrame *frame,
+                                         const std::string &desc) {
+  FreeGraph();
+
+  graph_ = avfilter_graph_alloc();
+  if (graph_ == nullptr) throw StreamError("Filter graph alloc fail");
+  if (options_.graph_threads > 0)
+    graph_->nb_threads = options_.graph_threads;
+
+  auto time_base = stream_->stream->time_base;
+  auto sar = frame->sample_aspect_ratio;
+  std::stringstream args;
+  args << "video_size=" << frame->width << "x" << frame->height
+      << ":pix_fmt=" << frame->format
+      << ":time_base=" << time_base.num << "/" << time_base.den
+      << ":pixel_aspect=" << sar.num << "/" << std::max(sar.den, 1);
+
+  int ret = avfilter_graph_create_filter(&src_ctx_,
+      avfilter_get_by_name("buffer"), "in", args.str().c_str(),
+      nullptr, graph_);
+  if (ret < 0) throw StreamError(ret);
+  ret = avfilter_graph_create_filter(&sink_ctx_,
+      avfilter_get_by_name("buffersink"), "out", nullptr, nullptr, graph_);
+  if (ret < 0) throw StreamError(ret);
+  // yuv420p to encode
+  enum AVPixelFormat pix_fmts[] = { AV_PIX_FMT_YUV420P, AV_PIX_FMT_NONE };
+  ret = av_opt_set_int_list(sink_ctx_, "pix_fmts", pix_fmts,
+      AV_PIX_FMT_NONE, AV_OPT_SEARCH_CHILDREN);
+  if (ret < 0) throw StreamError(ret);
+
+  // the graph input is the output of src, and the graph output is sink
+  auto outputs = avfilter_inout_alloc();
+  auto inputs = avfilter_inout_alloc();
+  outputs->name = av_strdup("in");
+  outputs->filter_ctx = src_ctx_;
+  outputs->pad_idx = 0;
+  outputs->next = nullptr;
+  inputs->name = av_strdup("out");
+  inputs->filter_ctx = sink_ctx_;
+  inputs->pad_idx = 0;
+  inputs->next = nullptr;
+
+  ret = avfilter_graph_parse_ptr(graph_, desc.c_str(),
+      &inputs, &outputs, nullptr);
+  avfilter_inout_free(&inputs);
+  avfilter_inout_free(&outputs);
+  if (ret < 0) {
+    throw_error<StreamError>() << "Filter graph parse fail: " << desc;
+  }
+  ret = avfilter_graph_config(graph_, nullptr);
+  if (ret < 0) throw StreamError(ret);
+}
+
+void StreamFilterVideoGraph::FreeGraph() {
+  if (graph_) {
+    // free the filters too
+    avfilter_graph_free(&graph_);
+    graph_ = nullptr;
+  }
+  src_ctx_ = nullptr;
+  sink_ctx_ = nullptr;
+}
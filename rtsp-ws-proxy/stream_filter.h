@@ -1,9 +1,11 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #ifdef __cplusplus
 extern "C" {
@@ -11,6 +13,8 @@ extern "C" {
 
 struct AVBSFContext;
 struct AVCodecContext;
+struct AVFilterContext;
+struct AVFilterGraph;
 struct AVFrame;
 struct AVPacket;
 
@@ -27,6 +31,8 @@ enum StreamFilterType {
   STREAM_FILTER_NONE,
   STREAM_FILTER_VIDEO_BSF,
   STREAM_FILTER_VIDEO_ENC,
+  STREAM_FILTER_VIDEO_MOTION_GATE,
+  STREAM_FILTER_VIDEO_GRAPH,
 };
 
 enum StreamFilterStatus {
@@ -55,11 +61,28 @@ struct StreamFilterOptions {
   int enc_qmax = -1;
   int enc_thread_count = -1;
   std::map<std::string, std::string> enc_open_options{};
+  // suspend decode and encode if no one is watching
+  bool enc_on_demand = true;
+  // encode a key frame if someone joins, but not more often than the interval
+  //  disable if < 0
+  int enc_key_frame_min_interval_ms = 1000;
 
   std::string dec_name = "";
   int dec_thread_count = -1;
   //  1: FF_THREAD_FRAME, 2: FF_THREAD_SLICE
   int dec_thread_type = -1;
+
+  // motion gate options
+  //  compare the 8x downscaled luma with the last frame passed
+  double motion_threshold = 2.0;  // motion if mean abs diff > it, 0~255
+  int motion_hold_ms = 2000;      // keep the framerate after motion stopped
+  int motion_keepalive_fps = 1;   // framerate if no motion, drop all if <= 0
+
+  // graph options
+  //  filtergraph description, e.g. "fps=10,scale=640:-2"
+  //  frames are converted to yuv420p at its end
+  std::string graph_desc = "";
+  int graph_threads = 0;  // set if > 0, slice threads
 };
 
 class StreamFilter {
@@ -73,6 +96,33 @@ class StreamFilter {
   virtual StreamFilterStatus SendPacket(AVPacket *pkt) = 0;
   virtual StreamFilterStatus RecvPacket(AVPacket *pkt) = 0;
 
+  // Suspend the filter if its packets not needed, or resume it
+  virtual void SetSuspended(bool suspended) { (void)suspended; }
+  virtual bool IsSuspended() const { return false; }
+
+  // Request a key frame as soon as possible, if the filter could
+  virtual void RequestKeyFrame() {}
+
+ protected:
+  std::shared_ptr<StreamSub> stream_;
+  StreamFilterOptions options_;
+};
+
+// StreamFrameFilter
+//  filter the decoded frames before encoding, used by the next video_enc
+
+class StreamFrameFilter {
+ public:
+  StreamFrameFilter(const std::shared_ptr<StreamSub> &stream,
+      const StreamFilterOptions &options);
+  virtual ~StreamFrameFilter();
+
+  const StreamFilterOptions &GetOptions() const;
+
+  // return the frame filtered, or nullptr if dropped
+  //  the frame returned is valid until the next call
+  virtual AVFrame *FilterFrame(AVFrame *frame) = 0;
+
  protected:
   std::shared_ptr<StreamSub> stream_;
   StreamFilterOptions options_;
@@ -106,10 +156,97 @@ class StreamFilterVideoEnc : public StreamFilter {
   StreamFilterStatus SendPacket(AVPacket *pkt) override;
   StreamFilterStatus RecvPacket(AVPacket *pkt) override;
 
+  void SetSuspended(bool suspended) override;
+  bool IsSuspended() const override;
+
+  void RequestKeyFrame() override;
+
+  void AddFrameFilter(const std::shared_ptr<StreamFrameFilter> &filter);
+
  private:
+  std::vector<std::shared_ptr<StreamFrameFilter>> frame_filters_;
+  bool graph_;
+
+  bool suspended_;
+  bool resume_wait_key_;
+  bool encoded_;
+
+  bool key_frame_pending_;
+  std::chrono::steady_clock::time_point key_frame_time_;
+
   std::shared_ptr<StreamVideoOp> decoder_;
   std::shared_ptr<StreamVideoEncoder> encoder_;
   AVFrame *encode_frame_;
   int64_t encode_frame_pts_;
   std::chrono::system_clock::time_point encode_frame_timestamp_;
+  std::chrono::steady_clock::time_point encode_time_beg_;
+};
+
+// StreamFilterVideoMotionGate
+//  drop the frames if no motion, but keep alive in a low framerate
+
+struct StreamMotionStats {
+  uint64_t frames = 0;          // frames checked
+  uint64_t frames_motion = 0;   // frames with motion
+  uint64_t frames_dropped = 0;  // frames dropped as no motion
+  double sad_mean = 0;          // mean abs diff of the last frame
+};
+
+class StreamFilterVideoMotionGate : public StreamFrameFilter {
+ public:
+  StreamFilterVideoMotionGate(const std::shared_ptr<StreamSub> &stream,
+      const StreamFilterOptions &options);
+  ~StreamFilterVideoMotionGate() override;
+
+  AVFrame *FilterFrame(AVFrame *frame) override;
+
+  bool IsMotion() const;
+  const StreamMotionStats &GetStats() const;
+
+ private:
+  using clock = std::chrono::steady_clock;
+
+  bool format_ok_;
+  std::vector<uint8_t> luma_ref_;
+  std::vector<uint8_t> luma_cur_;
+
+  bool motion_;
+  clock::time_point motion_time_;
+  clock::time_point pass_time_;
+
+  StreamMotionStats stats_;
+};
+
+// StreamFilterVideoGraph
+//  run a libavfilter filtergraph, e.g. fps, scale
+
+class StreamFilterVideoGraph : public StreamFrameFilter {
+ public:
+  StreamFilterVideoGraph(const std::shared_ptr<StreamSub> &stream,
+      const StreamFilterOptions &options);
+  ~StreamFilterVideoGraph() override;
+
+  // one frame out at most each time, the latest, as encoded once per input
+  //  the extra ones dropped, e.g. fps up-conversion, yadif=1
+  AVFrame *FilterFrame(AVFrame *frame) override;
+
+ private:
+  // rebuilt if the src changed, the dst size pinned to the first one by a
+  //  scale at the end, as the encoder is opened with it
+  void InitGraph(const AVFrame *frame);
+  void CreateGraph(const AVFrame *frame, const std::string &desc);
+  void FreeGraph();
+
+  AVFilterGraph *graph_;
+  AVFilterContext *src_ctx_;
+  AVFilterContext *sink_ctx_;
+  AVFrame *frame_;
+  AVFrame *sink_frame_;
+  uint64_t frames_dropped_;
+
+  int src_width_;
+  int src_height_;
+  int src_format_;
+  int dst_width_;
+  int dst_height_;
 };
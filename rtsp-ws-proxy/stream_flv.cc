@@ -0,0 +1,171 @@
+#include "stream_flv.h"
+
+#include <cstring>
+#include <utility>
+
+#include "common/util/log.h"
+
+namespace {
+
+// if the stream changed, e.g. looped, could go on with the same header
+bool IsCodecparSame(const AVCodecParameters *a, const AVCodecParameters *b) {
+  return a->codec_id == b->codec_id &&
+      a->width == b->width &&
+      a->height == b->height &&
+      a->extradata_size == b->extradata_size &&
+      (a->extradata_size <= 0 ||
+       std::memcmp(a->extradata, b->extradata, a->extradata_size) == 0);
+}
+
+}  // namespace
+
+bool StreamFlv::Viewer::Take(std::vector<bytes_t> *bytes, waiter_t waiter) {
+  std::lock_guard<std::mutex> _(mutex_);
+  if (header_ == nullptr && queue_.empty() && !closed_) {
+    waiter_ = std::move(waiter);
+    return false;
+  }
+  bytes->clear();
+  if (header_ != nullptr) {
+    bytes->push_back(std::move(header_));
+    header_ = nullptr;
+  }
+  bytes->insert(bytes->end(), queue_.begin(), queue_.end());
+  queue_.clear();
+  return true;
+}
+
+void StreamFlv::Viewer::CancelWaiter() {
+  std::lock_guard<std::mutex> _(mutex_);
+  waiter_ = nullptr;
+}
+
+bool StreamFlv::Viewer::IsClosed() {
+  std::lock_guard<std::mutex> _(mutex_);
+  return closed_;
+}
+
+void StreamFlv::Viewer::SetHeader(const bytes_t &header) {
+  waiter_t waiter = nullptr;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    header_ = header;
+    waiter.swap(waiter_);
+  }
+  if (waiter) waiter();
+}
+
+void StreamFlv::Viewer::Push(const bytes_t &bytes, bool key,
+                             std::size_t max_size) {
+  waiter_t waiter = nullptr;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (!key && wait_key_) return;
+    if (queue_.size() >= max_size) {
+      // too slow, drop to the next key frame
+      LOG(WARNING) << "Flv viewer queue size=" << queue_.size()
+          << " >= " << max_size << ", drop to the next key frame";
+      queue_.clear();
+      wait_key_ = true;
+      if (!key) return;
+    }
+    wait_key_ = false;
+    queue_.push_back(bytes);
+    waiter.swap(waiter_);
+  }
+  if (waiter) waiter();
+}
+
+void StreamFlv::Viewer::Close() {
+  waiter_t waiter = nullptr;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    closed_ = true;
+    waiter.swap(waiter_);
+  }
+  if (waiter) waiter();
+}
+
+StreamFlv::StreamFlv(const StreamFlvOptions &options)
+  : options_(options), stream_(nullptr), muxer_(nullptr),
+    codecpar_(avcodec_parameters_alloc()) {
+  if (options_.queue_max_size < 2) options_.queue_max_size = 2;
+}
+
+StreamFlv::~StreamFlv() {
+  avcodec_parameters_free(&codecpar_);
+}
+
+std::shared_ptr<StreamFlv::Viewer> StreamFlv::Join() {
+  auto viewer = std::make_shared<Viewer>();
+  std::lock_guard<std::mutex> _(mutex_);
+  // the header first, then the tags from the key frame
+  if (muxer_ != nullptr) viewer->SetHeader(muxer_->GetHeader());
+  viewers_.insert(viewer);
+  return viewer;
+}
+
+void StreamFlv::Leave(const std::shared_ptr<Viewer> &viewer) {
+  // not called by the tags pushed to the viewers copied by Send
+  viewer->CancelWaiter();
+  std::lock_guard<std::mutex> _(mutex_);
+  viewers_.erase(viewer);
+  // mux again from the next key frame if joined
+  if (viewers_.empty()) muxer_ = nullptr;
+}
+
+bool StreamFlv::Empty() {
+  std::lock_guard<std::mutex> _(mutex_);
+  return viewers_.empty();
+}
+
+void StreamFlv::Send(const std::shared_ptr<Stream> &stream,
+                     AVMediaType type, AVPacket *packet) {
+  if (type != AVMEDIA_TYPE_VIDEO) return;
+  auto key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+  auto par = stream->GetStreamSub(type)->info->codecpar;
+
+  std::shared_ptr<StreamFlvMuxer> muxer;
+  std::vector<std::shared_ptr<Viewer>> viewers;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    if (viewers_.empty()) return;
+    if (muxer_ != nullptr && stream_ != stream) {
+      stream_ = stream;
+      if (!IsCodecparSame(codecpar_, par)) {
+        // a new header not allowed in the middle, end the viewers
+        LOG(INFO) << "Flv codec parameters changed, end the viewers";
+        for (auto &&v : viewers_) v->Close();
+        viewers_.clear();
+        muxer_ = nullptr;
+        return;
+      }
+    }
+    if (muxer_ == nullptr) {
+      if (!key) return;
+      try {
+        muxer_ = std::make_shared<StreamFlvMuxer>(par);
+      } catch (const StreamError &e) {
+        LOG(ERROR) << "Flv " << e.what();
+        return;
+      }
+      stream_ = stream;
+      avcodec_parameters_copy(codecpar_, par);
+      for (auto &&v : viewers_) v->SetHeader(muxer_->GetHeader());
+    }
+    muxer = muxer_;
+    viewers.assign(viewers_.begin(), viewers_.end());
+  }
+
+  StreamFlv::bytes_t tag;
+  try {
+    tag = muxer->Write(packet);
+  } catch (const StreamError &e) {
+    LOG(ERROR) << "Flv " << e.what();
+    return;
+  }
+  if (tag == nullptr) return;
+  for (auto &&v : viewers) {
+    v->Push(tag, key, options_.queue_max_size);
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "common/media/stream.h"
+
+#include "stream_flv_muxer.h"
+
+struct StreamFlvOptions {
+  // drop the queued tags and wait the key frame if more than it
+  std::size_t queue_max_size = 100;
+};
+
+// HTTP-FLV of the stream, the tags muxed once and shared by all viewers
+class StreamFlv {
+ public:
+  using bytes_t = StreamMuxer::bytes_t;
+  using waiter_t = std::function<void()>;
+
+  class Viewer {
+   public:
+    // take the bytes queued, return false if none and the waiter is called
+    //  once by the stream thread when queued or closed, thread safe
+    bool Take(std::vector<bytes_t> *bytes, waiter_t waiter);
+    // remove the waiter not called, e.g. timeout
+    void CancelWaiter();
+    bool IsClosed();
+
+   private:
+    friend class StreamFlv;
+
+    void SetHeader(const bytes_t &header);
+    void Push(const bytes_t &bytes, bool key, std::size_t max_size);
+    void Close();
+
+    std::mutex mutex_;
+    // taken before the queue, not dropped with it
+    bytes_t header_ = nullptr;
+    std::vector<bytes_t> queue_;
+    bool wait_key_ = true;
+    bool closed_ = false;
+    waiter_t waiter_ = nullptr;
+  };
+
+  explicit StreamFlv(const StreamFlvOptions &options);
+  ~StreamFlv();
+
+  std::shared_ptr<Viewer> Join();
+  void Leave(const std::shared_ptr<Viewer> &viewer);
+  bool Empty();
+
+  // mux the video packet, called by the stream thread
+  void Send(const std::shared_ptr<Stream> &stream,
+            AVMediaType type, AVPacket *packet);
+
+ private:
+  StreamFlvOptions options_;
+
+  std::mutex mutex_;
+  std::unordered_set<std::shared_ptr<Viewer>> viewers_;
+  std::shared_ptr<Stream> stream_;
+  std::shared_ptr<StreamFlvMuxer> muxer_;
+  AVCodecParameters *codecpar_;
+};
@@ -0,0 +1,15 @@
+#include "stream_flv_muxer.h"
+
+StreamFlvMuxer::StreamFlvMuxer(const AVCodecParameters *codecpar)
+  : StreamMuxer("flv", codecpar, {
+        // live, not seek back to write them
+        {"flvflags", "no_duration_filesize"}}) {
+}
+
+StreamFlvMuxer::~StreamFlvMuxer() {
+}
+
+StreamFlvMuxer::bytes_t StreamFlvMuxer::Write(AVPacket *packet) {
+  WritePacket(packet);
+  return TakeBytes();
+}
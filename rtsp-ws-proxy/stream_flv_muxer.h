@@ -0,0 +1,15 @@
+#pragma once
+
+#include "stream_muxer.h"
+
+// Remux the video packets into flv without transcoding,
+//  the header (flv header, metadata, sequence header) and the tags
+class StreamFlvMuxer : public StreamMuxer {
+ public:
+  // throw StreamError if fail
+  explicit StreamFlvMuxer(const AVCodecParameters *codecpar);
+  ~StreamFlvMuxer() override;
+
+  // mux the packet as a tag, only ref it, throw StreamError if fail
+  bytes_t Write(AVPacket *packet);
+};
@@ -0,0 +1,55 @@
+#include "stream_fmp4_muxer.h"
+
+StreamFmp4Muxer::StreamFmp4Muxer(
+    const AVCodecParameters *codecpar,
+    const StreamFmp4MuxerOptions &options)
+  : StreamMuxer("mp4", codecpar, {
+        // moov without samples, moof with base data offset, flushed by us
+        {"movflags", "empty_moov+default_base_moof+frag_custom"}}),
+    options_(options), frag_key_(false), frag_empty_(true),
+    frag_duration_(0) {
+}
+
+StreamFmp4Muxer::~StreamFmp4Muxer() {
+}
+
+const StreamFmp4Muxer::bytes_t &StreamFmp4Muxer::GetInit() const {
+  return GetHeader();
+}
+
+StreamFmp4Muxer::Fragment StreamFmp4Muxer::Write(AVPacket *packet) {
+  auto is_key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+  Fragment frag{};
+  // not per frame, flush the last one before the key frame
+  if (!options_.frag_per_frame && is_key && !frag_empty_) {
+    frag = Flush();
+  }
+
+  frag_duration_ += WritePacket(packet);
+  if (frag_empty_) {
+    frag_key_ = is_key;
+    frag_empty_ = false;
+  }
+
+  if (options_.frag_per_frame) {
+    frag = Flush();
+  }
+  return frag;
+}
+
+StreamFmp4Muxer::Fragment StreamFmp4Muxer::Flush() {
+  Fragment frag{};
+  if (frag_empty_) return frag;
+  // write the fragment of the buffered samples, as frag_custom
+  WriteFlush();
+  frag.data = TakeBytes();
+  frag.key = frag_key_;
+  frag.duration = GetPendingDuration();
+  frag_empty_ = true;
+  frag_duration_ = 0;
+  return frag;
+}
+
+double StreamFmp4Muxer::GetPendingDuration() const {
+  return frag_duration_ * av_q2d(GetTimeBase());
+}
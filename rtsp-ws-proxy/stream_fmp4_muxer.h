@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+
+#include "stream_muxer.h"
+
+struct StreamFmp4MuxerOptions {
+  // a fragment per frame for low latency, otherwise per gop or by Flush()
+  bool frag_per_frame = true;
+};
+
+// Remux the video packets into fragmented mp4 without transcoding,
+//  the init segment (ftyp, moov) and the fragments (moof, mdat) for MSE
+class StreamFmp4Muxer : public StreamMuxer {
+ public:
+  struct Fragment {
+    bytes_t data = nullptr;  // nullptr if not flushed
+    bool key = false;        // starts with a key frame
+    double duration = 0;     // seconds
+  };
+
+  // throw StreamError if fail
+  StreamFmp4Muxer(const AVCodecParameters *codecpar,
+                  const StreamFmp4MuxerOptions &options);
+  ~StreamFmp4Muxer() override;
+
+  const bytes_t &GetInit() const;
+
+  // mux the packet, only ref it
+  //  return the fragment if flushed, throw StreamError if fail
+  Fragment Write(AVPacket *packet);
+  // flush the samples not flushed as a fragment, throw StreamError if fail
+  Fragment Flush();
+
+  // the duration of the samples not flushed, seconds
+  double GetPendingDuration() const;
+
+ private:
+  StreamFmp4MuxerOptions options_;
+
+  bool frag_key_;
+  bool frag_empty_;
+  int64_t frag_duration_;
+};
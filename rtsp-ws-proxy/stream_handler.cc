@@ -22,13 +22,41 @@ StreamHandler::StreamHandler(
     const StreamOptions &options,
     const std::vector<StreamFilterOptions> &filters_options,
     int get_frequency,
-    packet_callback_t cb)
+    packet_callback_t cb,
+    demand_callback_t demand_cb)
   : id_(id), options_(options), filters_options_(filters_options),
-    get_frequency_(get_frequency), packet_cb_(cb),
-    stream_(nullptr), video_filters_inited_(false), packet_recv_(nullptr) {
+    get_frequency_(get_frequency), packet_cb_(cb), demand_cb_(demand_cb),
+    stream_(nullptr), video_filters_inited_(false),
+    video_filters_suspended_(false), key_frame_requested_(false),
+    packet_recv_(nullptr) {
   std::stringstream ss;
   ss << "Stream[" << id_ << "]";
   log_id_ = ss.str();
+
+  auto &&r = metrics::Registry::Instance();
+  metrics::labels_t labels{{"stream", id_}};
+  metrics_.packets = r.GetCounter("rtsp_ws_stream_packets_total",
+      "The video packets read.", labels);
+  metrics_.bytes = r.GetCounter("rtsp_ws_stream_bytes_total",
+      "The video bytes read.", labels);
+  metrics_.key_frames = r.GetCounter("rtsp_ws_stream_key_frames_total",
+      "The video key frames read.", labels);
+  metrics_.reconnects = r.GetCounter("rtsp_ws_stream_reconnects_total",
+      "The times opened again, e.g. looped.", labels);
+  metrics_.errors = r.GetCounter("rtsp_ws_stream_errors_total",
+      "The errors stopped the stream.", labels);
+  metrics_.fps = r.GetGauge("rtsp_ws_stream_fps",
+      "The video packets read in the last second.", labels);
+  metrics_.bitrate = r.GetGauge("rtsp_ws_stream_bitrate_bps",
+      "The video bits read in the last second.", labels);
+  metrics_.key_interval = r.GetHistogram(
+      "rtsp_ws_stream_key_frame_interval_seconds",
+      "The time between the video key frames.",
+      {250000, 500000, 1000000, 2000000, 4000000, 8000000, 16000000},
+      1e-6, labels);
+  metrics_.read_gap = r.GetHistogram("rtsp_ws_stream_read_gap_seconds",
+      "The time between the video packets read.",
+      metrics::Histogram::LatencyBounds(), 1e-6, labels);
 }
 
 StreamHandler::~StreamHandler() {
@@ -53,9 +81,17 @@ void StreamHandler::Stop() {
   }
 }
 
+void StreamHandler::RequestKeyFrame() {
+  key_frame_requested_ = true;
+}
+
 void StreamHandler::OnEvent(const std::shared_ptr<StreamEvent> &e) {
   if (e->id == STREAM_EVENT_OPEN) {
     LOG(INFO) << log_id_ << " open ...";
+    if (metrics_.opened) metrics_.reconnects->Add();
+    metrics_.opened = true;
+    // not a read gap
+    metrics_.packet_time = {};
   } else if (e->id == STREAM_EVENT_OPENED) {
     LOG(INFO) << log_id_ << " open success";
   // } else if (e->id == STREAM_EVENT_CLOSE) {
@@ -67,6 +103,7 @@ void StreamHandler::OnEvent(const std::shared_ptr<StreamEvent> &e) {
   } else if (e->id == STREAM_EVENT_ERROR) {
     auto event = std::dynamic_pointer_cast<StreamErrorEvent>(e);
     LOG(ERROR) << log_id_ << " " << event->error.what();
+    metrics_.errors->Add();
   }
 }
 
@@ -85,8 +122,15 @@ void StreamHandler::OnRunning(const std::shared_ptr<StreamThread> &thread,
   if (sub->stream->index != packet->stream_index) {
     return;
   }
+  UpdateMetrics(packet);
 
   InitVideoFilters(sub);
+  UpdateVideoFilters();
+  if (key_frame_requested_.exchange(false)) {
+    for (auto &&filter : video_filters_) {
+      filter->RequestKeyFrame();
+    }
+  }
 
   if (video_filters_.empty()) {
     if (packet_cb_) {
@@ -100,6 +144,7 @@ void StreamHandler::OnRunning(const std::shared_ptr<StreamThread> &thread,
     };
     DoFilter(video_filters_, video_filters_.begin(), packet, do_callback);
     t->End();
+    LogMotionStats();
   }
 
   VLOG(2) << t->Log();
@@ -116,12 +161,23 @@ void StreamHandler::DoFilter(
   }
 
   int status;
+  // the time of this filter, the next ones excluded
+  auto &&latency = metrics_.filters[filter - video_filters_.begin()];
+  auto time_beg = std::chrono::steady_clock::now();
+  std::chrono::steady_clock::duration cost{};
+  auto observe = [&latency, &cost]() {
+    latency->Observe(std::chrono::duration_cast<std::chrono::microseconds>(
+        cost).count());
+  };
 
   // send
   do {
     status = (*filter)->SendPacket(pkt);
     av_packet_unref(pkt);
-    if (status == STREAM_FILTER_STATUS_BREAK) return;
+    if (status == STREAM_FILTER_STATUS_BREAK) {
+      cost = std::chrono::steady_clock::now() - time_beg;
+      return observe();
+    }
   } while (status == STREAM_FILTER_STATUS_AGAIN);
 
   // recv
@@ -130,32 +186,130 @@ void StreamHandler::DoFilter(
   }
   do {
     status = (*filter)->RecvPacket(packet_recv_);
+    cost += std::chrono::steady_clock::now() - time_beg;
     if (status == STREAM_FILTER_STATUS_BREAK) {
       av_packet_unref(packet_recv_);
-      return;
+      return observe();
     }
     DoFilter(filters, filter+1, packet_recv_, on_recv);
     av_packet_unref(packet_recv_);
+    time_beg = std::chrono::steady_clock::now();
   } while (status == STREAM_FILTER_STATUS_AGAIN);
 
   // STREAM_FILTER_STATUS_OK
+  observe();
 }
 
 void StreamHandler::InitVideoFilters(
     const std::shared_ptr<Stream::stream_sub_t> &video) {
   if (video_filters_inited_) return;
+  // frame filters are used by the next video_enc
+  std::vector<std::shared_ptr<StreamFrameFilter>> frame_filters;
   for (auto opts : filters_options_) {
     switch (opts.type) {
     case STREAM_FILTER_VIDEO_BSF:
       video_filters_.push_back(std::make_shared<StreamFilterVideoBSF>(
           video, opts));
       break;
-    case STREAM_FILTER_VIDEO_ENC:
-      video_filters_.push_back(std::make_shared<StreamFilterVideoEnc>(
+    case STREAM_FILTER_VIDEO_ENC: {
+      auto filter = std::make_shared<StreamFilterVideoEnc>(video, opts);
+      for (auto &&f : frame_filters) filter->AddFrameFilter(f);
+      frame_filters.clear();
+      video_filters_.push_back(filter);
+    } break;
+    case STREAM_FILTER_VIDEO_MOTION_GATE: {
+      auto filter = std::make_shared<StreamFilterVideoMotionGate>(
+          video, opts);
+      motion_gates_.push_back(filter);
+      frame_filters.push_back(filter);
+    } break;
+    case STREAM_FILTER_VIDEO_GRAPH:
+      frame_filters.push_back(std::make_shared<StreamFilterVideoGraph>(
           video, opts));
       break;
     default: break;
     }
   }
+  LOG_IF(WARNING, !frame_filters.empty()) << log_id_
+      << " frame filters ignored, need a video_enc filter after them";
+  for (std::size_t i = 0; i < video_filters_.size(); ++i) {
+    auto type = StreamFilterTypeToString(video_filters_[i]->GetOptions().type);
+    metrics_.filters.push_back(metrics::Registry::Instance().GetHistogram(
+        "rtsp_ws_stream_filter_seconds",
+        "The time of the filter per packet, the frame filters included.",
+        metrics::Histogram::LatencyBounds(), 1e-6,
+        {{"stream", id_}, {"filter", std::to_string(i) + "_" + type}}));
+  }
+  motion_stats_time_ = std::chrono::steady_clock::now();
   video_filters_inited_ = true;
 }
+
+void StreamHandler::UpdateVideoFilters() {
+  if (demand_cb_ == nullptr || video_filters_.empty()) return;
+  auto suspended = !demand_cb_();
+  for (auto &&filter : video_filters_) {
+    filter->SetSuspended(suspended);
+  }
+  if (suspended == video_filters_suspended_) return;
+  // filters may not suspend at once, log only if they did
+  for (auto &&filter : video_filters_) {
+    if (filter->IsSuspended() == suspended) {
+      video_filters_suspended_ = suspended;
+      LOG(INFO) << log_id_ << " filters "
+          << (suspended ? "suspended, no one is watching" : "resumed");
+      break;
+    }
+  }
+}
+
+void StreamHandler::LogMotionStats() {
+  if (motion_gates_.empty()) return;
+  auto now = std::chrono::steady_clock::now();
+  if (now - motion_stats_time_ < std::chrono::minutes(1)) return;
+  motion_stats_time_ = now;
+  for (auto &&gate : motion_gates_) {
+    auto &&stats = gate->GetStats();
+    auto percent = [&stats](uint64_t n) {
+      return stats.frames > 0 ? n * 100 / stats.frames : 0;
+    };
+    LOG(INFO) << log_id_ << " motion " << (gate->IsMotion() ? "on" : "off")
+        << ", frames=" << stats.frames
+        << ", motion=" << percent(stats.frames_motion) << "%"
+        << ", dropped=" << percent(stats.frames_dropped) << "%"
+        << ", sad_mean=" << stats.sad_mean;
+  }
+}
+
+void StreamHandler::UpdateMetrics(AVPacket *packet) {
+  auto now = std::chrono::steady_clock::now();
+  auto us = [](std::chrono::steady_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  };
+  metrics_.packets->Add();
+  metrics_.bytes->Add(packet->size);
+  if (metrics_.packet_time != std::chrono::steady_clock::time_point{}) {
+    metrics_.read_gap->Observe(us(now - metrics_.packet_time));
+  }
+  metrics_.packet_time = now;
+  if (packet->flags & AV_PKT_FLAG_KEY) {
+    metrics_.key_frames->Add();
+    if (metrics_.key_time != std::chrono::steady_clock::time_point{}) {
+      metrics_.key_interval->Observe(us(now - metrics_.key_time));
+    }
+    metrics_.key_time = now;
+  }
+
+  ++metrics_.window_packets;
+  metrics_.window_bytes += packet->size;
+  auto elapsed = now - metrics_.window_time;
+  if (elapsed < std::chrono::seconds(1)) return;
+  if (elapsed < std::chrono::seconds(2)) {
+    auto s = us(elapsed) * 1e-6;
+    metrics_.fps->Set(static_cast<int64_t>(metrics_.window_packets / s + 0.5));
+    metrics_.bitrate->Set(
+        static_cast<int64_t>(metrics_.window_bytes * 8 / s + 0.5));
+  }
+  metrics_.window_time = now;
+  metrics_.window_packets = 0;
+  metrics_.window_bytes = 0;
+}
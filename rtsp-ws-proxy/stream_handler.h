@@ -1,11 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <string>
 #include <memory>
 #include <vector>
 
 #include "common/media/stream_thread.h"
+#include "common/util/metrics.h"
 
 #include "stream_filter.h"
 
@@ -13,17 +16,24 @@ class StreamHandler {
  public:
   using packet_callback_t = std::function<void(
       const std::shared_ptr<Stream> &, const AVMediaType &, AVPacket *)>;
+  // return true if the packets are needed by someone
+  using demand_callback_t = std::function<bool()>;
 
   StreamHandler(const std::string &id,
                 const StreamOptions &options,
                 const std::vector<StreamFilterOptions> &filters_options,
                 int get_frequency,
-                packet_callback_t cb = nullptr);
+                packet_callback_t cb = nullptr,
+                demand_callback_t demand_cb = nullptr);
   ~StreamHandler();
 
   void Start();
   void Stop();
 
+  // Request a key frame from the filters as soon as possible, thread safe
+  //  e.g. encode the next frame as key frame if someone joins
+  void RequestKeyFrame();
+
  private:
   void OnEvent(const std::shared_ptr<StreamEvent> &e);
   void OnRunning(const std::shared_ptr<StreamThread> &t,
@@ -34,17 +44,48 @@ class StreamHandler {
       AVPacket *pkt,
       std::function<void(AVPacket *pkt)> on_recv);
   void InitVideoFilters(const std::shared_ptr<Stream::stream_sub_t> &video);
+  void UpdateVideoFilters();
+  void LogMotionStats();
+  void UpdateMetrics(AVPacket *packet);
 
   std::string id_;
   StreamOptions options_;
   std::vector<StreamFilterOptions> filters_options_;
   int get_frequency_;
   packet_callback_t packet_cb_;
+  demand_callback_t demand_cb_;
 
   std::string log_id_;
 
   std::shared_ptr<StreamThread> stream_;
   bool video_filters_inited_;
   std::vector<std::shared_ptr<StreamFilter>> video_filters_;
+  bool video_filters_suspended_;
+  std::atomic_bool key_frame_requested_;
+  std::vector<std::shared_ptr<StreamFilterVideoMotionGate>> motion_gates_;
+  std::chrono::steady_clock::time_point motion_stats_time_;
   AVPacket *packet_recv_;
+
+  // exported by /metrics, updated by the stream thread
+  struct Metrics {
+    std::shared_ptr<metrics::Counter> packets;
+    std::shared_ptr<metrics::Counter> bytes;
+    std::shared_ptr<metrics::Counter> key_frames;
+    std::shared_ptr<metrics::Counter> reconnects;
+    std::shared_ptr<metrics::Counter> errors;
+    std::shared_ptr<metrics::Gauge> fps;
+    std::shared_ptr<metrics::Gauge> bitrate;
+    std::shared_ptr<metrics::Histogram> key_interval;
+    std::shared_ptr<metrics::Histogram> read_gap;
+    // by the video filters
+    std::vector<std::shared_ptr<metrics::Histogram>> filters;
+
+    bool opened = false;
+    std::chrono::steady_clock::time_point packet_time;
+    std::chrono::steady_clock::time_point key_time;
+    // the fps and the bitrate of the last second
+    std::chrono::steady_clock::time_point window_time;
+    uint64_t window_packets = 0;
+    uint64_t window_bytes = 0;
+  } metrics_;
 };
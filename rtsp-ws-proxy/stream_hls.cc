@@ -0,0 +1,223 @@
+#include "stream_hls.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <utility>
+
+#include "common/util/log.h"
+
+namespace {
+
+int64_t NowCount() {
+  return std::chrono::steady_clock::now().time_since_epoch().count();
+}
+
+}  // namespace
+
+StreamHls::StreamHls(const StreamHlsOptions &options)
+  : options_(options), stream_(nullptr), muxer_(nullptr), gen_(0),
+    init_(nullptr), msn_next_(0), segment_max_duration_(0), waiter_next_(0),
+    touch_time_(NowCount()) {
+  options_.part_target_ms = std::max(options_.part_target_ms, 100);
+  options_.segment_target_ms = std::max(options_.segment_target_ms,
+      options_.part_target_ms);
+  options_.segments_max = std::max(options_.segments_max, 2);
+}
+
+StreamHls::~StreamHls() {
+}
+
+void StreamHls::Send(const std::shared_ptr<Stream> &stream,
+                     AVMediaType type, AVPacket *packet) {
+  if (type != AVMEDIA_TYPE_VIDEO) return;
+  auto key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+
+  try {
+    if (muxer_ == nullptr || stream_ != stream) {
+      // start at the key frame, again if the stream changed
+      if (!key) return;
+      StreamFmp4MuxerOptions options{};
+      options.frag_per_frame = false;
+      muxer_ = std::make_shared<StreamFmp4Muxer>(
+          stream->GetStreamSub(type)->info->codecpar, options);
+      stream_ = stream;
+
+      std::lock_guard<std::mutex> _(mutex_);
+      ++gen_;
+      init_ = muxer_->GetInit();
+      segments_.clear();
+      segments_.push_back(std::make_shared<Segment>());
+      segments_.back()->msn = msn_next_++;
+    }
+
+    // the part before the key frame is flushed, then split the segment
+    auto frag = muxer_->Write(packet);
+    if (frag.data != nullptr) AddPart(frag);
+    if (key) {
+      std::lock_guard<std::mutex> _(mutex_);
+      auto &&seg = segments_.back();
+      if (!seg->parts.empty() &&
+          seg->duration * 1000 >= options_.segment_target_ms) {
+        CloseSegment();
+      }
+    } else if (muxer_->GetPendingDuration() * 1000 >= options_.part_target_ms) {
+      frag = muxer_->Flush();
+      if (frag.data != nullptr) AddPart(frag);
+    }
+  } catch (const StreamError &e) {
+    LOG(ERROR) << "Hls " << e.what();
+    muxer_ = nullptr;
+  }
+}
+
+void StreamHls::AddPart(const StreamFmp4Muxer::Fragment &frag) {
+  std::unordered_map<uint64_t, waiter_t> waiters;
+  {
+    std::lock_guard<std::mutex> _(mutex_);
+    auto &&seg = segments_.back();
+    seg->parts.push_back(std::make_shared<Part>(
+        Part{frag.data, frag.duration, frag.key}));
+    seg->duration += frag.duration;
+    waiters.swap(waiters_);
+  }
+  for (auto &&w : waiters) {
+    w.second();
+  }
+}
+
+void StreamHls::CloseSegment() {
+  auto &&seg = segments_.back();
+  std::size_t n = 0;
+  for (auto &&p : seg->parts) n += p->data->size();
+  // joined once, shared by all the segment requests
+  auto data = std::make_shared<std::vector<uint8_t>>();
+  data->reserve(n);
+  for (auto &&p : seg->parts) {
+    data->insert(data->end(), p->data->begin(), p->data->end());
+  }
+  seg->data = std::move(data);
+  seg->complete = true;
+  segment_max_duration_ = std::max(segment_max_duration_, seg->duration);
+  VLOG(1) << "Hls segment " << seg->msn << " parts_n=" << seg->parts.size()
+      << ", duration=" << seg->duration << ", bytes_n=" << n;
+
+  segments_.push_back(std::make_shared<Segment>());
+  segments_.back()->msn = msn_next_++;
+  while (segments_.size() > static_cast<std::size_t>(options_.segments_max)) {
+    segments_.pop_front();
+  }
+}
+
+std::shared_ptr<StreamHls::Segment> StreamHls::FindSegment(
+    int64_t msn) const {
+  if (segments_.empty()) return nullptr;
+  auto i = msn - segments_.front()->msn;
+  if (i < 0 || i >= static_cast<int64_t>(segments_.size())) return nullptr;
+  return segments_[i];
+}
+
+std::string StreamHls::GetPlaylist() {
+  std::lock_guard<std::mutex> _(mutex_);
+  if (segments_.empty() || (segments_.size() == 1 &&
+      segments_.front()->parts.empty())) {
+    return std::string{};
+  }
+
+  auto part_target = options_.part_target_ms / 1000.;
+  auto target = std::ceil(std::max(options_.segment_target_ms / 1000.,
+      segment_max_duration_));
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(3);
+  ss << "#EXTM3U\n"
+     << "#EXT-X-VERSION:6\n"
+     << "#EXT-X-TARGETDURATION:" << static_cast<int>(target) << "\n"
+     << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK="
+     << part_target * 3 << "\n"
+     << "#EXT-X-PART-INF:PART-TARGET=" << part_target << "\n"
+     << "#EXT-X-MEDIA-SEQUENCE:" << segments_.front()->msn << "\n"
+     << "#EXT-X-DISCONTINUITY-SEQUENCE:" << gen_ << "\n"
+     << "#EXT-X-MAP:URI=\"init" << gen_ << ".mp4\"\n";
+  // the parts of the last segments only
+  auto parts_from = static_cast<int>(segments_.size()) - 3;
+  for (int i = 0, n = segments_.size(); i < n; ++i) {
+    auto &&seg = segments_[i];
+    if (i >= parts_from) {
+      for (int j = 0, m = seg->parts.size(); j < m; ++j) {
+        auto &&part = seg->parts[j];
+        ss << "#EXT-X-PART:DURATION=" << part->duration
+           << ",URI=\"part" << seg->msn << "." << j << ".mp4\"";
+        if (part->independent) ss << ",INDEPENDENT=YES";
+        ss << "\n";
+      }
+    }
+    if (seg->complete) {
+      ss << "#EXTINF:" << seg->duration << ",\n"
+         << "seg" << seg->msn << ".mp4\n";
+    } else {
+      ss << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part" << seg->msn << "."
+         << seg->parts.size() << ".mp4\"\n";
+    }
+  }
+  return ss.str();
+}
+
+StreamHls::bytes_t StreamHls::GetInit(int gen) {
+  std::lock_guard<std::mutex> _(mutex_);
+  return gen == gen_ ? init_ : nullptr;
+}
+
+StreamHls::bytes_t StreamHls::GetSegment(int64_t msn) {
+  std::lock_guard<std::mutex> _(mutex_);
+  auto seg = FindSegment(msn);
+  return seg != nullptr ? seg->data : nullptr;
+}
+
+StreamHls::bytes_t StreamHls::GetPart(int64_t msn, int part) {
+  std::lock_guard<std::mutex> _(mutex_);
+  auto seg = FindSegment(msn);
+  if (seg == nullptr || part < 0 ||
+      part >= static_cast<int>(seg->parts.size())) {
+    return nullptr;
+  }
+  return seg->parts[part]->data;
+}
+
+bool StreamHls::IsReady(int64_t msn, int part, waiter_t waiter,
+                        uint64_t *waiter_id) {
+  std::lock_guard<std::mutex> _(mutex_);
+  auto ready = false;
+  if (!segments_.empty()) {
+    auto &&last = segments_.back();
+    if (msn < 0) {
+      ready = segments_.size() > 1 || !last->parts.empty();
+    } else if (msn < segments_.front()->msn) {
+      // gone, not wait
+      ready = true;
+    } else if (msn < last->msn) {
+      ready = true;
+    } else if (msn == last->msn) {
+      ready = part >= 0 && part < static_cast<int>(last->parts.size());
+    }
+  }
+  if (!ready && waiter) {
+    auto id = waiter_next_++;
+    waiters_.emplace(id, std::move(waiter));
+    if (waiter_id != nullptr) *waiter_id = id;
+  }
+  return ready;
+}
+
+void StreamHls::CancelWaiter(uint64_t waiter_id) {
+  std::lock_guard<std::mutex> _(mutex_);
+  waiters_.erase(waiter_id);
+}
+
+void StreamHls::Touch() {
+  touch_time_ = NowCount();
+}
+
+std::chrono::steady_clock::duration StreamHls::GetIdleTime() const {
+  return std::chrono::steady_clock::duration(NowCount() - touch_time_);
+}
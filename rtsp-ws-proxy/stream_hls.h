@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "common/media/stream.h"
+
+#include "stream_fmp4_muxer.h"
+
+struct StreamHlsOptions {
+  int part_target_ms    = 500;   // the duration of the partial segments
+  int segment_target_ms = 2000;  // split at the key frame after it
+  int segments_max      = 6;     // the segments kept in memory
+};
+
+// Low-latency HLS of the stream, CMAF parts in an in-memory ring
+//  the parts and segments are shared by all viewers, never copied
+class StreamHls {
+ public:
+  using bytes_t = StreamFmp4Muxer::bytes_t;
+  using waiter_t = std::function<void()>;
+
+  explicit StreamHls(const StreamHlsOptions &options);
+  ~StreamHls();
+
+  // mux the video packet, called by the stream thread
+  void Send(const std::shared_ptr<Stream> &stream,
+            AVMediaType type, AVPacket *packet);
+
+  // the media playlist, empty if no part yet
+  std::string GetPlaylist();
+
+  // return nullptr if not found
+  bytes_t GetInit(int gen);
+  bytes_t GetSegment(int64_t msn);
+  bytes_t GetPart(int64_t msn, int part);
+
+  // if the part of the segment is available, or the segment if part < 0,
+  //  or any part if msn < 0, otherwise the waiter is called once by the
+  //  stream thread when the next part added, thread safe
+  //  waiter_id: set if the waiter kept, to cancel it
+  bool IsReady(int64_t msn, int part, waiter_t waiter = nullptr,
+               uint64_t *waiter_id = nullptr);
+  // remove the waiter not called, e.g. timeout
+  void CancelWaiter(uint64_t waiter_id);
+
+  // the last time it's requested
+  void Touch();
+  std::chrono::steady_clock::duration GetIdleTime() const;
+
+ private:
+  struct Part {
+    bytes_t data;
+    double duration;
+    bool independent;
+  };
+  struct Segment {
+    int64_t msn;
+    std::vector<std::shared_ptr<Part>> parts;
+    double duration = 0;
+    bool complete = false;
+    bytes_t data = nullptr;  // the parts joined if complete
+  };
+
+  void AddPart(const StreamFmp4Muxer::Fragment &frag);
+  void CloseSegment();
+  std::shared_ptr<Segment> FindSegment(int64_t msn) const;
+
+  StreamHlsOptions options_;
+
+  // used by the stream thread only
+  std::shared_ptr<Stream> stream_;
+  std::shared_ptr<StreamFmp4Muxer> muxer_;
+
+  std::mutex mutex_;
+  int gen_;  // increased if the stream changed, the init and discontinuity
+  bytes_t init_;
+  std::deque<std::shared_ptr<Segment>> segments_;
+  int64_t msn_next_;
+  double segment_max_duration_;
+  std::unordered_map<uint64_t, waiter_t> waiters_;
+  uint64_t waiter_next_;
+
+  std::atomic<int64_t> touch_time_;
+};
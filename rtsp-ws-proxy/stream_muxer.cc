@@ -0,0 +1,147 @@
+#include "stream_muxer.h"
+
+#include <algorithm>
+#include <utility>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/mathematics.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "common/media/stream_def.h"
+#include "common/util/log.h"
+
+namespace {
+
+constexpr int kIoBufferSize = 4096;
+constexpr AVRational kTimeBase{1, 90000};
+// the sample duration if unknown, e.g. the first one
+constexpr int64_t kDurationDefault = 90000 / 25;
+
+}  // namespace
+
+StreamMuxer::StreamMuxer(
+    const std::string &format_name,
+    const AVCodecParameters *codecpar,
+    const std::map<std::string, std::string> &options)
+  : fmt_ctx_(nullptr), io_ctx_(nullptr), packet_(av_packet_alloc()),
+    header_(nullptr), time_beg_(clock_t::now()), dts_last_(AV_NOPTS_VALUE) {
+  LOG_IF(WARNING, codecpar->extradata_size <= 0)
+      << "Muxer " << format_name
+      << " codec extradata is empty, the header may not work";
+
+  try {
+    int ret = avformat_alloc_output_context2(&fmt_ctx_, nullptr,
+        format_name.c_str(), nullptr);
+    if (ret < 0) throw StreamError(ret);
+
+    auto st = avformat_new_stream(fmt_ctx_, nullptr);
+    if (st == nullptr) throw StreamError(AVERROR(ENOMEM));
+    ret = avcodec_parameters_copy(st->codecpar, codecpar);
+    if (ret < 0) throw StreamError(ret);
+    st->codecpar->codec_tag = 0;
+    st->time_base = kTimeBase;
+
+    auto buf = static_cast<uint8_t *>(av_malloc(kIoBufferSize));
+    if (buf == nullptr) throw StreamError(AVERROR(ENOMEM));
+    io_ctx_ = avio_alloc_context(buf, kIoBufferSize, 1, this,
+        nullptr, &StreamMuxer::OnWrite, nullptr);
+    if (io_ctx_ == nullptr) {
+      av_free(buf);
+      throw StreamError(AVERROR(ENOMEM));
+    }
+    fmt_ctx_->pb = io_ctx_;
+    fmt_ctx_->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    AVDictionary *opts = nullptr;
+    for (auto &&e : options) {
+      av_dict_set(&opts, e.first.c_str(), e.second.c_str(), 0);
+    }
+    ret = avformat_write_header(fmt_ctx_, &opts);
+    av_dict_free(&opts);
+    if (ret < 0) throw StreamError(ret);
+    avio_flush(io_ctx_);
+  } catch (const StreamError &) {
+    // free on throw, as the destructor is not called
+    Free();
+    throw;
+  }
+
+  header_ = TakeBytes();
+  VLOG(1) << "Muxer " << format_name << " header bytes_n="
+      << (header_ ? header_->size() : 0);
+}
+
+StreamMuxer::~StreamMuxer() {
+  // no trailer, the bytes are sent already
+  Free();
+}
+
+void StreamMuxer::Free() {
+  if (io_ctx_) {
+    av_freep(&io_ctx_->buffer);
+    avio_context_free(&io_ctx_);
+  }
+  if (fmt_ctx_) {
+    avformat_free_context(fmt_ctx_);
+    fmt_ctx_ = nullptr;
+  }
+  av_packet_free(&packet_);
+}
+
+const StreamMuxer::bytes_t &StreamMuxer::GetHeader() const {
+  return header_;
+}
+
+int64_t StreamMuxer::WritePacket(AVPacket *packet) {
+  int ret = av_packet_ref(packet_, packet);
+  if (ret < 0) throw StreamError(ret);
+
+  auto tb = GetTimeBase();
+  auto t_us = std::chrono::duration_cast<std::chrono::microseconds>(
+      clock_t::now() - time_beg_).count();
+  auto dts = av_rescale_q(t_us, AVRational{1, 1000000}, tb);
+  if (dts_last_ != AV_NOPTS_VALUE) dts = std::max(dts, dts_last_ + 1);
+  packet_->stream_index = 0;
+  packet_->pts = packet_->dts = dts;
+  packet_->duration = (dts_last_ == AV_NOPTS_VALUE)
+      ? av_rescale_q(kDurationDefault, kTimeBase, tb) : dts - dts_last_;
+  packet_->pos = -1;
+  dts_last_ = dts;
+  auto duration = packet_->duration;
+
+  ret = av_write_frame(fmt_ctx_, packet_);
+  av_packet_unref(packet_);
+  if (ret < 0) throw StreamError(ret);
+  avio_flush(io_ctx_);
+  return duration;
+}
+
+void StreamMuxer::WriteFlush() {
+  int ret = av_write_frame(fmt_ctx_, nullptr);
+  if (ret < 0) throw StreamError(ret);
+  avio_flush(io_ctx_);
+}
+
+StreamMuxer::bytes_t StreamMuxer::TakeBytes() {
+  if (buffer_.empty()) return nullptr;
+  auto bytes = std::make_shared<const std::vector<uint8_t>>(
+      std::move(buffer_));
+  buffer_.clear();
+  return bytes;
+}
+
+AVRational StreamMuxer::GetTimeBase() const {
+  return fmt_ctx_->streams[0]->time_base;
+}
+
+int StreamMuxer::OnWrite(void *opaque, uint8_t *buf, int buf_size) {
+  auto self = static_cast<StreamMuxer *>(opaque);
+  self->buffer_.insert(self->buffer_.end(), buf, buf + buf_size);
+  return buf_size;
+}
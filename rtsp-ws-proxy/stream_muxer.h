@@ -0,0 +1,65 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavcodec/packet.h>
+#include <libavformat/avformat.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+// Remux the video packets into memory without transcoding
+class StreamMuxer {
+ public:
+  using bytes_t = std::shared_ptr<const std::vector<uint8_t>>;
+
+  // format_name: e.g. "mp4", "flv", options: the muxer options
+  //  throw StreamError if fail
+  StreamMuxer(const std::string &format_name,
+              const AVCodecParameters *codecpar,
+              const std::map<std::string, std::string> &options = {});
+  virtual ~StreamMuxer();
+
+  // the bytes of the header
+  const bytes_t &GetHeader() const;
+
+ protected:
+  // mux the packet, only ref it, throw StreamError if fail
+  //  timestamps from the arrival clock, as the time base of packets differs
+  //  with the filters, in decode order as live streams without b-frames
+  //  return the duration of the sample, in the stream time base
+  int64_t WritePacket(AVPacket *packet);
+  // av_write_frame(nullptr), e.g. flush the fragment if frag_custom
+  void WriteFlush();
+  // take the bytes written, nullptr if none
+  bytes_t TakeBytes();
+
+  AVRational GetTimeBase() const;
+
+ private:
+  using clock_t = std::chrono::steady_clock;
+
+  static int OnWrite(void *opaque, uint8_t *buf, int buf_size);
+  void Free();
+
+  AVFormatContext *fmt_ctx_;
+  AVIOContext *io_ctx_;
+  AVPacket *packet_;
+
+  bytes_t header_;
+  std::vector<uint8_t> buffer_;
+
+  clock_t::time_point time_beg_;
+  int64_t dts_last_;
+};
@@ -0,0 +1,36 @@
+#include "stream_outputs.h"
+
+#include <atomic>
+
+#include "stream_hls.h"
+#include "stream_snapshot.h"
+
+StreamOutputs::StreamOutputs(std::chrono::milliseconds hls_idle,
+                             std::chrono::milliseconds snapshot_idle)
+  : hls_idle_(hls_idle), snapshot_idle_(snapshot_idle),
+    map_(std::make_shared<const map_t>()) {
+}
+
+StreamOutputs::~StreamOutputs() {
+}
+
+StreamOutputs::entry_t StreamOutputs::Get(const std::string &id) const {
+  auto m = std::atomic_load(&map_);
+  auto it = m->find(id);
+  return it != m->end() ? it->second : nullptr;
+}
+
+bool StreamOutputs::IsDemanded(const entry_t &entry) const {
+  if (entry == nullptr) return false;
+  return entry->flv != nullptr || IsHlsActive(entry->hls) ||
+      IsSnapshotActive(entry->snapshot);
+}
+
+bool StreamOutputs::IsHlsActive(const std::shared_ptr<StreamHls> &hls) const {
+  return hls != nullptr && hls->GetIdleTime() < hls_idle_;
+}
+
+bool StreamOutputs::IsSnapshotActive(
+    const std::shared_ptr<StreamSnapshot> &snapshot) const {
+  return snapshot != nullptr && snapshot->GetIdleTime() < snapshot_idle_;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class StreamFlv;
+class StreamHls;
+class StreamSnapshot;
+
+// the http outputs of the streams by id, hls, flv and snapshot, created on
+//  demand
+//  published as immutable snapshots, written by the io threads if changed,
+//  read lock free by the stream threads per packet
+class StreamOutputs {
+ public:
+  struct Entry {
+    std::shared_ptr<StreamHls> hls;
+    // present while it has viewers, set by the first and reset by the last
+    std::shared_ptr<StreamFlv> flv;
+    // kept once the key frame arrived, if snapshot enabled
+    std::shared_ptr<StreamSnapshot> snapshot;
+
+    bool Empty() const {
+      return hls == nullptr && flv == nullptr && snapshot == nullptr;
+    }
+  };
+  using entry_t = std::shared_ptr<const Entry>;
+
+  // hls_idle, snapshot_idle: the output not requested within it is idle
+  StreamOutputs(std::chrono::milliseconds hls_idle,
+                std::chrono::milliseconds snapshot_idle);
+  ~StreamOutputs();
+
+  // lock free, nullptr if none
+  entry_t Get(const std::string &id) const;
+
+  // if the outputs of the stream demand it, lock free
+  bool IsDemanded(const entry_t &entry) const;
+  bool IsDemanded(const std::string &id) const { return IsDemanded(Get(id)); }
+
+  bool IsHlsActive(const std::shared_ptr<StreamHls> &hls) const;
+  bool IsSnapshotActive(const std::shared_ptr<StreamSnapshot> &snapshot) const;
+
+  // copy the entry of the stream, update and publish, locked
+  //  removed if empty then
+  template <typename F>
+  void Update(const std::string &id, F &&update);
+
+ private:
+  using map_t = std::unordered_map<std::string, entry_t>;
+
+  std::chrono::milliseconds hls_idle_;
+  std::chrono::milliseconds snapshot_idle_;
+
+  // copy on write, read by std::atomic_load, written under the mutex
+  std::shared_ptr<const map_t> map_;
+  std::mutex mutex_;
+};
+
+template <typename F>
+void StreamOutputs::Update(const std::string &id, F &&update) {
+  std::lock_guard<std::mutex> _(mutex_);
+  auto m = std::make_shared<map_t>(*map_);
+  auto &&entry = (*m)[id];
+  auto e = entry ? std::make_shared<Entry>(*entry)
+                 : std::make_shared<Entry>();
+  update(e.get());
+  if (e->Empty()) {
+    m->erase(id);
+  } else {
+    entry = std::move(e);
+  }
+  std::atomic_store(&map_, std::shared_ptr<const map_t>(std::move(m)));
+}
@@ -0,0 +1,80 @@
+#include "stream_registry.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <utility>
+
+#include "common/media/stream.h"
+#define NET_JSON_STREAM_INFO_IGNORE
+#include "common/net/json.h"
+#include "common/util/log.h"
+
+StreamRegistry::StreamRegistry() {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  char boot[24];
+  std::snprintf(boot, sizeof(boot), "%llx", static_cast<unsigned long long>(  // NOLINT
+      std::chrono::duration_cast<std::chrono::milliseconds>(now).count()));
+  boot_ = boot;
+  auto s = std::make_shared<Snapshot>();
+  s->json = std::make_shared<const std::string>(R"({"streams":null})");
+  s->etag = Etag(0);
+  snapshot_ = std::move(s);
+}
+
+StreamRegistry::~StreamRegistry() {
+}
+
+StreamRegistry::snapshot_t StreamRegistry::Get() const {
+  return std::atomic_load(&snapshot_);
+}
+
+bool StreamRegistry::Has(const std::string &id) const {
+  auto s = Get();
+  return s->streams.find(id) != s->streams.end();
+}
+
+bool StreamRegistry::Set(const std::string &id,
+                         const std::shared_ptr<Stream> &stream) {
+  // the same mostly, by every packet
+  {
+    auto s = Get();
+    auto it = s->streams.find(id);
+    if (it != s->streams.end() && it->second.stream == stream) return false;
+  }
+
+  std::lock_guard<std::mutex> _(mutex_);
+  auto it = snapshot_->streams.find(id);
+  if (it != snapshot_->streams.end() && it->second.stream == stream) {
+    return false;
+  }
+  LOG_IF(INFO, it == snapshot_->streams.end()) << "Stream[" << id << "] start";
+
+  auto s = std::make_shared<Snapshot>(*snapshot_);
+  s->version = snapshot_->version + 1;
+  // serialized once per change, the others reused
+  auto &&e = s->streams[id];
+  e.stream = stream;
+  e.json = std::make_shared<const std::string>(net::to_string(id, stream));
+  e.etag = Etag(s->version);
+
+  std::string json = R"({"streams":[)";
+  auto first = true;
+  for (auto &&p : s->streams) {
+    if (!first) json += ',';
+    first = false;
+    json += *p.second.json;
+  }
+  json += "]}";
+  s->json = std::make_shared<const std::string>(std::move(json));
+  s->etag = Etag(s->version);
+  VLOG(1) << "Stream registry version=" << s->version
+      << ", bytes_n=" << s->json->size();
+
+  std::atomic_store(&snapshot_, snapshot_t(std::move(s)));
+  return true;
+}
+
+std::string StreamRegistry::Etag(uint64_t version) const {
+  return "\"" + boot_ + "-" + std::to_string(version) + "\"";
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class Stream;
+
+// the streams by id, published as immutable snapshots with their json
+//  written by the stream threads if changed, read lock free by io threads
+class StreamRegistry {
+ public:
+  struct Entry {
+    std::shared_ptr<Stream> stream;
+    std::shared_ptr<const std::string> json;  // the stream
+    std::string etag;
+  };
+
+  struct Snapshot {
+    uint64_t version = 0;
+    std::map<std::string, Entry> streams;
+    std::shared_ptr<const std::string> json;  // {"streams": [...]}
+    std::string etag;
+  };
+  using snapshot_t = std::shared_ptr<const Snapshot>;
+
+  StreamRegistry();
+  ~StreamRegistry();
+
+  // set the stream of the id, published if added or changed (e.g. looped)
+  //  return true if so
+  bool Set(const std::string &id, const std::shared_ptr<Stream> &stream);
+
+  // lock free
+  snapshot_t Get() const;
+  bool Has(const std::string &id) const;
+
+ private:
+  std::string Etag(uint64_t version) const;
+
+  std::string boot_;  // the etags differ across restarts
+  snapshot_t snapshot_;
+  std::mutex mutex_;
+};
@@ -0,0 +1,287 @@
+#include "stream_snapshot.h"
+
+#include <algorithm>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavutil/mathematics.h>
+#include <libswscale/swscale.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "common/media/stream_def.h"
+#include "common/util/log.h"
+#include "common/util/throw_error.h"
+
+namespace {
+
+// free the av objects on return or throw
+struct AVCodecContextDeleter {
+  void operator()(AVCodecContext *p) { avcodec_free_context(&p); }
+};
+struct AVFrameDeleter {
+  void operator()(AVFrame *p) { av_frame_free(&p); }
+};
+struct AVPacketDeleter {
+  void operator()(AVPacket *p) { av_packet_free(&p); }
+};
+struct AVCodecParametersDeleter {
+  void operator()(AVCodecParameters *p) { avcodec_parameters_free(&p); }
+};
+struct SwsContextDeleter {
+  void operator()(SwsContext *p) { sws_freeContext(p); }
+};
+
+using codec_ctx_ptr = std::unique_ptr<AVCodecContext, AVCodecContextDeleter>;
+using frame_ptr = std::unique_ptr<AVFrame, AVFrameDeleter>;
+using packet_ptr = std::unique_ptr<AVPacket, AVPacketDeleter>;
+using codecpar_ptr =
+    std::unique_ptr<AVCodecParameters, AVCodecParametersDeleter>;
+using sws_ctx_ptr = std::unique_ptr<SwsContext, SwsContextDeleter>;
+
+// images of different sizes kept at most
+constexpr std::size_t kImagesMaxSize = 16;
+// jpeg quality scale, 2~31, lower is better
+constexpr int kJpegQscale = 4;
+
+}  // namespace
+
+StreamSnapshot::StreamSnapshot(const StreamSnapshotOptions &options)
+  : options_(options),
+    key_packet_(av_packet_alloc()), key_codecpar_(avcodec_parameters_alloc()),
+    key_seq_(0), waiter_next_(0), touch_time_(0),
+    frame_(av_frame_alloc()), frame_seq_(0) {
+}
+
+StreamSnapshot::~StreamSnapshot() {
+  av_frame_free(&frame_);
+  avcodec_parameters_free(&key_codecpar_);
+  av_packet_free(&key_packet_);
+}
+
+void StreamSnapshot::Update(const AVCodecParameters *codecpar,
+                            AVPacket *packet) {
+  if (!(packet->flags & AV_PKT_FLAG_KEY)) return;
+  std::unordered_map<uint64_t, waiter_t> waiters;
+  {
+    std::lock_guard<std::mutex> _(key_mutex_);
+    av_packet_unref(key_packet_);
+    if (av_packet_ref(key_packet_, packet) != 0) return;
+    if (avcodec_parameters_copy(key_codecpar_, codecpar) < 0) {
+      av_packet_unref(key_packet_);
+      return;
+    }
+    ++key_seq_;
+    key_time_ = clock_t::now();
+    waiters.swap(waiters_);
+  }
+  for (auto &&w : waiters) {
+    w.second();
+  }
+}
+
+bool StreamSnapshot::IsReady(clock_t::duration max_age,
+                             waiter_t waiter, uint64_t *waiter_id) {
+  std::lock_guard<std::mutex> _(key_mutex_);
+  auto ready = key_seq_ != 0 && clock_t::now() - key_time_ < max_age;
+  if (!ready && waiter) {
+    auto id = waiter_next_++;
+    waiters_.emplace(id, std::move(waiter));
+    if (waiter_id != nullptr) *waiter_id = id;
+  }
+  return ready;
+}
+
+void StreamSnapshot::CancelWaiter(uint64_t waiter_id) {
+  std::lock_guard<std::mutex> _(key_mutex_);
+  waiters_.erase(waiter_id);
+}
+
+void StreamSnapshot::Touch() {
+  touch_time_ = clock_t::now().time_since_epoch().count();
+}
+
+std::chrono::steady_clock::duration StreamSnapshot::GetIdleTime() const {
+  int64_t t = touch_time_;
+  if (t == 0) return clock_t::duration::max();
+  return clock_t::now() - clock_t::time_point(clock_t::duration(t));
+}
+
+std::chrono::steady_clock::duration StreamSnapshot::GetKeyAge() {
+  std::lock_guard<std::mutex> _(key_mutex_);
+  if (key_seq_ == 0) return clock_t::duration::max();
+  return clock_t::now() - key_time_;
+}
+
+std::shared_ptr<StreamSnapshot::image_t> StreamSnapshot::Get(
+    StreamSnapshotFormat format, int width) {
+  if (options_.max_width > 0) {
+    width = (width > 0) ? std::min(width, options_.max_width)
+                        : options_.max_width;
+  }
+
+  auto image = GetImage(format, width);
+  std::lock_guard<std::mutex> _(image->mutex);
+
+  auto now = clock_t::now();
+  if (image->data != nullptr &&
+      now - image->time < std::chrono::milliseconds(options_.ttl_ms)) {
+    return image->data;
+  }
+
+  frame_ptr frame(av_frame_alloc());
+  auto seq = Decode(frame.get());
+  if (seq == 0) return image->data;
+
+  // no new key frame since last encode
+  if (image->data == nullptr || image->key_seq != seq) {
+    image->data = Encode(frame.get(), format, width);
+    image->key_seq = seq;
+  }
+  image->time = now;
+  return image->data;
+}
+
+std::shared_ptr<StreamSnapshot::Image> StreamSnapshot::GetImage(
+    StreamSnapshotFormat format, int width) {
+  std::lock_guard<std::mutex> _(images_mutex_);
+  auto key = std::make_pair(format, width);
+  auto it = images_.find(key);
+  if (it != images_.end()) return it->second;
+
+  if (images_.size() >= kImagesMaxSize) {
+    // drop the ones not in use
+    for (auto it = images_.begin(); it != images_.end();) {
+      if (it->second.use_count() == 1) {
+        it = images_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  auto image = std::make_shared<Image>();
+  images_.emplace(key, image);
+  return image;
+}
+
+uint64_t StreamSnapshot::Decode(AVFrame *frame) {
+  std::lock_guard<std::mutex> _(frame_mutex_);
+
+  packet_ptr packet(av_packet_alloc());
+  codecpar_ptr codecpar(avcodec_parameters_alloc());
+  uint64_t seq;
+  {
+    std::lock_guard<std::mutex> _(key_mutex_);
+    seq = key_seq_;
+    if (seq == 0) return 0;
+    if (seq != frame_seq_) {
+      int ret = av_packet_ref(packet.get(), key_packet_);
+      if (ret != 0) throw StreamError(ret);
+      ret = avcodec_parameters_copy(codecpar.get(), key_codecpar_);
+      if (ret < 0) throw StreamError(ret);
+    }
+  }
+
+  if (seq != frame_seq_) {
+    auto codec = avcodec_find_decoder(codecpar->codec_id);
+    if (codec == nullptr) {
+      throw_error<StreamError>() << "Decoder not found, id="
+          << codecpar->codec_id;
+    }
+    codec_ctx_ptr codec_ctx(avcodec_alloc_context3(codec));
+    if (codec_ctx == nullptr)
+      throw StreamError("Codec alloc context fail");
+    int ret = avcodec_parameters_to_context(codec_ctx.get(), codecpar.get());
+    if (ret < 0) throw StreamError(ret);
+    // one frame only, not wait for more
+    codec_ctx->thread_count = 1;
+    ret = avcodec_open2(codec_ctx.get(), codec, nullptr);
+    if (ret != 0) throw StreamError(ret);
+
+    ret = avcodec_send_packet(codec_ctx.get(), packet.get());
+    if (ret != 0) throw StreamError(ret);
+    ret = avcodec_send_packet(codec_ctx.get(), nullptr);
+    if (ret != 0) throw StreamError(ret);
+    av_frame_unref(frame_);
+    ret = avcodec_receive_frame(codec_ctx.get(), frame_);
+    if (ret != 0) throw StreamError(ret);
+
+    frame_seq_ = seq;
+    VLOG(1) << "snapshot decoded, size=" << frame_->width << "x"
+        << frame_->height << ", seq=" << seq;
+  }
+
+  int ret = av_frame_ref(frame, frame_);
+  if (ret != 0) throw StreamError(ret);
+  return seq;
+}
+
+std::shared_ptr<StreamSnapshot::image_t> StreamSnapshot::Encode(
+    const AVFrame *frame, StreamSnapshotFormat format, int width) {
+  auto codec_id = AV_CODEC_ID_MJPEG;
+  auto pix_fmt = AV_PIX_FMT_YUVJ420P;
+  if (format == STREAM_SNAPSHOT_PNG) {
+    codec_id = AV_CODEC_ID_PNG;
+    pix_fmt = AV_PIX_FMT_RGB24;
+  }
+
+  // scale down only, keep aspect ratio, even size for yuv420
+  if (width <= 0 || width > frame->width) width = frame->width;
+  int height = static_cast<int>(
+      av_rescale(frame->height, width, frame->width));
+  width = std::max(2, width & ~1);
+  height = std::max(2, height & ~1);
+
+  // scale
+
+  frame_ptr dst(av_frame_alloc());
+  dst->format = pix_fmt;
+  dst->width = width;
+  dst->height = height;
+  int ret = av_frame_get_buffer(dst.get(), 0);
+  if (ret != 0) throw StreamError(ret);
+
+  sws_ctx_ptr sws_ctx(sws_getContext(
+      frame->width, frame->height, static_cast<AVPixelFormat>(frame->format),
+      width, height, pix_fmt, SWS_BICUBIC, nullptr, nullptr, nullptr));
+  if (sws_ctx == nullptr) throw StreamError("Get sws context fail");
+  sws_scale(sws_ctx.get(), frame->data, frame->linesize, 0, frame->height,
+      dst->data, dst->linesize);
+
+  // encode
+
+  auto codec = avcodec_find_encoder(codec_id);
+  if (codec == nullptr) {
+    throw_error<StreamError>() << "Encoder not found, id=" << codec_id;
+  }
+  codec_ctx_ptr codec_ctx(avcodec_alloc_context3(codec));
+  if (codec_ctx == nullptr)
+    throw StreamError("Codec alloc context fail");
+  codec_ctx->width = width;
+  codec_ctx->height = height;
+  codec_ctx->pix_fmt = pix_fmt;
+  codec_ctx->time_base = AVRational{1, 25};
+  if (format == STREAM_SNAPSHOT_JPEG) {
+    codec_ctx->flags |= AV_CODEC_FLAG_QSCALE;
+    codec_ctx->global_quality = FF_QP2LAMBDA * kJpegQscale;
+    dst->quality = codec_ctx->global_quality;
+  }
+  ret = avcodec_open2(codec_ctx.get(), codec, nullptr);
+  if (ret != 0) throw StreamError(ret);
+
+  ret = avcodec_send_frame(codec_ctx.get(), dst.get());
+  if (ret != 0) throw StreamError(ret);
+  ret = avcodec_send_frame(codec_ctx.get(), nullptr);
+  if (ret != 0) throw StreamError(ret);
+  packet_ptr packet(av_packet_alloc());
+  ret = avcodec_receive_packet(codec_ctx.get(), packet.get());
+  if (ret != 0) throw StreamError(ret);
+
+  VLOG(1) << "snapshot encoded, size=" << width << "x" << height
+      << ", bytes=" << packet->size;
+  return std::make_shared<image_t>(packet->data, packet->data + packet->size);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/avcodec.h>
+#include <libavcodec/packet.h>
+#include <libavutil/frame.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+struct StreamSnapshotOptions {
+  // encode again if the cached image is older than ttl
+  int ttl_ms = 1000;
+  // limit the requested width, src width if <= 0
+  int max_width = 1920;
+};
+
+enum StreamSnapshotFormat {
+  STREAM_SNAPSHOT_JPEG,
+  STREAM_SNAPSHOT_PNG,
+};
+
+// Snapshot of the latest key frame, decoded and encoded only if requested
+class StreamSnapshot {
+ public:
+  using image_t = std::vector<uint8_t>;
+  using waiter_t = std::function<void()>;
+
+  explicit StreamSnapshot(const StreamSnapshotOptions &options);
+  ~StreamSnapshot();
+
+  // keep the key frame, only ref the packet, called by the stream thread
+  //  the waiters are called then
+  void Update(const AVCodecParameters *codecpar, AVPacket *packet);
+
+  // if the latest key frame is younger than max_age, otherwise the waiter is
+  //  called once by the stream thread when the next key frame kept
+  //  waiter_id: set if the waiter kept, to cancel it
+  bool IsReady(std::chrono::steady_clock::duration max_age,
+               waiter_t waiter = nullptr, uint64_t *waiter_id = nullptr);
+  // remove the waiter not called, e.g. timeout
+  void CancelWaiter(uint64_t waiter_id);
+
+  // get the image of the latest key frame, scaled to width if > 0
+  //  concurrent requests of the same size share one decode and encode
+  //  return nullptr if no key frame yet, throw StreamError if fail
+  std::shared_ptr<image_t> Get(StreamSnapshotFormat format, int width);
+
+  // the last time it's requested, the stream demanded within a while
+  void Touch();
+  std::chrono::steady_clock::duration GetIdleTime() const;
+  // the age of the latest key frame, max() if none
+  std::chrono::steady_clock::duration GetKeyAge();
+
+ private:
+  using clock_t = std::chrono::steady_clock;
+
+  struct Image {
+    std::mutex mutex;
+    std::shared_ptr<image_t> data;
+    clock_t::time_point time;
+    uint64_t key_seq = 0;
+  };
+
+  std::shared_ptr<Image> GetImage(StreamSnapshotFormat format, int width);
+
+  // decode the latest key frame if not yet, return its seq or 0 if none
+  uint64_t Decode(AVFrame *frame);
+  std::shared_ptr<image_t> Encode(const AVFrame *frame,
+      StreamSnapshotFormat format, int width);
+
+  StreamSnapshotOptions options_;
+
+  // latest key frame
+  std::mutex key_mutex_;
+  AVPacket *key_packet_;
+  AVCodecParameters *key_codecpar_;
+  uint64_t key_seq_;
+  clock_t::time_point key_time_;
+  std::unordered_map<uint64_t, waiter_t> waiters_;
+  uint64_t waiter_next_;
+
+  std::atomic<int64_t> touch_time_;  // never if 0
+
+  // decoded key frame
+  std::mutex frame_mutex_;
+  AVFrame *frame_;
+  uint64_t frame_seq_;
+
+  // encoded images per format and size
+  std::mutex images_mutex_;
+  std::map<std::pair<StreamSnapshotFormat, int>, std::shared_ptr<Image>>
+      images_;
+};
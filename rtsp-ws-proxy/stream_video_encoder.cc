@@ -6,7 +6,8 @@
 #include "common/util/throw_error.h"
 
 StreamVideoEncoder::StreamVideoEncoder(const StreamVideoEncodeOptions &options)
-  : options_(options), codec_ctx_(nullptr), packet_(nullptr) {
+  : options_(options), codec_ctx_(nullptr), packet_(nullptr),
+    key_frame_requested_(false) {
   Init();
 }
 
@@ -20,6 +21,14 @@ AVCodecContext *StreamVideoEncoder::GetCodecContext() {
 
 int StreamVideoEncoder::Send(AVFrame *frame) {
   LOG_IF(FATAL, codec_ctx_ == nullptr);
+  if (frame != nullptr && key_frame_requested_.exchange(false)) {
+    // h264_nvenc need open option forced-idr=1, otherwise it's an intra frame
+    auto pict_type = frame->pict_type;
+    frame->pict_type = AV_PICTURE_TYPE_I;
+    int ret = avcodec_send_frame(codec_ctx_, frame);
+    frame->pict_type = pict_type;
+    return ret;
+  }
   return avcodec_send_frame(codec_ctx_, frame);
 }
 
@@ -28,6 +37,10 @@ int StreamVideoEncoder::Recv(AVPacket *packet) {
   return avcodec_receive_packet(codec_ctx_, packet);
 }
 
+void StreamVideoEncoder::RequestKeyFrame() {
+  key_frame_requested_ = true;
+}
+
 void StreamVideoEncoder::Encode(AVFrame *frame,
     std::function<void(AVPacket *)> on_recv) {
   int ret = Send(frame);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <functional>
 #include <map>
 #include <string>
@@ -57,6 +58,9 @@ class StreamVideoEncoder {
   int Send(AVFrame *frame);
   int Recv(AVPacket *packet);
 
+  // Encode the next frame sent as a key frame, thread safe
+  void RequestKeyFrame();
+
   void Encode(AVFrame *frame, std::function<void(AVPacket *)> on_recv);
 
   int Flush();
@@ -68,4 +72,5 @@ class StreamVideoEncoder {
   StreamVideoEncodeOptions options_;
   AVCodecContext *codec_ctx_;
   AVPacket *packet_;
+  std::atomic_bool key_frame_requested_;
 };
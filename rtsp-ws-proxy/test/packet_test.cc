@@ -0,0 +1,99 @@
+// net::Data from the bytes of v2, the malformed ones rejected, not read past
+//  the bytes given, e.g. by the sanitizers
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "common/net/packet.h"
+
+namespace {
+
+std::vector<uint8_t> MakeBytesV2(int size, int64_t time_us) {
+  auto p = av_packet_alloc();
+  CHECK_EQ(av_new_packet(p, size), 0);
+  std::memset(p->data, 0x5a, size);
+  p->pts = 90000 * 3600LL;
+  p->dts = p->pts - 3600;
+  p->flags = AV_PKT_FLAG_KEY;
+  p->duration = 3600;
+  p->pos = 1024;
+  net::Data data(AVMEDIA_TYPE_VIDEO, p, time_us);
+  av_packet_free(&p);
+  std::vector<uint8_t> bytes;
+  CHECK_EQ(data.ToBytes(bytes, net::DATA_VERSION_2), net::Data::OK);
+  return bytes;
+}
+
+void SetPkgSize(std::vector<uint8_t> *bytes, uint32_t pkg_size) {
+  bytes::to_be<uint32_t>(bytes->data()+4, pkg_size);
+}
+
+// the bytes copied to their own buffer, not to read the ones after
+int FromBytes(const std::vector<uint8_t> &bytes, std::size_t bytes_n) {
+  std::vector<uint8_t> buf(bytes.begin(), bytes.begin() + bytes_n);
+  net::Data data;
+  return data.FromBytes(buf.data(), buf.size());
+}
+
+void TestRoundTrip() {
+  auto bytes = MakeBytesV2(1000, 1700000000000000LL);
+  net::Data data;
+  CHECK_EQ(data.FromBytes(bytes.data(), bytes.size()), net::Data::OK);
+  CHECK_EQ(data.type, AVMEDIA_TYPE_VIDEO);
+  CHECK_EQ(data.packet->size, 1000);
+  CHECK_EQ(data.packet->pts, 90000 * 3600LL);
+  CHECK_EQ(data.packet->dts, 90000 * 3600LL - 3600);
+  CHECK_EQ(data.packet->pos, 1024);
+  CHECK_EQ(data.time_us, 1700000000000000LL);
+}
+
+void TestShortHead() {
+  auto bytes = MakeBytesV2(16, 0);
+  for (std::size_t n = 1; n < 8; ++n) {
+    CHECK_EQ(FromBytes(bytes, n), net::Data::ERROR_NOT_ENOUGH) << "n=" << n;
+  }
+}
+
+void TestShortPkgSize() {
+  // the pkg_size within the head, the fields never parsed
+  for (uint32_t pkg_size = 0; pkg_size < 8; ++pkg_size) {
+    auto bytes = MakeBytesV2(16, 0);
+    SetPkgSize(&bytes, pkg_size);
+    for (auto n : {std::size_t{8}, bytes.size()}) {
+      CHECK_EQ(FromBytes(bytes, n), net::Data::ERROR_INVALID)
+          << "pkg_size=" << pkg_size << ", n=" << n;
+    }
+  }
+}
+
+void TestTruncatedPkgSize() {
+  // the pkg_size shorter than the fields, in the fields or the data
+  auto bytes = MakeBytesV2(16, 1700000000000000LL);
+  for (uint32_t pkg_size = 8; pkg_size < bytes.size(); ++pkg_size) {
+    auto b = bytes;
+    SetPkgSize(&b, pkg_size);
+    CHECK_EQ(FromBytes(b, pkg_size), net::Data::ERROR_INVALID)
+        << "pkg_size=" << pkg_size;
+  }
+}
+
+void TestTruncatedBytes() {
+  // the bytes received partly
+  auto bytes = MakeBytesV2(16, 0);
+  for (std::size_t n = 8; n < bytes.size(); ++n) {
+    CHECK_EQ(FromBytes(bytes, n), net::Data::ERROR_NOT_ENOUGH) << "n=" << n;
+  }
+}
+
+}  // namespace
+
+int main() {
+  TestRoundTrip();
+  TestShortHead();
+  TestShortPkgSize();
+  TestTruncatedPkgSize();
+  TestTruncatedBytes();
+  std::cout << "packet_test passed" << std::endl;
+  return 0;
+}
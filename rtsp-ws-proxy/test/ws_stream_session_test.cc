@@ -0,0 +1,141 @@
+// WsStreamSession resynced by the send queue, the datas after it sent from
+//  the key frame, even if a key frame accepted meanwhile by the stream thread
+//
+// The session is not run, so its writes not completed, the messages sent are
+//  kept by the send queue in order.
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "common/net/asio.hpp"
+#include "common/net/packet.h"
+
+#include "rtsp-ws-proxy/ws_stream_room.h"
+#include "rtsp-ws-proxy/ws_stream_session.h"
+
+namespace {
+
+class TestSession : public WsStreamSession {
+ public:
+  using WsStreamSession::WsStreamSession;
+  using WsStreamSession::OnSendDropped;
+
+  // the messages sent, on the strand
+  std::size_t Queued() const { return send_queue_.size(); }
+  // the media messages sent, key or not, on the strand
+  std::vector<bool> Sent() const {
+    std::vector<bool> v;
+    for (auto &&e : send_queue_) {
+      if (e.meta.media) v.push_back(e.meta.key);
+    }
+    return v;
+  }
+};
+
+struct Fixture {
+  asio::io_context ioc;
+  asio::executor_work_guard<asio::io_context::executor_type> work{
+      ioc.get_executor()};
+  tcp::socket client{ioc};
+  std::shared_ptr<WsStreamRoom> room = std::make_shared<WsStreamRoom>(1);
+  std::shared_ptr<TestSession> session;
+  std::shared_ptr<net::DataBatch> message = std::make_shared<net::DataBatch>(
+      std::make_shared<const std::vector<uint8_t>>(16, 0x5a));
+
+  Fixture() {
+    tcp::acceptor acceptor(ioc, tcp::endpoint(asio::ip::make_address(
+        "127.0.0.1"), 0));
+    client.connect(acceptor.local_endpoint());
+    net::ws_stream_t ws(acceptor.accept());
+    auto strand = room->GetStrand(ws.get_executor());
+    session = std::make_shared<TestSession>(std::move(ws), boost::none,
+        1000000, "a", room, strand);
+  }
+
+  // accept and send the video frame as the room, on the strand
+  bool Send(bool key) {
+    uint32_t epoch = 0;
+    if (!session->Accept("a", AVMEDIA_TYPE_VIDEO, key, &epoch)) return false;
+    WsSendMeta meta;
+    meta.media = true;
+    meta.key = key;
+    auto s = session;
+    auto m = message;
+    asio::post(session->GetStrand(), [s, m, meta, epoch]() {
+      s->SendOnStrand(nullptr, m, meta, epoch);
+    });
+    return true;
+  }
+};
+
+void TestResyncThenKey() {
+  Fixture f;
+  CHECK(f.Send(false));
+  f.ioc.poll();
+  asio::post(f.session->GetStrand(), [&f]() {
+    f.session->OnSendDropped(1, true);
+  });
+  f.ioc.poll();
+  CHECK(!f.Send(false));
+  CHECK(f.Send(true));
+  CHECK(f.Send(false));
+  f.ioc.poll();
+  CHECK((f.session->Sent() == std::vector<bool>{false, true, false}));
+}
+
+void TestResyncBetweenAccepted() {
+  // accepted before the resync, then dropped as depends on the dropped
+  Fixture f;
+  CHECK(f.Send(true));
+  CHECK(f.Send(false));
+  f.session->OnSendDropped(1, true);
+  CHECK(f.Send(true));
+  f.ioc.poll();
+  CHECK((f.session->Sent() == std::vector<bool>{true}));
+}
+
+void TestResyncInterleavedKey() {
+  // the stream thread sends the frames, a key every other, while the strand
+  //  resyncs; after each resync the first frame sent must be a key
+  Fixture f;
+  std::atomic_bool done{false};
+  std::vector<std::size_t> resyncs;
+  std::thread stream([&f, &done]() {
+    for (int i = 0; i < 200000; ++i) f.Send(i % 2 == 0);
+    done = true;
+  });
+  std::thread strand([&f, &done, &resyncs]() {
+    while (!done) {
+      asio::post(f.session->GetStrand(), [&f, &resyncs]() {
+        resyncs.push_back(f.session->Queued());
+        f.session->OnSendDropped(1, true);
+      });
+      f.ioc.run_one();
+      while (f.ioc.poll_one() > 0 && !done) {}
+    }
+  });
+  stream.join();
+  strand.join();
+  f.ioc.poll();
+
+  auto sent = f.session->Sent();
+  CHECK_GT(resyncs.size(), 0u);
+  for (auto pos : resyncs) {
+    if (pos < sent.size()) CHECK(sent[pos]) << "not a key after the resync";
+  }
+  std::cout << "  resyncs=" << resyncs.size() << ", sent=" << sent.size()
+      << std::endl;
+}
+
+}  // namespace
+
+int main() {
+  TestResyncThenKey();
+  TestResyncBetweenAccepted();
+  TestResyncInterleavedKey();
+  std::cout << "ws_stream_session_test passed" << std::endl;
+  return 0;
+}
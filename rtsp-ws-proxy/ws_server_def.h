@@ -3,11 +3,21 @@
 #include <functional>
 #include <string>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #include <boost/asio/spawn.hpp>
 
 #include "common/net/asio.hpp"
 #include "common/net/beast.hpp"
 #include "common/net/cors.h"
+#include "common/net/socket.h"
+#include "common/net/static_cache.h"
+#ifdef MY_USE_SSL
+#include "common/net/ssl.h"
+#endif
 
 #include "ws_def.h"
 
@@ -15,6 +25,9 @@ struct WsServerOptions {
   std::string addr  = "0.0.0.0";
   int port          = 8080;
   int threads       = 3;
+  // an io_context per thread, each with its own SO_REUSEPORT acceptor and
+  //  the thread pinned to a cpu, the sessions stay on the shard accepted
+  bool shard_enable = false;
 
   struct HTTP {
     bool enable          = true;
@@ -22,19 +35,74 @@ struct WsServerOptions {
     //  "": deny access the filesystem
     //  "/", "//": will access the filesystem root
     std::string doc_root = ".";
+    // the files of doc_root in memory, ETag/304, Range and the .br/.gz
+    net::StaticCacheOptions cache{};
+    // GET the prometheus metrics, disabled if empty
+    std::string metrics_target = "/metrics";
 
     // https only
     std::string ssl_crt = "";  // required
     std::string ssl_key = "";  // required
     std::string ssl_dh  = "";  // optional
+#ifdef MY_USE_SSL
+    // tls 1.2 ~ 1.3, the ciphers preferred by the cpu, the session cache
+    //  and tickets, so the clients reconnected resume without full handshakes
+    net::SslOptions ssl{};
+#endif
   } http{};
 
   net::CorsOptions cors{};
 
+  // the sockets accepted, TCP_NODELAY, SO_SNDBUF and TCP_NOTSENT_LOWAT
+  net::SocketOptions socket{};
+
   struct Stream {
     std::string http_target = "/streams";
     std::string ws_target_prefix = "/stream/";
     int send_queue_max_size = 1;  // set if >= 1
+    // the media over the queue size or the deadline are dropped to the key
+    //  frame, evict the session if dropped so many times within the window
+    int send_deadline_ms      = 0;  // disabled if <= 0
+    int send_evict_drops      = 0;  // disabled if <= 0
+    int send_evict_window_ms  = 10000;
+    // sample the rtt and the unsent bytes of the socket, disabled if <= 0
+    //  the media dropped as congested if the unsent bytes > the max
+    int send_sample_ms          = 0;
+    int send_unsent_max_bytes   = 0;  // disabled if <= 0
+
+    // batch the datas into one message, if requested by ?batch=1
+    int batch_window_ms = 5;          // disabled if <= 0
+    int batch_max_bytes = 64 * 1024;  // send the batch at once if >= it
+
+    // a session of multiple streams, ws <ws_target_prefix> without id
+    //  subscribed by the json text messages, the datas tagged by index
+    bool mux_enable = true;
+
+    // fragmented mp4 for MSE, ws <ws_target_prefix><id>.mp4
+    bool fmp4_enable          = true;
+    bool fmp4_frag_per_frame  = true;  // a fragment per frame, or per gop
+
+    // low-latency hls, CMAF parts in memory, never touch disk
+    //  GET <http_target>/<id>/hls/index.m3u8, muxed only if requested
+    bool hls_enable           = true;
+    int hls_part_target_ms    = 500;
+    int hls_segment_target_ms = 2000;  // split at the key frame after it
+    int hls_segments_max      = 6;
+    int hls_idle_ms           = 30000;  // stop if not requested within it
+
+    // http-flv, the chunked tags until closed, GET <ws_target_prefix><id>.flv
+    bool flv_enable         = true;
+    int flv_queue_max_size  = 100;  // drop to the next key frame if more
+
+    // snapshot of the latest key frame
+    //  GET <http_target>/<id>/snapshot.jpg?w=320, or snapshot.png
+    bool snapshot_enable    = true;
+    int snapshot_ttl_ms     = 1000;  // encode again if older than ttl
+    // the stream demanded within it after requested, as transcoding is
+    //  suspended if no one is watching, the key frame kept could be old
+    int snapshot_idle_ms    = 10000;
+    int snapshot_max_width  = 1920;  // src width if <= 0
+    int snapshot_threads    = 1;     // decode and encode off the io threads
   } stream{};
 
   bool signal_exit_enable = true;
@@ -45,14 +113,46 @@ struct WsServerOptions {
       std::function<void(beast::error_code ec, char const *what)>;
   using on_stop_t = std::function<void()>;
   using on_exit_t = std::function<void()>;
+  // a session joined the stream, called by io threads
+  using on_stream_join_t = std::function<void(const std::string &id)>;
 
   on_fail_t on_fail = nullptr;
   on_stop_t on_stop = nullptr;
   on_exit_t on_exit = nullptr;
+  on_stream_join_t on_stream_join = nullptr;
 };
 
 namespace net {
 
+#ifdef SO_REUSEPORT
+// the connections balanced to the acceptors of the port by the kernel
+using reuse_port =
+    asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// pin the current thread to the i-th cpu allowed, linux only
+inline bool pin_thread(int i) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return false;
+  auto n = CPU_COUNT(&allowed);
+  if (n <= 0) return false;
+  i %= n;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &allowed) || i-- > 0) continue;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+  }
+  return false;
+#else
+  (void)i;
+  return false;
+#endif
+}
+
 // This is the C++11 equivalent of a generic lambda.
 // The function object is used to send an HTTP message.
 struct send_lambda {
@@ -85,4 +185,21 @@ struct send_lambda {
   }
 };
 
+#if defined(__linux__) && !defined(MY_USE_SSL)
+// the large static files by sendfile, the plain tcp only
+inline bool can_send_file(const send_lambda &) {
+  return true;
+}
+
+inline void send_file(const send_lambda &send,
+    http::response<http::empty_body> &&res, const std::string &path,
+    uint64_t offset, uint64_t n) {
+  send.close_ = res.need_eof();
+  http::response_serializer<http::empty_body> sr{res};
+  http::async_write_header(send.stream_, sr, send.yield_[send.ec_]);
+  if (send.ec_) return;
+  net::sendfile(send.stream_, path, offset, n, send.yield_, send.ec_);
+}
+#endif
+
 }  // namespace net
@@ -1,5 +1,6 @@
 #include "ws_server_plain.h"
 
+#include <algorithm>
 #include <memory>
 #include <string>
 #include <thread>
@@ -11,7 +12,11 @@
 #include "ws_session.h"
 
 WsServer::WsServer(const WsServerOptions &options)
-  : options_(options) {
+  : options_(options),
+    static_cache_(options.http.cache.enable && !options.http.doc_root.empty()
+        ? std::make_shared<net::StaticCache>(
+            options.http.doc_root, options.http.cache)
+        : nullptr) {
   VLOG(2) << __func__;
 }
 
@@ -23,16 +28,31 @@ void WsServer::Run() {
   auto endpoint = tcp::endpoint{
       asio::ip::make_address(options_.addr),
       static_cast<asio::ip::port_type>(options_.port)};
+#ifndef SO_REUSEPORT
+  LOG_IF(WARNING, options_.shard_enable)
+      << "SO_REUSEPORT not supported, shard disabled";
+  options_.shard_enable = false;
+#endif
   // The io_context is required for all I/O
-  asio::io_context ioc(options_.threads);
+  //  sharded, one per thread with its own acceptor, else shared
+  auto shards_n = options_.shard_enable ? std::max(options_.threads, 1) : 1;
+  std::vector<std::unique_ptr<asio::io_context>> iocs;
+  iocs.reserve(shards_n);
+  for (auto i = 0; i < shards_n; ++i) {
+    iocs.emplace_back(new asio::io_context(
+        options_.shard_enable ? 1 : options_.threads));
+  }
+  auto &ioc = *iocs.front();
 
   // Spawn a listening port
-  asio::spawn(ioc, std::bind(
-      &WsServer::DoListen,
-      this,
-      std::ref(ioc),
-      endpoint,
-      std::placeholders::_1));
+  for (auto &&shard : iocs) {
+    asio::spawn(*shard, std::bind(
+        &WsServer::DoListen,
+        this,
+        std::ref(*shard),
+        endpoint,
+        std::placeholders::_1));
+  }
 
   // Capture SIGINT and SIGTERM to perform a clean shutdown
   std::unique_ptr<asio::signal_set> signals{nullptr};
@@ -42,28 +62,31 @@ void WsServer::Run() {
       // Stop the `io_context`. This will cause `run()`
       // to return immediately, eventually destroying the
       // `io_context` and all of the sockets in it.
-      ioc.stop();
+      for (auto &&shard : iocs) shard->stop();
       if (options_.on_stop) options_.on_stop();
     });
   }
 
   // Run the I/O service on the requested number of threads
+  //  the i-th one runs the shard i, pinned to the cpu
+  auto run = [this, &iocs](int i) {
+    if (options_.shard_enable && !net::pin_thread(i)) {
+      LOG(WARNING) << "Shard[" << i << "] pin thread fail";
+    }
+    iocs[i % iocs.size()]->run();
+  };
   std::vector<std::thread> v;
   if (options_.thread_main_block) {
     v.reserve(options_.threads - 1);
     for (auto i = options_.threads - 1; i > 0; --i) {
-      v.emplace_back([&ioc] {
-        ioc.run();
-      });
+      v.emplace_back(run, i);
     }
-    ioc.run();
+    run(0);
     // (If we get here, it means we got a SIGINT or SIGTERM)
   } else {
     v.reserve(options_.threads);
     for (auto i = options_.threads; i > 0; --i) {
-      v.emplace_back([&ioc] {
-        ioc.run();
-      });
+      v.emplace_back(run, i - 1);
     }
   }
 
@@ -98,6 +121,14 @@ void WsServer::DoListen(
   acceptor.set_option(asio::socket_base::reuse_address(true), ec);
   if (ec) return OnFail(ec, "set_option");
 
+#ifdef SO_REUSEPORT
+  // Allow the acceptors of the shards on the same port
+  if (options_.shard_enable) {
+    acceptor.set_option(net::reuse_port(true), ec);
+    if (ec) return OnFail(ec, "set_option");
+  }
+#endif
+
   // Bind to the server address
   acceptor.bind(endpoint, ec);
   if (ec) return OnFail(ec, "bind");
@@ -112,6 +143,8 @@ void WsServer::DoListen(
     if (ec) {
       OnFail(ec, "accept");
     } else {
+      net::set_socket_options(socket, options_.socket, ec);
+      if (ec) OnFail(ec, "set_socket_options");
       if (options_.http.enable) {
         asio::spawn(acceptor.get_executor(), std::bind(
             &WsServer::DoSessionHTTP,
@@ -175,6 +208,10 @@ void WsServer::DoSessionHTTP(
 
     // LOG(INFO) << "http req: " << http_req.target();
     auto handled = OnHandleHttpRequest(http_req, lambda);
+    if (!handled && static_cache_) {
+      handled = static_cache_->Handle(http_req, lambda);
+      if (handled && ec) return OnFail(ec, "write");
+    }
     if (!handled) {
       net::handle_request(options_.http.doc_root, std::move(http_req), lambda);
       if (ec) return OnFail(ec, "write");
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <memory>
+
 #include "ws_server_def.h"
 
 class WsServer {
@@ -32,4 +34,6 @@ class WsServer {
       http_req_t &req, send_lambda_t &send);
 
   WsServerOptions options_;
+  // the static files of doc_root, nullptr if disabled
+  std::shared_ptr<net::StaticCache> static_cache_;
 };
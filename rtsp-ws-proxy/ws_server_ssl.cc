@@ -1,5 +1,6 @@
 #include "ws_server_ssl.h"
 
+#include <algorithm>
 #include <fstream>
 #include <memory>
 #include <string>
@@ -11,11 +12,28 @@
 
 #include "common/net/ext.h"
 #include "common/util/log.h"
+#include "common/util/times.h"
 #include "ws_session.h"
 
 WsServerSSL::WsServerSSL(const WsServerOptions &options)
-  : options_(options) {
+  : options_(options),
+    static_cache_(options.http.cache.enable && !options.http.doc_root.empty()
+        ? std::make_shared<net::StaticCache>(
+            options.http.doc_root, options.http.cache)
+        : nullptr) {
   VLOG(2) << __func__;
+  auto &&r = metrics::Registry::Instance();
+  auto handshakes = [&r](const char *resumed) {
+    return r.GetCounter("rtsp_ws_tls_handshakes_total",
+        "The tls handshakes done, full or resumed.", {{"resumed", resumed}});
+  };
+  metrics_.handshakes = handshakes("false");
+  metrics_.resumed = handshakes("true");
+  metrics_.failed = r.GetCounter("rtsp_ws_tls_handshake_errors_total",
+      "The tls handshakes failed.");
+  metrics_.handshake = r.GetHistogram("rtsp_ws_tls_handshake_seconds",
+      "The time of a tls handshake, the round trips included.",
+      metrics::Histogram::LatencyBounds(), 1e-6);
 }
 
 WsServerSSL::~WsServerSSL() {
@@ -26,23 +44,39 @@ void WsServerSSL::Run() {
   auto endpoint = tcp::endpoint{
       asio::ip::make_address(options_.addr),
       static_cast<asio::ip::port_type>(options_.port)};
+#ifndef SO_REUSEPORT
+  LOG_IF(WARNING, options_.shard_enable)
+      << "SO_REUSEPORT not supported, shard disabled";
+  options_.shard_enable = false;
+#endif
   // The io_context is required for all I/O
-  asio::io_context ioc(options_.threads);
+  //  sharded, one per thread with its own acceptor, else shared
+  auto shards_n = options_.shard_enable ? std::max(options_.threads, 1) : 1;
+  std::vector<std::unique_ptr<asio::io_context>> iocs;
+  iocs.reserve(shards_n);
+  for (auto i = 0; i < shards_n; ++i) {
+    iocs.emplace_back(new asio::io_context(
+        options_.shard_enable ? 1 : options_.threads));
+  }
+  auto &ioc = *iocs.front();
 
   // The SSL context is required, and holds certificates
-  ssl::context ctx{ssl::context::tlsv12};
+  //  shared by the shards, so is the session cache and the ticket keys
+  ssl::context ctx{ssl::context::tls_server};
 
   // This holds the self-signed certificate used by the server
   LoadServerCertificate(ctx);
 
   // Spawn a listening port
-  asio::spawn(ioc, std::bind(
-      &WsServerSSL::DoListen,
-      this,
-      std::ref(ioc),
-      std::ref(ctx),
-      endpoint,
-      std::placeholders::_1));
+  for (auto &&shard : iocs) {
+    asio::spawn(*shard, std::bind(
+        &WsServerSSL::DoListen,
+        this,
+        std::ref(*shard),
+        std::ref(ctx),
+        endpoint,
+        std::placeholders::_1));
+  }
 
   // Capture SIGINT and SIGTERM to perform a clean shutdown
   std::unique_ptr<asio::signal_set> signals{nullptr};
@@ -52,28 +86,31 @@ void WsServerSSL::Run() {
       // Stop the `io_context`. This will cause `run()`
       // to return immediately, eventually destroying the
       // `io_context` and all of the sockets in it.
-      ioc.stop();
+      for (auto &&shard : iocs) shard->stop();
       if (options_.on_stop) options_.on_stop();
     });
   }
 
   // Run the I/O service on the requested number of threads
+  //  the i-th one runs the shard i, pinned to the cpu
+  auto run = [this, &iocs](int i) {
+    if (options_.shard_enable && !net::pin_thread(i)) {
+      LOG(WARNING) << "Shard[" << i << "] pin thread fail";
+    }
+    iocs[i % iocs.size()]->run();
+  };
   std::vector<std::thread> v;
   if (options_.thread_main_block) {
     v.reserve(options_.threads - 1);
     for (auto i = options_.threads - 1; i > 0; --i) {
-      v.emplace_back([&ioc] {
-        ioc.run();
-      });
+      v.emplace_back(run, i);
     }
-    ioc.run();
+    run(0);
     // (If we get here, it means we got a SIGINT or SIGTERM)
   } else {
     v.reserve(options_.threads);
     for (auto i = options_.threads; i > 0; --i) {
-      v.emplace_back([&ioc] {
-        ioc.run();
-      });
+      v.emplace_back(run, i - 1);
     }
   }
 
@@ -127,6 +164,15 @@ void WsServerSSL::LoadServerCertificate(ssl::context &ctx) {
     ctx.use_tmp_dh(
         asio::buffer(dh.data(), dh.size()));
   }
+
+  auto &&ssl = options_.http.ssl;
+  beast::error_code ec;
+  net::set_ssl_options(ctx, ssl, ec);
+  LOG_IF(FATAL, ec) << "WsServerSSL set ssl options fail: " << ec.message();
+  LOG(INFO) << "WsServerSSL tls1.2" << (ssl.tls13 ? "~1.3" : "")
+      << ", prefer " << (net::cpu_has_aes() ? "AES-GCM" : "ChaCha20")
+      << ", session cache " << ssl.session_cache_size
+      << ", tickets " << (ssl.session_tickets ? "on" : "off");
 }
 
 void WsServerSSL::OnFail(beast::error_code ec, char const *what) {
@@ -152,6 +198,14 @@ void WsServerSSL::DoListen(
   acceptor.set_option(asio::socket_base::reuse_address(true), ec);
   if (ec) return OnFail(ec, "set_option");
 
+#ifdef SO_REUSEPORT
+  // Allow the acceptors of the shards on the same port
+  if (options_.shard_enable) {
+    acceptor.set_option(net::reuse_port(true), ec);
+    if (ec) return OnFail(ec, "set_option");
+  }
+#endif
+
   // Bind to the server address
   acceptor.bind(endpoint, ec);
   if (ec) return OnFail(ec, "bind");
@@ -166,6 +220,8 @@ void WsServerSSL::DoListen(
     if (ec) {
       OnFail(ec, "accept");
     } else {
+      net::set_socket_options(socket, options_.socket, ec);
+      if (ec) OnFail(ec, "set_socket_options");
       if (options_.http.enable) {
         asio::spawn(acceptor.get_executor(), std::bind(
             &WsServerSSL::DoSessionHTTP,
@@ -192,9 +248,19 @@ void WsServerSSL::DoSessionHTTP(
   beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
 
   // Perform the SSL handshake
+  auto t = times::now();
   stream.async_handshake(ssl::stream_base::server, yield[ec]);
-  if (ec)
+  if (ec) {
+    metrics_.failed->Add();
     return OnFail(ec, "handshake");
+  }
+  metrics_.handshake->Observe(
+      times::count<times::microseconds>(times::now() - t));
+  if (SSL_session_reused(stream.native_handle())) {
+    metrics_.resumed->Add();
+  } else {
+    metrics_.handshakes->Add();
+  }
 
   // This buffer is required to persist across reads
   beast::flat_buffer buffer;
@@ -241,6 +307,10 @@ void WsServerSSL::DoSessionHTTP(
 
     // LOG(INFO) << "http req: " << http_req.target();
     auto handled = OnHandleHttpRequest(http_req, lambda);
+    if (!handled && static_cache_) {
+      handled = static_cache_->Handle(http_req, lambda);
+      if (handled && ec) return OnFail(ec, "write");
+    }
     if (!handled) {
       net::handle_request(options_.http.doc_root, std::move(http_req), lambda);
       if (ec) return OnFail(ec, "write");
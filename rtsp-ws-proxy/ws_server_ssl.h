@@ -1,5 +1,9 @@
 #pragma once
 
+#include <memory>
+
+#include "common/util/metrics.h"
+
 #ifndef MY_USE_SSL
 # define MY_USE_SSL  // correct lint
 #endif
@@ -38,4 +42,14 @@ class WsServerSSL {
       http_req_t &req, send_lambda_t &send);
 
   WsServerOptions options_;
+
+  struct Metrics {
+    std::shared_ptr<metrics::Counter> handshakes;  // full
+    std::shared_ptr<metrics::Counter> resumed;
+    std::shared_ptr<metrics::Counter> failed;
+    std::shared_ptr<metrics::Histogram> handshake;
+  } metrics_;
+
+  // the static files of doc_root, nullptr if disabled
+  std::shared_ptr<net::StaticCache> static_cache_;
 };
@@ -1,7 +1,10 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
 #include <memory>
-#include <mutex>
 #include <string>
 #include <utility>
 #include <vector>
@@ -9,12 +12,122 @@
 #include "common/net/asio.hpp"
 #include "common/net/beast.hpp"
 #include "common/net/event.h"
+#include "common/net/socket.h"
 #include "common/util/log.h"
+#include "common/util/metrics.h"
 #include "common/util/ptr.h"
 #include "common/util/times.h"
 
 #include "ws_def.h"
 
+namespace ws_detail {
+
+// the buffer sequence of data, data.buffers() if has, else asio::buffer(data)
+template <typename Data>
+auto buffers(const Data &data, int) -> decltype(data.buffers()) {
+  return data.buffers();
+}
+
+template <typename Data>
+auto buffers(const Data &data, long) -> decltype(asio::buffer(data)) {  // NOLINT
+  return asio::buffer(data);
+}
+
+// if send the data as a text message, data.is_text() if has, else false
+template <typename Data>
+auto is_text(const Data &data, int) -> decltype(data.is_text()) {
+  return data.is_text();
+}
+
+template <typename Data>
+bool is_text(const Data &, long) {  // NOLINT
+  return false;
+}
+
+using strand_t = asio::strand<asio::io_context::executor_type>;
+
+// a new strand on the io_context of the executor
+template <typename Executor>
+strand_t make_strand(const Executor &ex) {
+  return asio::make_strand(static_cast<asio::io_context &>(
+      asio::query(ex, asio::execution::context)));
+}
+
+// the sessions in aggregate, exported by /metrics
+struct Metrics {
+  std::shared_ptr<metrics::Gauge> sessions;
+  std::shared_ptr<metrics::Gauge> queued;
+  std::shared_ptr<metrics::Counter> sent;
+  std::shared_ptr<metrics::Counter> sent_bytes;
+  std::shared_ptr<metrics::Counter> dropped;
+  std::shared_ptr<metrics::Counter> drop_runs;
+  std::shared_ptr<metrics::Counter> evicted;
+  std::shared_ptr<metrics::Histogram> write;
+  std::shared_ptr<metrics::Histogram> queue_wait;
+
+  static const Metrics &Instance() {
+    static const Metrics instance;
+    return instance;
+  }
+
+ private:
+  Metrics() {
+    auto &&r = metrics::Registry::Instance();
+    sessions = r.GetGauge("rtsp_ws_sessions", "The websocket sessions.");
+    queued = r.GetGauge("rtsp_ws_send_queue_messages",
+        "The messages queued by the sessions.");
+    sent = r.GetCounter("rtsp_ws_sent_messages_total",
+        "The messages sent by the sessions.");
+    sent_bytes = r.GetCounter("rtsp_ws_sent_bytes_total",
+        "The bytes sent by the sessions.");
+    dropped = r.GetCounter("rtsp_ws_send_dropped_total",
+        "The media messages dropped by the sessions.");
+    drop_runs = r.GetCounter("rtsp_ws_send_drop_runs_total",
+        "The times the sessions dropped.");
+    evicted = r.GetCounter("rtsp_ws_evicted_total",
+        "The sessions closed as too slow.");
+    write = r.GetHistogram("rtsp_ws_write_seconds",
+        "The time of a message written to the socket.",
+        metrics::Histogram::LatencyBounds(), 1e-6);
+    queue_wait = r.GetHistogram("rtsp_ws_send_queue_wait_seconds",
+        "The time of a message queued until written.",
+        metrics::Histogram::LatencyBounds(), 1e-6);
+  }
+};
+
+}  // namespace ws_detail
+
+// the meta of a message queued, see WsSendPolicy
+struct WsSendMeta {
+  bool media = false;  // the packets, could be dropped, else kept
+  bool key = false;    // decodable from it, e.g. the video key frame
+  int stream = 0;      // the stream of it, e.g. the mux index
+  int64_t pts = 0;
+  times::clock::time_point time{};  // queued at, set by DoSend
+};
+
+// the media messages over send_queue_max_size, or queued longer than
+//  the deadline, are dropped by the dependent runs: the ones before the
+//  last key queued if decodable from it, else all and wait the key frames
+struct WsSendPolicy {
+  int deadline_ms = 0;          // disabled if <= 0
+  int evict_drops = 0;          // close if dropped so many times, <= 0 never
+  int evict_window_ms = 10000;  //  within the window
+  // sample the socket after the writes, within the interval at most
+  int sample_ms = 0;                // disabled if <= 0
+  std::size_t unsent_max_bytes = 0;  // congested if more, disabled if 0
+};
+
+struct WsSendStats {
+  uint64_t sent;
+  uint64_t dropped;    // the messages
+  uint64_t drop_runs;  // the times of dropping
+  bool evicted;
+  // sampled, 0 if disabled
+  uint32_t rtt_us;
+  uint32_t unsent_bytes;
+};
+
 template <typename Data>
 class WsSession
   : public net::NetEventManager,
@@ -23,51 +136,112 @@ class WsSession
   using data_t = Data;
   using ws_stream_t = net::ws_stream_t;
   using http_req_t = net::http_req_t;
+  using strand_t = ws_detail::strand_t;
   using virtual_enable_shared_from_this<WsSession<Data>>::shared_from_this;
 
+  // strand: the handlers and the send queue of the session run on it,
+  //  could be shared by sessions, a new one if not given
   WsSession(ws_stream_t &&ws, boost::optional<http_req_t> &&req,
       std::string tag, std::size_t send_queue_max_size);
+  WsSession(ws_stream_t &&ws, boost::optional<http_req_t> &&req,
+      std::string tag, std::size_t send_queue_max_size,
+      const strand_t &strand);
   virtual ~WsSession();
 
   void Run();
   void Send(const std::shared_ptr<Data> &data);
 
+  const strand_t &GetStrand() const { return strand_; }
+
+  // thread safe
+  WsSendStats GetSendStats() const {
+    return {sent_, dropped_, drop_runs_, evicted_, rtt_us_, unsent_bytes_};
+  }
+
  protected:
   void OnEventFail(beast::error_code ec, char const *what) override;
   void OnAccept(beast::error_code ec);
 
   void DoRead();
   void OnRead(beast::error_code ec, std::size_t bytes_transferred);
-  void DoSend(const std::shared_ptr<Data> &data);
+  // on the strand
+  void DoSend(const std::shared_ptr<Data> &data,
+              WsSendMeta meta = WsSendMeta{});
   void DoWrite(const std::shared_ptr<Data> &data);
   void OnWrite(beast::error_code ec, std::size_t bytes_transferred);
+  // the queue size changed, to the metrics
+  void UpdateQueued();
+  // sample the socket by the policy, the rtt and the unsent bytes
+  void SampleSocket();
+  // drop the queued ones by the policy, before the next write
+  void DropQueued();
+  // close the session too slow, by the policy
+  void Evict();
+  // dropped n media messages, resync if not decodable from the next one
+  virtual void OnSendDropped(std::size_t n, bool resync) {
+    (void)n;
+    (void)resync;
+  }
 
   ws_stream_t ws_;
   boost::optional<http_req_t> req_;
   std::string tag_;
+  strand_t strand_;
 
   beast::flat_buffer read_buffer_;
-  std::vector<std::shared_ptr<Data>> send_queue_;
+  struct Queued {
+    std::shared_ptr<Data> data;
+    WsSendMeta meta;
+  };
+  // strand local, no lock
+  std::vector<Queued> send_queue_;
   std::size_t send_queue_max_size_;
-  std::mutex send_mutex_;
+  WsSendPolicy send_policy_;
   times::clock::time_point time_write_;
+  times::clock::time_point sample_time_;
+  times::clock::time_point evict_window_time_;
+  int evict_window_drops_;
+  const ws_detail::Metrics &metrics_;
+  std::size_t metrics_queued_;
+
+  std::atomic<uint64_t> sent_;
+  std::atomic<uint64_t> dropped_;
+  std::atomic<uint64_t> drop_runs_;
+  std::atomic_bool evicted_;
+  std::atomic<uint32_t> rtt_us_;
+  std::atomic<uint32_t> unsent_bytes_;
 };
 
 template <typename Data>
 WsSession<Data>::WsSession(ws_stream_t &&ws, boost::optional<http_req_t> &&req,
     std::string tag, std::size_t send_queue_max_size)
+  : WsSession(std::move(ws), std::move(req), std::move(tag),
+      send_queue_max_size, ws_detail::make_strand(ws.get_executor())) {
+}
+
+template <typename Data>
+WsSession<Data>::WsSession(ws_stream_t &&ws, boost::optional<http_req_t> &&req,
+    std::string tag, std::size_t send_queue_max_size,
+    const strand_t &strand)
   : ws_(std::move(ws)), req_(std::move(req)),
-    tag_(std::move(tag)), send_queue_max_size_(send_queue_max_size) {
+    tag_(std::move(tag)), strand_(strand),
+    send_queue_max_size_(send_queue_max_size), evict_window_drops_(0),
+    metrics_(ws_detail::Metrics::Instance()), metrics_queued_(0),
+    sent_(0), dropped_(0), drop_runs_(0), evicted_(false),
+    rtt_us_(0), unsent_bytes_(0) {
   VLOG(2) << __func__ << "[" << tag_ << "]";
   if (send_queue_max_size_ <= 0) {
     LOG(WARNING) << __func__ << "[" << tag_ << "] send_queue_max_size set to 1";
     send_queue_max_size_ = 1;
   }
+  metrics_.sessions->Add(1);
 }
 
 template <typename Data>
 WsSession<Data>::~WsSession() {
   VLOG(2) << __func__ << "[" << tag_ << "]";
+  metrics_.sessions->Add(-1);
+  metrics_.queued->Add(-static_cast<int64_t>(metrics_queued_));
 }
 
 template <typename Data>
@@ -88,25 +262,25 @@ void WsSession<Data>::Run() {
   if (req_.has_value()) {
     ws_.async_accept(
         req_.get(),
-        beast::bind_front_handler(
+        asio::bind_executor(strand_, beast::bind_front_handler(
             &WsSession<Data>::OnAccept,
-            shared_from_this()));
+            shared_from_this())));
   } else {
     ws_.async_accept(
-        beast::bind_front_handler(
+        asio::bind_executor(strand_, beast::bind_front_handler(
             &WsSession<Data>::OnAccept,
-            shared_from_this()));
+            shared_from_this())));
   }
 }
 
 template <typename Data>
 void WsSession<Data>::Send(const std::shared_ptr<Data> &data) {
   asio::post(
-      ws_.get_executor(),
+      strand_,
       beast::bind_front_handler(
           &WsSession::DoSend,
           shared_from_this(),
-          data));
+          data, WsSendMeta{}));
 }
 
 template <typename Data>
@@ -132,9 +306,9 @@ void WsSession<Data>::DoRead() {
   // Read a message into our buffer
   ws_.async_read(
       read_buffer_,
-      beast::bind_front_handler(
+      asio::bind_executor(strand_, beast::bind_front_handler(
           &WsSession::OnRead,
-          shared_from_this()));
+          shared_from_this())));
 }
 
 template <typename Data>
@@ -143,63 +317,197 @@ void WsSession<Data>::OnRead(
   if (ec)
     return OnEventFail(ec, "read");
   OnEventRecv(read_buffer_, bytes_transferred);
+  read_buffer_.consume(read_buffer_.size());
   DoRead();
 }
 
 template <typename Data>
-void WsSession<Data>::DoSend(const std::shared_ptr<Data> &data) {
-  std::lock_guard<std::mutex> _(send_mutex_);
-
+void WsSession<Data>::DoSend(const std::shared_ptr<Data> &data,
+                             WsSendMeta meta) {
+  if (evicted_) return;
+  meta.time = times::now();
   // Always add to queue
-  send_queue_.push_back(data);
+  send_queue_.push_back({data, meta});
+  UpdateQueued();
 
   // Are we already writing?
   if (send_queue_.size() > 1)
     return;
 
   // We are not currently writing, so send this immediately
-  DoWrite(send_queue_.front());
+  DoWrite(send_queue_.front().data);
 }
 
 template <typename Data>
 void WsSession<Data>::DoWrite(const std::shared_ptr<Data> &data) {
   OnEventSend(data);
-  if (VLOG_IS_ON(2))
-    time_write_ = times::now();
-  ws_.binary(true);
+  time_write_ = times::now();
+  ws_.binary(!ws_detail::is_text(*data, 0));
   ws_.async_write(
-      asio::buffer(*data),
-      beast::bind_front_handler(
+      ws_detail::buffers(*data, 0),
+      asio::bind_executor(strand_, beast::bind_front_handler(
           &WsSession::OnWrite,
-          shared_from_this()));
+          shared_from_this())));
 }
 
 template <typename Data>
 void WsSession<Data>::OnWrite(
     beast::error_code ec, std::size_t bytes_transferred) {
-  (void)bytes_transferred;
-
-  VLOG(2) << "WsSession[" << tag_ << "] write cost " <<
-      times::count<times::microseconds>(times::now() - time_write_) * 0.001
-      << " ms";
+  auto now = times::now();
+  auto cost = times::count<times::microseconds>(now - time_write_);
+  VLOG(2) << "WsSession[" << tag_ << "] write cost " << cost * 0.001 << " ms";
 
   if (ec)
     return OnEventFail(ec, "write");
 
-  std::lock_guard<std::mutex> _(send_mutex_);
+  metrics_.write->Observe(cost);
+  metrics_.queue_wait->Observe(times::count<times::microseconds>(
+      now - send_queue_.front().meta.time));
+  metrics_.sent->Add();
+  metrics_.sent_bytes->Add(bytes_transferred);
 
   // Remove the sent message from the queue
   send_queue_.erase(send_queue_.begin());
+  ++sent_;
 
-  if (send_queue_max_size_ > 0 && send_queue_.size() > send_queue_max_size_) {
-    LOG(WARNING) << "WsSession[" << tag_ << "] send queue size="
-        << send_queue_.size() << " > " << send_queue_max_size_
-        << ", erase eldest ones";
-    send_queue_.erase(send_queue_.begin(),
-      send_queue_.end() - send_queue_max_size_);
-  }
+  SampleSocket();
+  DropQueued();
+  UpdateQueued();
 
   // Send the next message if any
   if (!send_queue_.empty())
-    DoWrite(send_queue_.front());
+    DoWrite(send_queue_.front().data);
+}
+
+template <typename Data>
+void WsSession<Data>::UpdateQueued() {
+  auto n = send_queue_.size();
+  if (n == metrics_queued_) return;
+  metrics_.queued->Add(static_cast<int64_t>(n) -
+      static_cast<int64_t>(metrics_queued_));
+  metrics_queued_ = n;
+}
+
+template <typename Data>
+void WsSession<Data>::SampleSocket() {
+  if (send_policy_.sample_ms <= 0) return;
+  auto now = times::now();
+  if (now - sample_time_ < times::milliseconds(send_policy_.sample_ms)) return;
+  sample_time_ = now;
+  net::SocketInfo info;
+  if (!net::get_socket_info(beast::get_lowest_layer(ws_).socket(), &info)) {
+    return;
+  }
+  rtt_us_ = info.rtt_us;
+  unsent_bytes_ = info.unsent_bytes;
+  VLOG(2) << "WsSession[" << tag_ << "] rtt=" << info.rtt_us
+      << " us, outq=" << info.outq_bytes << ", unsent=" << info.unsent_bytes;
+}
+
+template <typename Data>
+void WsSession<Data>::DropQueued() {
+  std::size_t media_n = 0;
+  for (auto &&e : send_queue_) {
+    if (e.meta.media) ++media_n;
+  }
+  if (media_n == 0) {
+    if (send_queue_.size() > send_queue_max_size_) {
+      LOG(WARNING) << "WsSession[" << tag_ << "] send queue size="
+          << send_queue_.size() << " > " << send_queue_max_size_
+          << ", erase eldest ones";
+      send_queue_.erase(send_queue_.begin(),
+        send_queue_.end() - send_queue_max_size_);
+    }
+    return;
+  }
+
+  // the media ones limited only, the others (e.g. init, text) always kept
+  auto now = times::now();
+  auto expired = [this, &now](const Queued &e) {
+    return send_policy_.deadline_ms > 0 && now - e.meta.time >
+        times::milliseconds(send_policy_.deadline_ms);
+  };
+  auto first = std::find_if(send_queue_.begin(), send_queue_.end(),
+      [](const Queued &e) { return e.meta.media; });
+  // the bytes not sent yet by the kernel, hidden from the queue size
+  auto congested = send_policy_.unsent_max_bytes > 0 &&
+      unsent_bytes_ > send_policy_.unsent_max_bytes;
+  if (media_n <= send_queue_max_size_ && !expired(*first) && !congested) {
+    return;
+  }
+
+  // drop the ones before the last key, if the rest fit and the dropped
+  //  are of its stream only, else drop all and wait the key frames
+  auto resync = true;
+  auto key = send_queue_.rend();
+  for (auto it = send_queue_.rbegin(); it != send_queue_.rend(); ++it) {
+    if (it->meta.media && it->meta.key) {
+      key = it;
+      break;
+    }
+  }
+  auto end = send_queue_.end();
+  if (key != send_queue_.rend()) {
+    auto pos = std::prev(key.base());
+    auto stream = pos->meta.stream;
+    auto rest = std::count_if(pos, send_queue_.end(),
+        [](const Queued &e) { return e.meta.media; });
+    auto same = std::all_of(send_queue_.begin(), pos,
+        [stream](const Queued &e) {
+          return !e.meta.media || e.meta.stream == stream;
+        });
+    if (static_cast<std::size_t>(rest) <= send_queue_max_size_ &&
+        !expired(*pos) && same) {
+      resync = false;
+      end = pos;
+    }
+  }
+  // decodable from the first one already, e.g. congested only
+  if (!resync && end == first) return;
+
+  std::size_t n = 0;
+  auto pts_beg = first->meta.pts, pts_end = first->meta.pts;
+  auto it = std::remove_if(send_queue_.begin(), end,
+      [&n, &pts_end](const Queued &e) {
+        if (!e.meta.media) return false;
+        ++n;
+        pts_end = e.meta.pts;
+        return true;
+      });
+  send_queue_.erase(it, end);
+  dropped_ += n;
+  ++drop_runs_;
+  metrics_.dropped->Add(n);
+  metrics_.drop_runs->Add();
+  LOG(WARNING) << "WsSession[" << tag_ << "] send queue media="
+      << media_n << " > " << send_queue_max_size_ << " or expired"
+      << (congested ? " or congested" : "") << ", drop "
+      << n << " pts=[" << pts_beg << ", " << pts_end << "]"
+      << (resync ? ", wait the key frames" : ", from the key frame");
+  OnSendDropped(n, resync);
+
+  if (send_policy_.evict_drops <= 0) return;
+  if (now - evict_window_time_ >
+      times::milliseconds(send_policy_.evict_window_ms)) {
+    evict_window_time_ = now;
+    evict_window_drops_ = 0;
+  }
+  if (++evict_window_drops_ >= send_policy_.evict_drops) Evict();
+}
+
+template <typename Data>
+void WsSession<Data>::Evict() {
+  LOG(WARNING) << "WsSession[" << tag_ << "] evicted, dropped "
+      << evict_window_drops_ << " times within "
+      << send_policy_.evict_window_ms << " ms";
+  evicted_ = true;
+  metrics_.evicted->Add();
+  send_queue_.clear();
+  UpdateQueued();
+  // the read fails as closed then
+  ws_.async_close(websocket::close_code::try_again_later,
+      asio::bind_executor(strand_, [self = shared_from_this(), this](
+          beast::error_code ec) {
+        if (ec) VLOG(1) << "WsSession[" << tag_ << "] close " << ec.message();
+      }));
 }
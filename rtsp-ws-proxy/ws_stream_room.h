@@ -1,34 +1,483 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <libavcodec/packet.h>
+#include <libavutil/avutil.h>
+
+#ifdef __cplusplus
+}
+#endif
+
+#include "common/media/stream.h"
+#include "common/net/asio.hpp"
+#include "common/net/packet.h"
+#include "common/util/log.h"
+
+#include "stream_fmp4_muxer.h"
+#include "ws_def.h"
+#include "ws_session.h"
+
 class WsStreamSession;
 
-class WsStreamRoom {
+// the sessions of the streams, templated on the session for the benches,
+//  see WsStreamRoom for the server
+template <typename Session>
+class WsStreamRoomBase {
  public:
-  using data_t = std::vector<uint8_t>;
-  using sessions_set_t = std::unordered_set<std::shared_ptr<WsStreamSession>>;
+  using data_t = net::DataRef;
+  using session_t = std::shared_ptr<Session>;
+  using sessions_t = std::vector<session_t>;
+  using strand_t = asio::strand<asio::io_context::executor_type>;
+
+  // strands_n: the strands shared by the sessions of an io_context,
+  //  e.g. the io threads, or 1 if an io_context per thread
+  explicit WsStreamRoomBase(int strands_n,
+      const StreamFmp4MuxerOptions &fmp4_options = StreamFmp4MuxerOptions{});
+  ~WsStreamRoomBase();
 
-  WsStreamRoom();
-  ~WsStreamRoom();
+  // the strand of a new session, round robin, of the io_context of the
+  //  executor, so the fan-out is posted once per shard if sharded
+  strand_t GetStrand(const net::ws_stream_t::executor_type &ex);
 
-  bool Empty(const std::string &id);
+  // lock free, as Send
+  bool Empty(const std::string &id) const;
 
-  void Join(const std::string &id,
-      const std::shared_ptr<WsStreamSession> &session);
-  void Leave(const std::string &id,
-      const std::shared_ptr<WsStreamSession> &session);
+  // the index of the stream id, the same for all mux sessions
+  //  -1 if more than DataMux::max_count()
+  int GetIndex(const std::string &id);
 
-  void Send(const std::string &id,
-      const std::shared_ptr<data_t> &data);
+  void Join(const std::string &id, const session_t &session);
+  void Leave(const std::string &id, const session_t &session);
+
+  // serialize the packet once per data version of the sessions
+  //  lock free and no allocation if none wants it, by the subscribers
+  //  snapshot of the stream, then posted once per strand
+  //  time_us: the ingest wall clock, to the sessions want it, ?time=1
+  void Send(const std::string &id, AVMediaType type, AVPacket *packet,
+      int64_t time_us = 0);
+
+  // the init of the stream, sent to the sessions want it if changed
+  void SetInit(const std::string &id, std::vector<uint8_t> init);
+
+  // remux the video packet once for the fmp4 sessions, by the stream thread
+  void Mux(const std::string &id, const std::shared_ptr<Stream> &stream,
+      AVMediaType type, AVPacket *packet);
 
  private:
-  std::unordered_map<std::string, sessions_set_t> sessions_map_;
+  struct Fmp4 {
+    std::shared_ptr<Stream> stream;
+    std::shared_ptr<StreamFmp4Muxer> muxer;
+  };
+
+  // the sessions of the same strand
+  struct Group {
+    strand_t strand;
+    sessions_t sessions;
+  };
+  using groups_t = std::vector<Group>;
+
+  // the subscribers of the stream, immutable once published
+  struct Subscribers {
+    groups_t groups;       // the datas
+    groups_t fmp4_groups;  // the fmp4
+    int index = -1;        // the mux index, if any mux session
+  };
+  using subscribers_t = std::shared_ptr<const Subscribers>;
+  using subscribers_map_t = std::unordered_map<std::string, subscribers_t>;
+
+  subscribers_t GetSubscribers(const std::string &id) const;
+  // copy the subscribers of the stream, update and publish, locked
+  template <typename F>
+  void UpdateSubscribers(const std::string &id, F &&update);
+
+  int GetIndexLocked(const std::string &id);
+
+  static void GroupAdd(groups_t *groups, const session_t &session);
+  static bool GroupRemove(groups_t *groups, const session_t &session);
+
+  int strands_n_;
+  StreamFmp4MuxerOptions fmp4_options_;
+
+  struct Strands {
+    std::vector<strand_t> strands;
+    std::size_t next = 0;
+  };
+  // created once the first session of the io_context
+  std::unordered_map<asio::io_context *, Strands> strands_;
+
+  // copy on write, read by std::atomic_load, written under the mutex
+  std::shared_ptr<const subscribers_map_t> subscribers_;
+  std::unordered_map<std::string, Fmp4> fmp4_map_;
+
+  std::unordered_map<std::string, int> index_map_;
+
+  // the init, and the one tagged by the index for the mux sessions
+  std::unordered_map<std::string, std::shared_ptr<net::DataBatch>> inits_;
+  std::unordered_map<std::string,
+      std::shared_ptr<net::DataBatch>> mux_inits_;
+  std::unordered_map<std::string,
+      std::shared_ptr<const std::vector<uint8_t>>> init_bytes_;
 
   std::mutex mutex_;
 };
+
+template <typename Session>
+WsStreamRoomBase<Session>::WsStreamRoomBase(int strands_n,
+    const StreamFmp4MuxerOptions &fmp4_options)
+  : strands_n_(std::max(strands_n, 1)), fmp4_options_(fmp4_options),
+    subscribers_(std::make_shared<const subscribers_map_t>()) {
+  VLOG(2) << __func__;
+}
+
+template <typename Session>
+WsStreamRoomBase<Session>::~WsStreamRoomBase() {
+  VLOG(2) << __func__;
+}
+
+template <typename Session>
+typename WsStreamRoomBase<Session>::strand_t
+WsStreamRoomBase<Session>::GetStrand(
+    const net::ws_stream_t::executor_type &ex) {
+  auto &ioc = static_cast<asio::io_context &>(
+      asio::query(ex, asio::execution::context));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto &&s = strands_[&ioc];
+  if (s.strands.empty()) {
+    for (int i = 0; i < strands_n_; ++i) {
+      s.strands.push_back(asio::make_strand(ioc));
+    }
+  }
+  return s.strands[s.next++ % s.strands.size()];
+}
+
+template <typename Session>
+typename WsStreamRoomBase<Session>::subscribers_t
+WsStreamRoomBase<Session>::GetSubscribers(const std::string &id) const {
+  auto m = std::atomic_load(&subscribers_);
+  auto it = m->find(id);
+  return it != m->end() ? it->second : nullptr;
+}
+
+template <typename Session>
+template <typename F>
+void WsStreamRoomBase<Session>::UpdateSubscribers(
+    const std::string &id, F &&update) {
+  auto m = std::make_shared<subscribers_map_t>(*subscribers_);
+  auto &&subs = (*m)[id];
+  auto s = subs ? std::make_shared<Subscribers>(*subs)
+                : std::make_shared<Subscribers>();
+  update(s.get());
+  if (s->groups.empty() && s->fmp4_groups.empty()) {
+    m->erase(id);
+  } else {
+    subs = std::move(s);
+  }
+  std::atomic_store(&subscribers_,
+      std::shared_ptr<const subscribers_map_t>(std::move(m)));
+}
+
+template <typename Session>
+void WsStreamRoomBase<Session>::GroupAdd(
+    groups_t *groups, const session_t &session) {
+  for (auto &&g : *groups) {
+    if (g.strand == session->GetStrand()) {
+      g.sessions.push_back(session);
+      return;
+    }
+  }
+  groups->push_back({session->GetStrand(), {session}});
+}
+
+template <typename Session>
+bool WsStreamRoomBase<Session>::GroupRemove(
+    groups_t *groups, const session_t &session) {
+  for (auto it = groups->begin(); it != groups->end(); ++it) {
+    auto &&v = it->sessions;
+    auto pos = std::find(v.begin(), v.end(), session);
+    if (pos == v.end()) continue;
+    v.erase(pos);
+    if (v.empty()) groups->erase(it);
+    return true;
+  }
+  return false;
+}
+
+template <typename Session>
+bool WsStreamRoomBase<Session>::Empty(const std::string &id) const {
+  // removed if empty
+  return GetSubscribers(id) == nullptr;
+}
+
+template <typename Session>
+int WsStreamRoomBase<Session>::GetIndex(const std::string &id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return GetIndexLocked(id);
+}
+
+template <typename Session>
+int WsStreamRoomBase<Session>::GetIndexLocked(const std::string &id) {
+  auto it = index_map_.find(id);
+  if (it != index_map_.end()) return it->second;
+  auto index = static_cast<int>(index_map_.size());
+  if (index >= net::DataMux::max_count()) return -1;
+  index_map_.emplace(id, index);
+  return index;
+}
+
+template <typename Session>
+void WsStreamRoomBase<Session>::Join(const std::string &id,
+    const session_t &session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // joined on the session executor, the init is queued before any data
+  if (session->IsFmp4()) {
+    auto it = fmp4_map_.find(id);
+    if (it != fmp4_map_.end()) {
+      session->SendInit(
+          std::make_shared<net::DataBatch>(it->second.muxer->GetInit()));
+    }
+    UpdateSubscribers(id, [&session](Subscribers *s) {
+      GroupAdd(&s->fmp4_groups, session);
+    });
+    return;
+  }
+  if (session->IsInitEnabled()) {
+    auto &&inits = session->IsMux() ? mux_inits_ : inits_;
+    auto it = inits.find(id);
+    if (it != inits.end()) session->SendInit(it->second);
+  }
+  auto index = session->IsMux() ? GetIndexLocked(id) : -1;
+  UpdateSubscribers(id, [&session, index](Subscribers *s) {
+    GroupAdd(&s->groups, session);
+    if (index >= 0) s->index = index;
+  });
+}
+
+template <typename Session>
+void WsStreamRoomBase<Session>::Leave(const std::string &id,
+    const session_t &session) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto subs = GetSubscribers(id);
+  if (subs == nullptr) return;
+  auto fmp4 = session->IsFmp4();
+  auto groups = fmp4 ? subs->fmp4_groups : subs->groups;
+  if (!GroupRemove(&groups, session)) return;
+  UpdateSubscribers(id, [fmp4, &groups](Subscribers *s) {
+    (fmp4 ? s->fmp4_groups : s->groups) = std::move(groups);
+  });
+  // no one is watching, mux again from the next key frame if joined
+  if (fmp4 && groups.empty()) fmp4_map_.erase(id);
+}
+
+template <typename Session>
+void WsStreamRoomBase<Session>::SetInit(
+    const std::string &id, std::vector<uint8_t> init) {
+  std::shared_ptr<net::DataBatch> message, mux_message;
+  sessions_t v;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = init_bytes_.find(id);
+    if (it != init_bytes_.end() && *it->second == init) return;
+    auto index = GetIndexLocked(id);
+    if (index >= 0) {
+      mux_message = std::make_shared<net::DataBatch>(
+          std::make_shared<const std::vector<uint8_t>>(
+              net::DataMux::ToBytes(index, init)));
+      mux_inits_[id] = mux_message;
+    }
+    auto bytes = std::make_shared<const std::vector<uint8_t>>(std::move(init));
+    message = std::make_shared<net::DataBatch>(bytes);
+    init_bytes_[id] = bytes;
+    inits_[id] = message;
+    if (auto subs = GetSubscribers(id)) {
+      for (auto &&g : subs->groups) {
+        for (auto &&p : g.sessions) {
+          if (p->IsInitEnabled()) v.push_back(p);
+        }
+      }
+    }
+  }
+  VLOG(1) << "Stream[" << id << "] init bytes_n=" << message->size()
+      << ", sessions_n=" << v.size();
+  for (auto &&s : v) {
+    if (s->IsMux()) {
+      if (mux_message != nullptr) s->Send(mux_message);
+    } else {
+      s->Send(message);
+    }
+  }
+}
+
+template <typename Session>
+void WsStreamRoomBase<Session>::Send(const std::string &id,
+    AVMediaType type, AVPacket *packet, int64_t time_us) {
+  auto subs = GetSubscribers(id);
+  if (subs == nullptr) return;
+
+  // the sessions of a strand accepted the packet, posted at once
+  struct Entry {
+    Session *session;
+    int i;  // of the datas
+    uint32_t epoch;
+  };
+  struct Fanout {
+    subscribers_t subs;  // keep the sessions
+    std::vector<Entry> sessions;
+    std::shared_ptr<data_t> datas[6];
+    std::shared_ptr<net::DataBatch> messages[6];
+    WsSendMeta meta;
+  };
+
+  // [v1, v2, v2 time] and the mux ones, the data and the message of it only
+  std::shared_ptr<data_t> datas[6];
+  std::shared_ptr<net::DataBatch> messages[6];
+  auto key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+  WsSendMeta meta;
+  meta.media = true;
+  // decodable from the video key frame only, the audio dropped along
+  meta.key = key && type == AVMEDIA_TYPE_VIDEO;
+  meta.stream = subs->index;
+  meta.pts = packet->pts;
+  for (auto &&g : subs->groups) {
+    std::shared_ptr<Fanout> fanout = nullptr;
+    for (auto &&s : g.sessions) {
+      // paused, or the key frames only, not serialized if none wants it
+      //  the epoch not to send the ones accepted before the resync
+      uint32_t epoch = 0;
+      if (!s->Accept(id, type, key, &epoch)) continue;
+      auto i = 0;
+      if (s->GetDataVersion() == net::DATA_VERSION_2) {
+        i = s->IsTimeEnabled() ? 2 : 1;
+      }
+      if (s->IsMux()) i += 3;
+      auto &data = datas[i];
+      if (data == nullptr) {
+        data = std::make_shared<data_t>(type, packet, s->GetDataVersion(),
+            s->IsMux() ? subs->index : -1, s->IsTimeEnabled() ? time_us : 0);
+      }
+      auto &message = messages[i];
+      if (message == nullptr && !s->IsBatchEnabled()) {
+        message = std::make_shared<net::DataBatch>(
+            std::vector<std::shared_ptr<data_t>>{data});
+      }
+      if (fanout == nullptr) {
+        fanout = std::make_shared<Fanout>();
+        fanout->subs = subs;
+        fanout->sessions.reserve(g.sessions.size());
+        fanout->meta = meta;
+      }
+      fanout->sessions.push_back({s.get(), i, epoch});
+    }
+    if (fanout == nullptr) continue;
+    std::copy(std::begin(datas), std::end(datas), fanout->datas);
+    std::copy(std::begin(messages), std::end(messages), fanout->messages);
+    asio::post(g.strand, [fanout]() {
+      for (auto &&e : fanout->sessions) {
+        e.session->SendOnStrand(fanout->datas[e.i], fanout->messages[e.i],
+            fanout->meta, e.epoch);
+      }
+    });
+  }
+}
+
+template <typename Session>
+void WsStreamRoomBase<Session>::Mux(const std::string &id,
+    const std::shared_ptr<Stream> &stream,
+    AVMediaType type, AVPacket *packet) {
+  if (type != AVMEDIA_TYPE_VIDEO) return;
+  auto key = (packet->flags & AV_PKT_FLAG_KEY) != 0;
+
+  if (auto subs = GetSubscribers(id)) {
+    if (subs->fmp4_groups.empty()) return;
+  } else {
+    return;
+  }
+
+  std::shared_ptr<StreamFmp4Muxer> muxer;
+  subscribers_t subs;
+  std::shared_ptr<net::DataBatch> init;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // the snapshot with the muxer, as published under the lock
+    subs = GetSubscribers(id);
+    if (subs == nullptr || subs->fmp4_groups.empty()) return;
+
+    auto it = fmp4_map_.find(id);
+    // create the muxer at the key frame, again if the stream changed
+    if (it == fmp4_map_.end() || it->second.stream != stream) {
+      if (!key) return;
+      try {
+        muxer = std::make_shared<StreamFmp4Muxer>(
+            stream->GetStreamSub(type)->info->codecpar, fmp4_options_);
+      } catch (const StreamError &e) {
+        LOG(ERROR) << "Stream[" << id << "] fmp4 " << e.what();
+        fmp4_map_.erase(id);
+        return;
+      }
+      fmp4_map_[id] = Fmp4{stream, muxer};
+      init = std::make_shared<net::DataBatch>(muxer->GetInit());
+      LOG(INFO) << "Stream[" << id << "] fmp4 init bytes_n=" << init->size();
+    } else {
+      muxer = it->second.muxer;
+    }
+  }
+  if (init != nullptr) {
+    for (auto &&g : subs->fmp4_groups) {
+      for (auto &&s : g.sessions) {
+        s->Fmp4WaitKey();
+        s->Send(init);
+      }
+    }
+  }
+
+  StreamFmp4Muxer::Fragment frag;
+  try {
+    frag = muxer->Write(packet);
+  } catch (const StreamError &e) {
+    LOG(ERROR) << "Stream[" << id << "] fmp4 " << e.what();
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = fmp4_map_.find(id);
+    if (it != fmp4_map_.end() && it->second.muxer == muxer) {
+      fmp4_map_.erase(it);
+    }
+    return;
+  }
+  if (frag.data == nullptr) return;
+
+  auto message = std::make_shared<net::DataBatch>(frag.data);
+  auto frag_key = frag.key;
+  WsSendMeta meta;
+  meta.media = true;
+  meta.key = frag.key;
+  meta.pts = packet->pts;
+  for (auto &&g : subs->fmp4_groups) {
+    // the group kept by the subs
+    asio::post(g.strand, [subs, &g, message, frag_key, meta]() {
+      for (auto &&s : g.sessions) {
+        // on the strand as the resync, the epoch current
+        if (s->Fmp4Accept(frag_key)) {
+          s->SendOnStrand(nullptr, message, meta, s->GetSendEpoch());
+        }
+      }
+    });
+  }
+}
+
+extern template class WsStreamRoomBase<WsStreamSession>;
+
+// the room of the server sessions, instantiated once by ws_stream_room.cc
+class WsStreamRoom : public WsStreamRoomBase<WsStreamSession> {
+ public:
+  using WsStreamRoomBase<WsStreamSession>::WsStreamRoomBase;
+};
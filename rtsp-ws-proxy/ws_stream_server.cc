@@ -1,22 +1,150 @@
 #include "ws_stream_server.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
 #include <utility>
 #include <vector>
 
+#include <boost/asio/post.hpp>
+
+#include "common/net/ext.h"
 #define NET_JSON_STREAM_INFO_IGNORE
 #include "common/net/json.h"
 #include "common/net/packet.h"
 #include "common/util/log.h"
+#include "common/util/metrics.h"
+#include "common/util/times.h"
 
+#include "stream_flv.h"
+#include "stream_hls.h"
+#include "stream_snapshot.h"
 #include "ws_stream_room.h"
 #include "ws_stream_session.h"
 
+namespace {
+
+// split "path?query" of the target, return the query
+beast::string_view SplitQuery(beast::string_view *target) {
+  auto pos = target->find('?');
+  if (pos == beast::string_view::npos) return beast::string_view{};
+  auto query = target->substr(pos + 1);
+  *target = target->substr(0, pos);
+  return query;
+}
+
+// the value of "name=value" in the query, empty if not found
+std::string GetQueryParam(beast::string_view query,
+                          beast::string_view name) {
+  while (!query.empty()) {
+    auto pos = query.find('&');
+    auto param = query.substr(0, pos);
+    if (param.size() > name.size() && param.starts_with(name) &&
+        param[name.size()] == '=') {
+      return std::string(param.substr(name.size() + 1));
+    }
+    query = (pos == beast::string_view::npos)
+        ? beast::string_view{} : query.substr(pos + 1);
+  }
+  return std::string{};
+}
+
+// parse "<prefix><n><suffix>", e.g. seg12.mp4, return false if not matched
+bool ParseName(beast::string_view name, beast::string_view prefix,
+               beast::string_view suffix, int64_t *n) {
+  if (name.size() <= prefix.size() + suffix.size() ||
+      !name.starts_with(prefix) || !name.ends_with(suffix)) {
+    return false;
+  }
+  auto s = std::string(name.substr(prefix.size(),
+      name.size() - prefix.size() - suffix.size()));
+  if (s.find_first_not_of("0123456789") != std::string::npos) return false;
+  *n = std::atoll(s.c_str());
+  return true;
+}
+
+// resume the coroutine once ready, or at the deadline
+//  is_ready(waiter): return true if ready, or the waiter will be called once
+//    checked only if the waiter is nullptr
+//  cancel(): remove the waiter kept, if not called
+//  return false if timeout
+// the waiter kept is always waited, by it or the timer, then cancelled, so
+//  never calls the handler after the coroutine resumed
+template <typename IsReady, typename Cancel>
+bool WaitReady(IsReady &&is_ready, Cancel &&cancel,
+               std::chrono::steady_clock::time_point deadline,
+               asio::yield_context yield) {
+  using init_t = asio::async_completion<asio::yield_context, void()>;
+  using handler_t = init_t::completion_handler_type;
+  // completed once by the stream thread or the timer
+  struct Wait {
+    std::atomic_bool done;
+    handler_t handler;
+    explicit Wait(handler_t &&h) : done(false), handler(std::move(h)) {}
+    void Complete() {
+      if (done.exchange(true)) return;
+      auto ex = asio::get_associated_executor(handler);
+      asio::post(ex, std::move(handler));
+    }
+  };
+
+  while (true) {
+    if (std::chrono::steady_clock::now() >= deadline) {
+      return is_ready(nullptr);
+    }
+    init_t init(yield);
+    auto w = std::make_shared<Wait>(std::move(init.completion_handler));
+    if (is_ready([w]() { w->Complete(); })) return true;
+    auto timer = std::make_shared<asio::steady_timer>(
+        asio::get_associated_executor(w->handler), deadline);
+    timer->async_wait([w, timer](beast::error_code) { w->Complete(); });
+    init.result.get();
+    timer->cancel();
+    cancel();
+  }
+}
+
+bool WaitHls(const std::shared_ptr<StreamHls> &hls, int64_t msn, int part,
+             std::chrono::steady_clock::time_point deadline,
+             asio::yield_context yield) {
+  uint64_t waiter_id = 0;
+  return WaitReady([&hls, msn, part, &waiter_id](StreamHls::waiter_t waiter) {
+    return hls->IsReady(msn, part, std::move(waiter), &waiter_id);
+  }, [&hls, &waiter_id]() {
+    hls->CancelWaiter(waiter_id);
+  }, deadline, yield);
+}
+
+bool WaitSnapshot(const std::shared_ptr<StreamSnapshot> &snapshot,
+                  std::chrono::steady_clock::duration max_age,
+                  std::chrono::steady_clock::time_point deadline,
+                  asio::yield_context yield) {
+  uint64_t waiter_id = 0;
+  return WaitReady([&snapshot, max_age, &waiter_id](
+      StreamSnapshot::waiter_t waiter) {
+    return snapshot->IsReady(max_age, std::move(waiter), &waiter_id);
+  }, [&snapshot, &waiter_id]() {
+    snapshot->CancelWaiter(waiter_id);
+  }, deadline, yield);
+}
+
+}  // namespace
+
 WsStreamServer::WsStreamServer(const WsServerOptions &options)
   : WsServer(options),
     cors_(options.cors.enabled
         ? std::make_shared<net::Cors<>>(options.cors)
         : nullptr),
-    room_(std::make_shared<WsStreamRoom>()) {
+    room_(std::make_shared<WsStreamRoom>(
+        options.shard_enable ? 1 : options.threads,
+        StreamFmp4MuxerOptions{options.stream.fmp4_frag_per_frame})),
+    outputs_(std::chrono::milliseconds(options.stream.hls_idle_ms),
+             std::chrono::milliseconds(options.stream.snapshot_idle_ms)),
+    snapshot_pool_(options.stream.snapshot_enable
+        ? new asio::thread_pool(std::max(options.stream.snapshot_threads, 1))
+        : nullptr) {
   VLOG(2) << __func__;
 }
 
@@ -29,20 +157,49 @@ void WsStreamServer::Send(
     const std::shared_ptr<Stream> &stream,
     const AVMediaType &type,
     AVPacket *packet) {
-  (void)stream;
-  if (stream_map_.find(id) == stream_map_.end()) {
-    stream_map_.emplace(id, stream);
-    LOG(INFO) << "Stream[" << id << "] start";
-  } else {
-    // need update if stream loop
-    stream_map_[id] = stream;
+  // need update if stream loop
+  if (streams_.Set(id, stream)) {
+    SetInit(id, stream);
+  }
+  // the outputs of the stream, loaded once per packet, lock free
+  auto outputs = outputs_.Get(id);
+  // remove the hls if not requested for a while
+  if (outputs != nullptr && outputs->hls != nullptr) {
+    if (outputs_.IsHlsActive(outputs->hls)) {
+      outputs->hls->Send(stream, type, packet);
+    } else {
+      RemoveHls(id, outputs->hls);
+    }
+  }
+  // muxed once for all flv viewers
+  if (outputs != nullptr && outputs->flv != nullptr) {
+    outputs->flv->Send(stream, type, packet);
   }
-  // if no sessions, not send data
-  if (room_->Empty(id)) return;
+  // keep the key frame for snapshot, only ref it
+  if (snapshot_pool_ != nullptr && type == AVMEDIA_TYPE_VIDEO &&
+      (packet->flags & AV_PKT_FLAG_KEY)) {
+    auto snapshot = outputs != nullptr ? outputs->snapshot : nullptr;
+    if (snapshot == nullptr) snapshot = GetSnapshot(id, true);
+    snapshot->Update(stream->GetStreamSub(type)->info->codecpar, packet);
+  }
+  // the packet buffer is ref'ed until all sessions written it, skipped if none
+  //  with the ingest wall clock, for the sessions measure the latency
+  room_->Send(id, type, packet, times::now<times::microseconds>());
+  // remuxed once for all fmp4 sessions
+  room_->Mux(id, stream, type, packet);
+}
+
+void WsStreamServer::SetInit(
+    const std::string &id, const std::shared_ptr<Stream> &stream) {
+  net::DataInit::subs_t subs;
+  for (auto &&e : stream->GetStreamSubs()) {
+    subs[e.first] = e.second->info;
+  }
+  room_->SetInit(id, net::DataInit::ToBytes(subs));
+}
 
-  auto data = std::make_shared<std::vector<uint8_t>>();
-  net::Data(type, packet).ToBytes(*data);
-  room_->Send(id, data);
+bool WsStreamServer::HasSubscribers(const std::string &id) {
+  return !room_->Empty(id) || outputs_.IsDemanded(id);
 }
 
 void WsStreamServer::DoSessionWebSocket(
@@ -57,24 +214,81 @@ void WsStreamServer::DoSessionWebSocket(
   }
 
   static auto stream_path_len = options_.stream.ws_target_prefix.size();
+  // ?ver=2&batch=1&init=1, the data version wanted, if batch datas
+  //  and if send the codec parameters first
+  auto query = SplitQuery(&target);
   auto stream_id = std::string(target.substr(stream_path_len));
-  LOG(INFO) << "ws stream granted, id=" << stream_id;
+  WsStreamSessionOptions session_options{};
+  // <id>.mp4, fragmented mp4 instead of the datas
+  static const std::string fmp4_suffix = ".mp4";
+  if (options_.stream.fmp4_enable && stream_id.size() > fmp4_suffix.size() &&
+      stream_id.compare(stream_id.size() - fmp4_suffix.size(),
+          fmp4_suffix.size(), fmp4_suffix) == 0 &&
+      !streams_.Has(stream_id)) {
+    stream_id.resize(stream_id.size() - fmp4_suffix.size());
+    session_options.fmp4 = true;
+  }
+  if (GetQueryParam(query, "ver") == "2")
+    session_options.data_ver = net::DATA_VERSION_2;
+  if (GetQueryParam(query, "batch") == "1") {
+    session_options.batch_window_ms = options_.stream.batch_window_ms;
+    session_options.batch_max_bytes =
+        std::max(options_.stream.batch_max_bytes, 1);
+  }
+  session_options.init = (GetQueryParam(query, "init") == "1");
+  // the v1 layout is fixed, no field for it
+  session_options.time = (GetQueryParam(query, "time") == "1") &&
+      session_options.data_ver == net::DATA_VERSION_2;
+  session_options.send_policy.deadline_ms = options_.stream.send_deadline_ms;
+  session_options.send_policy.evict_drops = options_.stream.send_evict_drops;
+  session_options.send_policy.evict_window_ms =
+      options_.stream.send_evict_window_ms;
+  session_options.send_policy.sample_ms = options_.stream.send_sample_ms;
+  session_options.send_policy.unsent_max_bytes =
+      std::max(options_.stream.send_unsent_max_bytes, 0);
+  // <ws_target_prefix> without id, the streams subscribed by the messages
+  if (options_.stream.mux_enable && stream_id.empty()) {
+    session_options.mux = true;
+    session_options.on_subscribe = [this](const std::string &id) {
+      if (!streams_.Has(id)) return false;
+      if (options_.on_stream_join) options_.on_stream_join(id);
+      return true;
+    };
+  }
+  LOG(INFO) << "ws stream granted, id=" << stream_id
+      << ", ver=" << session_options.data_ver
+      << ", batch_window_ms=" << session_options.batch_window_ms
+      << ", init=" << session_options.init
+      << ", time=" << session_options.time
+      << ", fmp4=" << session_options.fmp4
+      << ", mux=" << session_options.mux;
   LOG(INFO) << " client, ip="
       << beast::get_lowest_layer(ws).socket().remote_endpoint();
 
-  if (stream_map_.find(stream_id) == stream_map_.end()) {
+  if (!session_options.mux && !streams_.Has(stream_id)) {
     LOG(WARNING) << "ws stream not found, id=" << stream_id;
     return;
   }
 
+  // the sessions share the strands, posted once per strand by the room
+  auto strand = room_->GetStrand(ws.get_executor());
   auto s = std::make_shared<WsStreamSession>(
       std::move(ws), std::move(req),
-      options_.stream.send_queue_max_size, stream_id, room_);
+      options_.stream.send_queue_max_size, stream_id, room_, strand,
+      session_options);
   s->SetEventCallback(net::NET_EVENT_FAIL,
       [this](const std::shared_ptr<WsStreamSession::event_t> &event) {
         auto e = std::dynamic_pointer_cast<net::NetFailEvent>(event);
         OnFail(e->ec, e->what.c_str());
       });
+  if (options_.on_stream_join && !session_options.mux) {
+    s->SetEventCallback(net::NET_EVENT_OPENED,
+        [this, stream_id](
+            const std::shared_ptr<WsStreamSession::event_t> &event) {
+          (void)event;
+          options_.on_stream_join(stream_id);
+        });
+  }
   s->Run();
 }
 
@@ -82,23 +296,464 @@ bool WsStreamServer::OnHandleHttpRequest(
     http_req_t &req, send_lambda_t &send) {
   (void)send;
 
+  if (OnHandleStreams(req, send)) return true;
+  if (OnHandleMetrics(req, send)) return true;
+  if (OnHandleFlv(req, send)) return true;
+  if (OnHandleHls(req, send)) return true;
+  return OnHandleSnapshot(req, send);
+}
+
+bool WsStreamServer::OnHandleStreams(
+    http_req_t &req, send_lambda_t &send) {
   auto target = req.target();
-  if (target == options_.stream.http_target) {
-    LOG(INFO) << "http req: " << target;
-    http::response<http::string_body> res{
-        http::status::ok, req.version()};
-    if (cors_ && cors_->Handle(req, res)) {
+  SplitQuery(&target);
+  auto &&prefix = options_.stream.http_target;
+  if (!target.starts_with(prefix)) return false;
+  target.remove_prefix(prefix.size());
+  if (!target.empty()) {
+    // <http_target>/<id>, the others handled after
+    if (target.front() != '/') return false;
+    target.remove_prefix(1);
+    if (target.empty() || target.find('/') != beast::string_view::npos)
+      return false;
+  }
+
+  LOG(INFO) << "http req: " << req.target();
+  http::response<http::string_body> res{
+      http::status::ok, req.version()};
+  if (cors_ && cors_->Handle(req, res)) {
+    send(std::move(res));
+    return true;
+  }
+  res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.keep_alive(req.keep_alive());
+
+  // the json shared by the snapshot, kept alive till written
+  auto snapshot = streams_.Get();
+  auto json = snapshot->json;
+  auto etag = &snapshot->etag;
+  if (!target.empty()) {
+    auto it = snapshot->streams.find(std::string(target));
+    if (it == snapshot->streams.end()) {
+      res.result(http::status::not_found);
+      res.set(http::field::content_type, "text/html");
+      res.body() = "The stream '" + std::string(target) +
+          "' is not available.";
+      res.prepare_payload();
       send(std::move(res));
       return true;
     }
-    res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
-    res.set(http::field::content_type, "application/json");
+    json = it->second.json;
+    etag = &it->second.etag;
+  }
+  res.set(http::field::etag, *etag);
+  res.set(http::field::cache_control, "no-cache");
+
+  auto inm = req[http::field::if_none_match];
+  if (!inm.empty() && net::StaticCache::EtagMatch(inm, *etag)) {
+    res.result(http::status::not_modified);
+    http::response<http::empty_body> r{std::move(res.base())};
+    send(std::move(r));
+    return true;
+  }
+
+  res.set(http::field::content_type, "application/json");
+  res.content_length(json->size());
+  if (req.method() == http::verb::head) {
+    http::response<http::empty_body> r{std::move(res.base())};
+    send(std::move(r));
+    return true;
+  }
+  http::response<http::span_body<char const>> r{std::move(res.base()),
+      http::span_body<char const>::value_type{json->data(), json->size()}};
+  send(std::move(r));
+  return true;
+}
+
+bool WsStreamServer::OnHandleMetrics(
+    http_req_t &req, send_lambda_t &send) {
+  auto &&target = options_.http.metrics_target;
+  if (target.empty() || req.target() != target) return false;
+
+  VLOG(1) << "http req: " << req.target();
+  http::response<http::string_body> res{
+      http::status::ok, req.version()};
+  res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.set(http::field::content_type, metrics::Registry::kContentType);
+  res.set(http::field::cache_control, "no-store");
+  res.keep_alive(req.keep_alive());
+  res.body() = metrics::Registry::Instance().Serialize();
+  res.prepare_payload();
+  send(std::move(res));
+  return true;
+}
+
+bool WsStreamServer::OnHandleSnapshot(
+    http_req_t &req, send_lambda_t &send) {
+  if (snapshot_pool_ == nullptr) return false;
+
+  // <http_target>/<id>/snapshot.jpg?w=320
+  auto target = req.target();
+  auto query = SplitQuery(&target);
+  auto prefix = options_.stream.http_target + "/";
+  if (!target.starts_with(prefix)) return false;
+  target.remove_prefix(prefix.size());
+  auto pos = target.rfind('/');
+  if (pos == beast::string_view::npos) return false;
+  auto id = std::string(target.substr(0, pos));
+  auto name = target.substr(pos + 1);
+  StreamSnapshotFormat format;
+  if (name == "snapshot.jpg" || name == "snapshot.jpeg") {
+    format = STREAM_SNAPSHOT_JPEG;
+  } else if (name == "snapshot.png") {
+    format = STREAM_SNAPSHOT_PNG;
+  } else {
+    return false;
+  }
+  int width = std::atoi(GetQueryParam(query, "w").c_str());
+
+  VLOG(1) << "http req: " << req.target();
+  http::response<http::string_body> res{
+      http::status::ok, req.version()};
+  if (cors_ && cors_->Handle(req, res)) {
+    send(std::move(res));
+    return true;
+  }
+  res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.keep_alive(req.keep_alive());
+
+  using image_t = StreamSnapshot::image_t;
+  std::shared_ptr<image_t> image = nullptr;
+  auto snapshot = GetSnapshot(id, streams_.Has(id));
+  if (snapshot != nullptr) {
+    // demand the stream as a viewer, resumed with a key frame if suspended
+    auto idle = !outputs_.IsSnapshotActive(snapshot);
+    snapshot->Touch();
+    if (idle) {
+      if (options_.on_stream_join) options_.on_stream_join(id);
+      // the key frame kept before suspended, wait a new one a while
+      auto deadline = std::chrono::steady_clock::now() +
+          std::chrono::seconds(5);
+      WaitSnapshot(snapshot,
+          std::chrono::milliseconds(options_.stream.snapshot_idle_ms),
+          deadline, send.yield_);
+    }
+
+    // decode and encode in the pool, then resume this coroutine
+    asio::async_completion<asio::yield_context,
+        void(std::shared_ptr<image_t>)> init(send.yield_);
+    asio::post(*snapshot_pool_,
+        [snapshot, format, width, id,
+            handler = std::move(init.completion_handler)]() mutable {
+          std::shared_ptr<image_t> image = nullptr;
+          try {
+            image = snapshot->Get(format, width);
+          } catch (const std::exception &e) {
+            LOG(ERROR) << "Stream[" << id << "] snapshot fail, " << e.what();
+          }
+          auto ex = asio::get_associated_executor(handler);
+          asio::post(ex, std::bind(std::move(handler), image));
+        });
+    image = init.result.get();
+  }
+
+  if (image == nullptr) {
+    res.result(http::status::not_found);
+    res.set(http::field::content_type, "text/html");
+    res.body() = "The snapshot of stream '" + id + "' is not available.";
+    res.prepare_payload();
+    send(std::move(res));
+    return true;
+  }
+
+  // the shared image, not copied, kept until written
+  http::response<http::span_body<char const>> image_res{std::move(res.base())};
+  image_res.set(http::field::content_type, net::mime_type(name));
+  image_res.set(http::field::cache_control, "no-cache");
+  // the seconds since the key frame, old if the stream stopped
+  image_res.set(http::field::age, std::to_string(
+      std::chrono::duration_cast<std::chrono::seconds>(
+          snapshot->GetKeyAge()).count()));
+  image_res.body() = http::span_body<char const>::value_type(
+      reinterpret_cast<char const *>(image->data()), image->size());
+  image_res.prepare_payload();
+  send(std::move(image_res));
+  return true;
+}
+
+std::shared_ptr<StreamSnapshot> WsStreamServer::GetSnapshot(
+    const std::string &id, bool create) {
+  auto outputs = outputs_.Get(id);
+  if (outputs != nullptr && outputs->snapshot != nullptr) {
+    return outputs->snapshot;
+  }
+  if (!create) return nullptr;
+
+  std::shared_ptr<StreamSnapshot> snapshot = nullptr;
+  outputs_.Update(id, [this, &snapshot](StreamOutputs::Entry *e) {
+    if (e->snapshot == nullptr) {
+      StreamSnapshotOptions options{};
+      options.ttl_ms = options_.stream.snapshot_ttl_ms;
+      options.max_width = options_.stream.snapshot_max_width;
+      e->snapshot = std::make_shared<StreamSnapshot>(options);
+    }
+    snapshot = e->snapshot;
+  });
+  return snapshot;
+}
+
+bool WsStreamServer::OnHandleFlv(http_req_t &req, send_lambda_t &send) {
+  if (!options_.stream.flv_enable) return false;
+
+  // <ws_target_prefix><id>.flv
+  static const beast::string_view flv_suffix = ".flv";
+  auto target = req.target();
+  SplitQuery(&target);
+  auto &&prefix = options_.stream.ws_target_prefix;
+  if (target.size() <= prefix.size() + flv_suffix.size() ||
+      !target.starts_with(prefix) || !target.ends_with(flv_suffix)) {
+    return false;
+  }
+  auto id = std::string(target.substr(prefix.size(),
+      target.size() - prefix.size() - flv_suffix.size()));
+
+  LOG(INFO) << "http req: " << req.target();
+  http::response<http::string_body> res{
+      http::status::ok, req.version()};
+  if (cors_ && cors_->Handle(req, res)) {
+    send(std::move(res));
+    return true;
+  }
+  res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+  if (!streams_.Has(id)) {
+    res.result(http::status::not_found);
+    res.set(http::field::content_type, "text/html");
     res.keep_alive(req.keep_alive());
-    res.body() = net::to_string(stream_map_);
+    res.body() = "The stream '" + id + "' is not available.";
+    res.prepare_payload();
+    send(std::move(res));
+    return true;
+  }
+
+  // the header, then the chunks until closed
+  http::response<http::empty_body> flv_res{std::move(res.base())};
+  flv_res.set(http::field::content_type, "video/x-flv");
+  flv_res.set(http::field::cache_control, "no-cache");
+  flv_res.keep_alive(false);
+  flv_res.chunked(true);
+  send.close_ = true;
+
+  auto &&stream = send.stream_;
+  auto &&yield = send.yield_;
+  beast::error_code ec;
+  http::response_serializer<http::empty_body> sr{flv_res};
+  beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+  http::async_write_header(stream, sr, yield[ec]);
+  if (ec) {
+    send.ec_ = ec;
+    return true;
+  }
+
+  std::shared_ptr<StreamFlv> flv = nullptr;
+  auto viewer = JoinFlv(id, &flv);
+  std::vector<StreamFlv::bytes_t> bytes;
+  std::vector<asio::const_buffer> bufs;
+  while (true) {
+    auto deadline = std::chrono::steady_clock::now() +
+        std::chrono::seconds(30);
+    auto ready = WaitReady([&viewer, &bytes](StreamFlv::waiter_t waiter) {
+      return viewer->Take(&bytes, std::move(waiter));
+    }, [&viewer]() {
+      viewer->CancelWaiter();
+    }, deadline, yield);
+    if (!ready) {
+      LOG(WARNING) << "Stream[" << id << "] flv no data, end";
+      break;
+    }
+    if (bytes.empty()) break;  // closed
+    // the shared tags, not copied, kept until written
+    bufs.clear();
+    for (auto &&b : bytes) bufs.emplace_back(b->data(), b->size());
+    beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    asio::async_write(stream, http::make_chunk(bufs), yield[ec]);
+    if (ec) break;
+  }
+  LeaveFlv(id, flv, viewer);
+  LOG(INFO) << "Stream[" << id << "] flv viewer left"
+      << (ec ? ", " + ec.message() : "");
+
+  if (!ec) {
+    beast::get_lowest_layer(stream).expires_after(std::chrono::seconds(30));
+    asio::async_write(stream, http::make_chunk_last(), yield[ec]);
+  }
+  return true;
+}
+
+bool WsStreamServer::OnHandleHls(http_req_t &req, send_lambda_t &send) {
+  if (!options_.stream.hls_enable) return false;
+
+  // <http_target>/<id>/hls/<name>
+  static const beast::string_view hls_dir = "/hls/";
+  auto target = req.target();
+  auto query = SplitQuery(&target);
+  auto prefix = options_.stream.http_target + "/";
+  if (!target.starts_with(prefix)) return false;
+  target.remove_prefix(prefix.size());
+  auto pos = target.rfind(hls_dir);
+  if (pos == beast::string_view::npos) return false;
+  auto id = std::string(target.substr(0, pos));
+  auto name = target.substr(pos + hls_dir.size());
+
+  VLOG(1) << "http req: " << req.target();
+  http::response<http::string_body> res{
+      http::status::ok, req.version()};
+  if (cors_ && cors_->Handle(req, res)) {
+    send(std::move(res));
+    return true;
+  }
+  res.set(http::field::server, BOOST_BEAST_VERSION_STRING);
+  res.keep_alive(req.keep_alive());
+
+  auto not_found = [&res, &send, &id](const std::string &what) {
+    res.result(http::status::not_found);
+    res.set(http::field::content_type, "text/html");
+    res.body() = "The hls " + what + " of stream '" + id +
+        "' is not available.";
+    res.prepare_payload();
+    send(std::move(res));
+    return true;
+  };
+
+  // muxed on demand, the stream may be resumed
+  auto create = (name == "index.m3u8") && streams_.Has(id);
+  auto hls = GetHls(id, create);
+  if (hls == nullptr) return not_found(std::string(name));
+  hls->Touch();
+
+  auto timeout = std::chrono::milliseconds(
+      options_.stream.hls_segment_target_ms * 3);
+  auto deadline = std::chrono::steady_clock::now() + timeout;
+
+  if (name == "index.m3u8") {
+    // blocking playlist reload, ?_HLS_msn=<M>&_HLS_part=<N>
+    auto msn_s = GetQueryParam(query, "_HLS_msn");
+    auto part_s = GetQueryParam(query, "_HLS_part");
+    int64_t msn = msn_s.empty() ? -1 : std::atoll(msn_s.c_str());
+    int part = part_s.empty() ? -1 : std::atoi(part_s.c_str());
+    WaitHls(hls, msn, part, deadline, send.yield_);
+    auto playlist = hls->GetPlaylist();
+    if (playlist.empty()) return not_found("playlist");
+    res.set(http::field::content_type, "application/vnd.apple.mpegurl");
+    res.set(http::field::cache_control, "no-cache");
+    res.body() = std::move(playlist);
     res.prepare_payload();
     send(std::move(res));
     return true;
   }
 
-  return false;
+  StreamHls::bytes_t data = nullptr;
+  int64_t n = 0, msn = 0;
+  if (ParseName(name, "init", ".mp4", &n)) {
+    data = hls->GetInit(static_cast<int>(n));
+  } else if (ParseName(name, "seg", ".mp4", &n)) {
+    data = hls->GetSegment(n);
+  } else if (name.starts_with("part")) {
+    // part<msn>.<n>.mp4, wait it as the preload hint
+    auto dot = name.find('.');
+    if (dot != beast::string_view::npos &&
+        ParseName(name.substr(0, dot), "part", "", &msn) &&
+        ParseName(name.substr(dot), ".", ".mp4", &n)) {
+      if (WaitHls(hls, msn, static_cast<int>(n), deadline, send.yield_)) {
+        data = hls->GetPart(msn, static_cast<int>(n));
+      }
+    }
+  }
+  if (data == nullptr) return not_found(std::string(name));
+
+  // the shared bytes, not copied, kept until written
+  http::response<http::span_body<char const>> data_res{std::move(res.base())};
+  data_res.set(http::field::content_type, "video/mp4");
+  data_res.set(http::field::cache_control, "max-age=60");
+  data_res.body() = http::span_body<char const>::value_type(
+      reinterpret_cast<char const *>(data->data()), data->size());
+  data_res.prepare_payload();
+  send(std::move(data_res));
+  return true;
+}
+
+std::shared_ptr<StreamHls> WsStreamServer::GetHls(
+    const std::string &id, bool create) {
+  auto outputs = outputs_.Get(id);
+  if (outputs != nullptr && outputs->hls != nullptr) return outputs->hls;
+  if (!create) return nullptr;
+
+  std::shared_ptr<StreamHls> hls = nullptr;
+  bool created = false;
+  outputs_.Update(id, [this, &hls, &created](StreamOutputs::Entry *e) {
+    // created by the other request meanwhile
+    if (e->hls == nullptr) {
+      StreamHlsOptions options{};
+      options.part_target_ms = options_.stream.hls_part_target_ms;
+      options.segment_target_ms = options_.stream.hls_segment_target_ms;
+      options.segments_max = options_.stream.hls_segments_max;
+      e->hls = std::make_shared<StreamHls>(options);
+      created = true;
+    }
+    hls = e->hls;
+  });
+  if (!created) return hls;
+  LOG(INFO) << "Stream[" << id << "] hls start";
+  // resume the stream if suspended
+  if (options_.on_stream_join) options_.on_stream_join(id);
+  return hls;
+}
+
+void WsStreamServer::RemoveHls(
+    const std::string &id, const std::shared_ptr<StreamHls> &hls) {
+  bool removed = false;
+  outputs_.Update(id, [this, &hls, &removed](StreamOutputs::Entry *e) {
+    // not the new one, or the one requested meanwhile
+    if (e->hls == hls && !outputs_.IsHlsActive(hls)) {
+      e->hls = nullptr;
+      removed = true;
+    }
+  });
+  if (removed) LOG(INFO) << "Stream[" << id << "] hls idle, removed";
+}
+
+std::shared_ptr<StreamFlv::Viewer> WsStreamServer::JoinFlv(
+    const std::string &id, std::shared_ptr<StreamFlv> *flv) {
+  std::shared_ptr<StreamFlv::Viewer> viewer = nullptr;
+  bool created = false;
+  // joined under the lock, not to join the one being removed
+  outputs_.Update(id, [this, flv, &viewer, &created](StreamOutputs::Entry *e) {
+    if (e->flv == nullptr) {
+      StreamFlvOptions options{};
+      options.queue_max_size = std::max(options_.stream.flv_queue_max_size, 2);
+      e->flv = std::make_shared<StreamFlv>(options);
+      created = true;
+    }
+    *flv = e->flv;
+    viewer = e->flv->Join();
+  });
+  if (!created) return viewer;
+  LOG(INFO) << "Stream[" << id << "] flv start";
+  // resume the stream if suspended
+  if (options_.on_stream_join) options_.on_stream_join(id);
+  return viewer;
+}
+
+void WsStreamServer::LeaveFlv(
+    const std::string &id,
+    const std::shared_ptr<StreamFlv> &flv,
+    const std::shared_ptr<StreamFlv::Viewer> &viewer) {
+  bool removed = false;
+  outputs_.Update(id, [&flv, &viewer, &removed](StreamOutputs::Entry *e) {
+    flv->Leave(viewer);
+    if (e->flv == flv && flv->Empty()) {
+      e->flv = nullptr;
+      removed = true;
+    }
+  });
+  if (removed) LOG(INFO) << "Stream[" << id << "] flv stop";
 }
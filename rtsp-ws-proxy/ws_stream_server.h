@@ -2,12 +2,18 @@
 
 #include <memory>
 #include <string>
-#include <unordered_map>
+
+#include <boost/asio/thread_pool.hpp>
 
 #include "common/media/stream.h"
 
+#include "stream_flv.h"
+#include "stream_outputs.h"
+#include "stream_registry.h"
 #include "ws_server.h"
 
+class StreamHls;
+class StreamSnapshot;
 class WsStreamRoom;
 
 class WsStreamServer : public WsServer {
@@ -20,6 +26,9 @@ class WsStreamServer : public WsServer {
             const AVMediaType &type,
             AVPacket *packet);
 
+  // if any session is watching the stream
+  bool HasSubscribers(const std::string &id);
+
  protected:
   void DoSessionWebSocket(
       ws_stream_t &&ws, boost::optional<http_req_t> &&req) override;
@@ -27,7 +36,37 @@ class WsStreamServer : public WsServer {
   bool OnHandleHttpRequest(
       http_req_t &req, send_lambda_t &send) override;
 
+  // <http_target> and <http_target>/<id>, the json cached till changed
+  bool OnHandleStreams(http_req_t &req, send_lambda_t &send);
+  bool OnHandleMetrics(http_req_t &req, send_lambda_t &send);
+  bool OnHandleSnapshot(http_req_t &req, send_lambda_t &send);
+  bool OnHandleHls(http_req_t &req, send_lambda_t &send);
+  bool OnHandleFlv(http_req_t &req, send_lambda_t &send);
+
+  std::shared_ptr<StreamSnapshot> GetSnapshot(const std::string &id,
+                                              bool create = false);
+
+  // the hls of the stream, removed if idle
+  std::shared_ptr<StreamHls> GetHls(const std::string &id,
+                                    bool create = false);
+  void RemoveHls(const std::string &id, const std::shared_ptr<StreamHls> &hls);
+
+  // the flv of the stream, created by the first viewer, removed by the last
+  std::shared_ptr<StreamFlv::Viewer> JoinFlv(
+      const std::string &id, std::shared_ptr<StreamFlv> *flv);
+  void LeaveFlv(const std::string &id,
+                const std::shared_ptr<StreamFlv> &flv,
+                const std::shared_ptr<StreamFlv::Viewer> &viewer);
+
+  // the codec parameters for the sessions want them, ?init=1
+  void SetInit(const std::string &id, const std::shared_ptr<Stream> &stream);
+
   std::shared_ptr<net::Cors<>> cors_;
   std::shared_ptr<WsStreamRoom> room_;
-  std::unordered_map<std::string, std::shared_ptr<Stream>> stream_map_;
+  // written by the stream threads, read by the io threads
+  StreamRegistry streams_;
+  // written by the io threads, read by the stream threads
+  StreamOutputs outputs_;
+
+  std::unique_ptr<asio::thread_pool> snapshot_pool_;
 };
@@ -1,10 +1,15 @@
 #include "ws_stream_session.h"
 
+#include <algorithm>
 #include <utility>
 
 #include <boost/lexical_cast.hpp>
 
+#define NET_JSON_STREAM_IGNORE
+#define NET_JSON_STREAM_INFO_IGNORE
+#include "common/net/json.h"
 #include "common/util/log.h"
+#include "common/util/metrics.h"
 
 #include "ws_stream_room.h"
 
@@ -13,13 +18,19 @@ WsStreamSession::WsStreamSession(
     boost::optional<http_req_t> &&req,
     std::size_t send_queue_max_size,
     std::string id,
-    std::shared_ptr<WsStreamRoom> room)
+    std::shared_ptr<WsStreamRoom> room,
+    const strand_t &strand,
+    const WsStreamSessionOptions &options)
   : WsSession(std::move(ws), std::move(req),
       id + "|" + boost::lexical_cast<std::string>(
           beast::get_lowest_layer(ws).socket().remote_endpoint()),
-      send_queue_max_size),
-    id_(std::move(id)), room_(std::move(room)) {
+      send_queue_max_size, strand),
+    id_(std::move(id)), room_(std::move(room)), options_(options),
+    batch_bytes_(0), batch_timer_(ws_.get_executor()),
+    batch_timer_waiting_(false), fmp4_wait_key_(true), send_epoch_(0),
+    paused_(false), key_only_(false), wait_key_(false), mux_closed_(false) {
   VLOG(2) << __func__ << "[" << tag_ << "]";
+  send_policy_ = options_.send_policy;
 }
 
 WsStreamSession::~WsStreamSession() {
@@ -27,13 +38,221 @@ WsStreamSession::~WsStreamSession() {
 }
 
 void WsStreamSession::OnEventOpened() {
-  room_->Join(id_, shared_from_this());
+  // the mux session joins once subscribed
+  if (!IsMux()) room_->Join(id_, shared_from_this());
   WsSession<data_t>::OnEventOpened();
 }
 
 void WsStreamSession::OnEventClosed() {
   WsSession<data_t>::OnEventClosed();
-  room_->Leave(id_, shared_from_this());
+  auto stats = GetSendStats();
+  if (stats.dropped > 0) {
+    LOG(INFO) << "WsStreamSession[" << tag_ << "] sent=" << stats.sent
+        << ", dropped=" << stats.dropped << ", drop_runs=" << stats.drop_runs
+        << ", evicted=" << stats.evicted;
+  }
+  {
+    std::lock_guard<std::mutex> _(latency_mutex_);
+    if (present_latency_.n > 0) {
+      LOG(INFO) << "WsStreamSession[" << tag_ << "] latency present_avg="
+          << present_latency_.sum / present_latency_.n * 0.001
+          << " ms, present_max=" << present_latency_.max * 0.001
+          << " ms, recv_avg=" << (recv_latency_.n > 0
+              ? recv_latency_.sum / recv_latency_.n * 0.001 : 0)
+          << " ms";
+    }
+  }
+  if (!IsMux()) {
+    room_->Leave(id_, shared_from_this());
+    return;
+  }
+  std::lock_guard<std::mutex> _(mux_mutex_);
+  mux_closed_ = true;
+  for (auto &&e : mux_ids_) {
+    room_->Leave(e.first, shared_from_this());
+  }
+  mux_ids_.clear();
+}
+
+void WsStreamSession::OnEventRecv(
+    beast::flat_buffer &buffer, std::size_t bytes_n) {
+  WsSession<data_t>::OnEventRecv(buffer, bytes_n);
+  OnControl(beast::buffers_to_string(buffer.data()));
+}
+
+void WsStreamSession::OnControl(const std::string &msg) {
+  auto j = net::json::parse(msg, nullptr, false);
+  if (j.is_discarded() || !j.is_object() || !j["op"].is_string()) {
+    LOG(WARNING) << "WsStreamSession[" << tag_ << "] control invalid: "
+        << msg.substr(0, 64);
+    SendText(net::json{{"error", "invalid"}}.dump());
+    return;
+  }
+  auto op = j["op"].get<std::string>();
+  VLOG(1) << "WsStreamSession[" << tag_ << "] control " << msg.substr(0, 64);
+  if (op == "sub" || op == "unsub") {
+    if (!IsMux() || !j["ids"].is_array()) {
+      SendText(net::json{{"op", op}, {"error", "invalid"}}.dump());
+      return;
+    }
+    std::vector<std::string> ids;
+    for (auto &&e : j["ids"]) {
+      if (e.is_string()) ids.push_back(e.get<std::string>());
+    }
+    OnSubscribe(op == "sub", ids);
+  } else if (op == "pause") {
+    paused_ = true;
+    SendText(net::json{{"op", op}}.dump());
+  } else if (op == "resume") {
+    WaitKey();
+    paused_ = false;
+    SendText(net::json{{"op", op}}.dump());
+  } else if (op == "mode" && j["mode"].is_string() && !IsFmp4()) {
+    auto mode = j["mode"].get<std::string>();
+    if (mode != "key" && mode != "all") {
+      SendText(net::json{{"op", op}, {"error", "mode unknown"}}.dump());
+      return;
+    }
+    // the frames after the key ones not decodable, if switched to all
+    if (mode == "all" && key_only_) WaitKey();
+    key_only_ = (mode == "key");
+    SendText(net::json{{"op", op}, {"mode", mode}}.dump());
+  } else if (op == "stats") {
+    auto stats = GetSendStats();
+    net::json reply{{"op", op}, {"sent", stats.sent},
+        {"dropped", stats.dropped}, {"drop_runs", stats.drop_runs},
+        {"rtt_us", stats.rtt_us}, {"unsent_bytes", stats.unsent_bytes}};
+    if (IsTimeEnabled()) {
+      std::lock_guard<std::mutex> _(latency_mutex_);
+      auto avg = [](const Latency &l) { return l.n > 0 ? l.sum / l.n : 0; };
+      reply["recv_us"] = {{"avg", avg(recv_latency_)},
+                          {"max", recv_latency_.max}};
+      reply["present_us"] = {{"avg", avg(present_latency_)},
+                             {"max", present_latency_.max}};
+    }
+    SendText(reply.dump());
+  } else if (op == "clock") {
+    // the client clock offset, as ntp by the round trip
+    auto reply = net::json{{"op", op},
+        {"server_us", times::now<times::microseconds>()}};
+    if (j["client_us"].is_number()) reply["client_us"] = j["client_us"];
+    SendText(reply.dump());
+  } else if (op == "latency" && IsTimeEnabled()) {
+    // reported about once a second, not replied
+    auto values = [&j](const char *key) {
+      // the integers within a minute, the others dropped, as from the client
+      //  not to overflow the sums shared by the viewers
+      constexpr int64_t kMaxUs = 60 * 1000000;
+      std::vector<int64_t> v;
+      auto &&a = j[key];
+      if (!a.is_array()) return v;
+      // bounded, as from the client
+      auto n = std::min<std::size_t>(a.size(), 1000);
+      v.reserve(n);
+      for (std::size_t i = 0; i < n; ++i) {
+        auto &&e = a[i];
+        if (e.is_number_unsigned()) {
+          auto u = e.get<uint64_t>();
+          if (u <= static_cast<uint64_t>(kMaxUs)) v.push_back(u);
+        } else if (e.is_number_integer()) {
+          auto t = e.get<int64_t>();
+          // the clocks synced roughly, a little negative
+          if (t >= -kMaxUs && t <= kMaxUs) v.push_back(std::max<int64_t>(t, 0));
+        }
+      }
+      return v;
+    };
+    auto id = id_;
+    if (IsMux()) {
+      if (!j["id"].is_string()) return;
+      id = j["id"].get<std::string>();
+      std::lock_guard<std::mutex> _(mux_mutex_);
+      if (mux_ids_.find(id) == mux_ids_.end()) return;
+    }
+    OnLatency(id, values("recv_us"), values("present_us"));
+  } else {
+    SendText(net::json{{"op", op}, {"error", "op unknown"}}.dump());
+  }
+}
+
+void WsStreamSession::OnLatency(const std::string &id,
+    const std::vector<int64_t> &recv_us,
+    const std::vector<int64_t> &present_us) {
+  auto &&r = metrics::Registry::Instance();
+  metrics::labels_t labels{{"stream", id}};
+  auto observe = [&r, &labels](const char *name, const char *help,
+      const std::vector<int64_t> &values, Latency *l) {
+    if (values.empty()) return;
+    auto h = r.GetHistogram(name, help, metrics::Histogram::LatencyBounds(),
+        1e-6, labels);
+    for (auto v : values) {
+      // the clocks synced roughly, not negative
+      v = std::max<int64_t>(v, 0);
+      h->Observe(v);
+      ++l->n;
+      l->sum += v;
+      l->max = std::max(l->max, v);
+    }
+  };
+  std::lock_guard<std::mutex> _(latency_mutex_);
+  observe("rtsp_ws_viewer_recv_latency_seconds",
+      "The time from ingested by the server to received by the viewers.",
+      recv_us, &recv_latency_);
+  observe("rtsp_ws_viewer_present_latency_seconds",
+      "The time from ingested by the server to presented by the viewers.",
+      present_us, &present_latency_);
+}
+
+void WsStreamSession::OnSubscribe(
+    bool sub, const std::vector<std::string> &ids) {
+  auto op = sub ? "sub" : "unsub";
+  // reply the indexes first, then the datas (and the inits) of them
+  auto streams = net::json::object();
+  auto not_found = net::json::array();
+  std::vector<std::string> changed;
+  // locked until joined, not to join after closed
+  std::lock_guard<std::mutex> _(mux_mutex_);
+  if (mux_closed_) return;
+  for (auto &&id : ids) {
+    auto it = mux_ids_.find(id);
+    if (it != mux_ids_.end()) {
+      streams[id] = it->second;
+      if (!sub) {
+        mux_ids_.erase(it);
+        changed.push_back(id);
+      }
+      continue;
+    }
+    auto index = -1;
+    if (sub && (options_.on_subscribe == nullptr ||
+        options_.on_subscribe(id))) {
+      index = room_->GetIndex(id);
+    }
+    if (index < 0) {
+      not_found.push_back(id);
+      continue;
+    }
+    mux_ids_.emplace(id, index);
+    streams[id] = index;
+    changed.push_back(id);
+  }
+
+  net::json reply{{"op", op}, {"streams", streams}};
+  if (!not_found.empty()) reply["not_found"] = not_found;
+  SendText(reply.dump());
+  for (auto &&id : changed) {
+    if (sub) {
+      room_->Join(id, shared_from_this());
+    } else {
+      room_->Leave(id, shared_from_this());
+    }
+  }
+}
+
+void WsStreamSession::SendText(const std::string &text) {
+  DoSend(std::make_shared<net::DataBatch>(
+      std::make_shared<const std::vector<uint8_t>>(text.begin(), text.end()),
+      true));
 }
 
 void WsStreamSession::OnEventSend(std::shared_ptr<void> data) {
@@ -42,3 +261,132 @@ void WsStreamSession::OnEventSend(std::shared_ptr<void> data) {
     VLOG(2) << "WsStreamSession[" << tag_ << "] send bytes_n=" << d->size();
   }
 }
+
+void WsStreamSession::SendInit(const std::shared_ptr<net::DataBatch> &init) {
+  DoSend(init);
+}
+
+bool WsStreamSession::Accept(const std::string &id,
+                             AVMediaType type, bool key, uint32_t *epoch) {
+  // before the wait key read, dropped by SendOnStrand if a resync between
+  *epoch = send_epoch_;
+  if (paused_) return false;
+  if (type != AVMEDIA_TYPE_VIDEO) return !key_only_;
+  if (key_only_) return key;
+  if (!wait_key_) return true;
+  std::lock_guard<std::mutex> _(wait_key_mutex_);
+  // the epoch of the resync waited the key, if any, as changed at once
+  *epoch = send_epoch_;
+  auto it = wait_key_ids_.find(id);
+  if (it == wait_key_ids_.end()) return true;
+  if (!key) return false;
+  wait_key_ids_.erase(it);
+  if (wait_key_ids_.empty()) wait_key_ = false;
+  return true;
+}
+
+void WsStreamSession::WaitKey() {
+  if (IsFmp4()) {
+    fmp4_wait_key_ = true;
+    return;
+  }
+  std::lock_guard<std::mutex> _(wait_key_mutex_);
+  WaitKeyLocked();
+}
+
+void WsStreamSession::WaitKeyLocked() {
+  if (IsMux()) {
+    std::lock_guard<std::mutex> lock(mux_mutex_);
+    for (auto &&e : mux_ids_) wait_key_ids_.insert(e.first);
+  } else {
+    wait_key_ids_.insert(id_);
+  }
+  wait_key_ = !wait_key_ids_.empty();
+}
+
+bool WsStreamSession::Fmp4Accept(bool key) {
+  if (paused_) return false;
+  if (fmp4_wait_key_) {
+    if (!key) return false;
+    fmp4_wait_key_ = false;
+  }
+  return true;
+}
+
+void WsStreamSession::SendOnStrand(
+    const std::shared_ptr<net::DataRef> &data,
+    const std::shared_ptr<net::DataBatch> &message,
+    const WsSendMeta &meta, uint32_t epoch) {
+  if (epoch != send_epoch_) {
+    // accepted before the resync, depends on the dropped
+    ++dropped_;
+    return;
+  }
+  if (data != nullptr && IsBatchEnabled()) {
+    DoBatch(data, meta);
+  } else {
+    DoSend(message, meta);
+  }
+}
+
+void WsStreamSession::OnSendDropped(std::size_t n, bool resync) {
+  (void)n;
+  if (!resync) return;
+  // the key frames first, then the datas accepted again
+  if (IsFmp4()) {
+    fmp4_wait_key_ = true;
+    ++send_epoch_;
+  } else {
+    // at once, not to accept a key frame by the epoch before, dropped then
+    //  and the frames after it accepted by the epoch after
+    std::lock_guard<std::mutex> _(wait_key_mutex_);
+    WaitKeyLocked();
+    ++send_epoch_;
+  }
+  dropped_ += batch_datas_.size();
+  batch_datas_.clear();
+  batch_bytes_ = 0;
+}
+
+void WsStreamSession::DoBatch(const std::shared_ptr<net::DataRef> &data,
+                              const WsSendMeta &meta) {
+  if (batch_datas_.empty()) {
+    batch_meta_ = meta;
+  } else if (meta.stream != batch_meta_.stream) {
+    batch_meta_.key = false;
+  }
+  batch_datas_.push_back(data);
+  batch_bytes_ += data->size();
+  if (batch_bytes_ >= options_.batch_max_bytes ||
+      batch_datas_.size() >= net::DataBatch::max_count()) {
+    FlushBatch();
+    return;
+  }
+  if (batch_timer_waiting_) return;
+  batch_timer_waiting_ = true;
+  batch_timer_.expires_after(
+      std::chrono::milliseconds(options_.batch_window_ms));
+  batch_timer_.async_wait(
+      asio::bind_executor(strand_, beast::bind_front_handler(
+          &WsStreamSession::OnBatchTimer,
+          shared_from_this())));
+}
+
+void WsStreamSession::OnBatchTimer(beast::error_code ec) {
+  if (ec == asio::error::operation_aborted) return;
+  FlushBatch();
+}
+
+void WsStreamSession::FlushBatch() {
+  if (batch_timer_waiting_) {
+    batch_timer_waiting_ = false;
+    batch_timer_.cancel();
+  }
+  if (batch_datas_.empty()) return;
+  VLOG(2) << "WsStreamSession[" << tag_ << "] batch datas_n="
+      << batch_datas_.size() << ", bytes_n=" << batch_bytes_;
+  auto batch = std::make_shared<net::DataBatch>(std::move(batch_datas_));
+  batch_datas_.clear();
+  batch_bytes_ = 0;
+  DoSend(batch, batch_meta_);
+}
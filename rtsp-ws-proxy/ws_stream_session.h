@@ -1,32 +1,152 @@
 #pragma once
 
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "common/net/packet.h"
 #include "common/util/ptr.h"
 
 #include "ws_session.h"
 
 class WsStreamRoom;
 
+struct WsStreamSessionOptions {
+  int data_ver = net::DATA_VERSION_1;
+  // send the datas within the window as one message, disabled if <= 0
+  int batch_window_ms = 0;
+  // send the batch at once if its bytes >= it
+  std::size_t batch_max_bytes = 64 * 1024;
+  // send the codec parameters first, and again if changed
+  bool init = false;
+  // the ingest wall clock in the datas, v2 only, the latency reported back
+  bool time = false;
+  // send fragmented mp4 instead of the datas, <id>.mp4
+  bool fmp4 = false;
+  // subscribe the streams by the control messages, the datas tagged by index
+  bool mux = false;
+  // if the stream could be subscribed, called by io threads
+  std::function<bool(const std::string &id)> on_subscribe = nullptr;
+  // drop the media messages by the dependent runs, evict if too slow
+  WsSendPolicy send_policy{};
+};
+
 class WsStreamSession
-  : public WsSession<std::vector<uint8_t>>,
+  : public WsSession<net::DataBatch>,
     public virtual_enable_shared_from_this<WsStreamSession> {
  public:
   using virtual_enable_shared_from_this<WsStreamSession>::shared_from_this;
 
+  // strand: shared by the sessions of the shard, see WsStreamRoom::GetStrand
   WsStreamSession(ws_stream_t &&ws, boost::optional<http_req_t> &&req,
       std::size_t send_queue_max_size,
-      std::string id, std::shared_ptr<WsStreamRoom> room);
+      std::string id, std::shared_ptr<WsStreamRoom> room,
+      const strand_t &strand,
+      const WsStreamSessionOptions &options = WsStreamSessionOptions{});
   ~WsStreamSession() override;
 
+  int GetDataVersion() const { return options_.data_ver; }
+  bool IsBatchEnabled() const { return options_.batch_window_ms > 0; }
+  bool IsInitEnabled() const { return options_.init; }
+  bool IsTimeEnabled() const { return options_.time; }
+  bool IsFmp4() const { return options_.fmp4; }
+  bool IsMux() const { return options_.mux; }
+
+  // if send the data of the stream, by the pause and mode controls
+  //  called by the stream thread, before the data serialized
+  //  epoch: the send epoch accepted in, to SendOnStrand
+  bool Accept(const std::string &id, AVMediaType type, bool key,
+              uint32_t *epoch);
+  // changed once the queued dropped to resync, the datas accepted before
+  //  are dropped as not decodable
+  uint32_t GetSendEpoch() const { return send_epoch_; }
+
+  // wait the key fragment after the fmp4 init, as the ones before not decodable
+  void Fmp4WaitKey() { fmp4_wait_key_ = true; }
+  // if send the fragment, called by the stream thread
+  bool Fmp4Accept(bool key);
+
+  // send the init before the datas queued later, on the session executor
+  void SendInit(const std::shared_ptr<net::DataBatch> &init);
+
+  // send the data, or the message if not batch or no data, on the strand
+  //  by the room fan-out, posted once for the sessions of the strand
+  void SendOnStrand(const std::shared_ptr<net::DataRef> &data,
+                    const std::shared_ptr<net::DataBatch> &message,
+                    const WsSendMeta &meta, uint32_t epoch);
+
  protected:
   void OnEventOpened() override;
   void OnEventClosed() override;
 
   void OnEventSend(std::shared_ptr<void> data) override;
+  void OnEventRecv(beast::flat_buffer &buffer, std::size_t bytes_n) override;
+  void OnSendDropped(std::size_t n, bool resync) override;
+
+  // the control messages, json text
+  //  {"op": "pause" | "resume"}, resumed at the next key frame
+  //  {"op": "mode", "mode": "key" | "all"}, the key frames only or all
+  //  {"op": "sub" | "unsub", "ids": ["a", "b"]}, mux only
+  //  {"op": "stats"}, the messages sent and dropped
+  //  {"op": "clock", "client_us": t}, replied with "server_us", the offset
+  //    of the client clock is server_us - (t + t_replied) / 2
+  //  {"op": "latency", "recv_us": [], "present_us": []}, the latencies from
+  //    the ingest time to received and presented, by the server clock
+  //    "id" of the stream if mux
+  void OnControl(const std::string &msg);
+  // the latencies of the stream reported, to the metrics and the stats
+  void OnLatency(const std::string &id, const std::vector<int64_t> &recv_us,
+                 const std::vector<int64_t> &present_us);
+  void OnSubscribe(bool sub, const std::vector<std::string> &ids);
+  // drop the datas until the key frame of each stream
+  void WaitKey();
+  void WaitKeyLocked();
+  void SendText(const std::string &text);
 
   std::string id_;
   std::shared_ptr<WsStreamRoom> room_;
+  WsStreamSessionOptions options_;
+
+ private:
+  void DoBatch(const std::shared_ptr<net::DataRef> &data,
+               const WsSendMeta &meta);
+  void OnBatchTimer(beast::error_code ec);
+  void FlushBatch();
+
+  // strand local, no lock
+  std::vector<std::shared_ptr<net::DataRef>> batch_datas_;
+  std::size_t batch_bytes_;
+  WsSendMeta batch_meta_;  // of the first data, not key if mixed streams
+  asio::steady_timer batch_timer_;
+  bool batch_timer_waiting_;
+
+  std::atomic_bool fmp4_wait_key_;
+  std::atomic<uint32_t> send_epoch_;
+
+  std::atomic_bool paused_;
+  std::atomic_bool key_only_;
+  std::atomic_bool wait_key_;
+  std::unordered_set<std::string> wait_key_ids_;
+  // also the send epoch changed under it by the resync
+  std::mutex wait_key_mutex_;
+
+  // the latencies reported, in us
+  struct Latency {
+    uint64_t n = 0;
+    int64_t sum = 0;
+    int64_t max = 0;
+  };
+  Latency recv_latency_;
+  Latency present_latency_;
+  std::mutex latency_mutex_;
+
+  // the stream ids subscribed and their indexes, mux only
+  std::unordered_map<std::string, int> mux_ids_;
+  bool mux_closed_;
+  std::mutex mux_mutex_;
 };
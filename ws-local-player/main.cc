@@ -69,6 +69,9 @@ int main(int argc, char const *argv[]) {
             node_client["dec_thread_type"].as<int>();
       if (node_client["ui_wait_secs"])
         client_options.ui_wait_secs = node_client["ui_wait_secs"].as<int>();
+      if (node_client["latency_report_ms"])
+        client_options.latency_report_ms =
+            node_client["latency_report_ms"].as<int>();
     }
 
     if (argc >= 3)
@@ -146,7 +149,13 @@ int main(int argc, char const *argv[]) {
       ioc.stop();
     });
 
-    client_options.ws.target = ws_target_prefix + stream_info.id;
+    // data v2, smaller than v1, small packets batched, and the codec
+    //  parameters sent first, again if changed, e.g. the stream looped
+    //  with the ingest time, the latencies reported back
+    client_options.ws.target =
+        ws_target_prefix + stream_info.id + "?ver=2&batch=1&init=1";
+    if (client_options.latency_report_ms > 0)
+      client_options.ws.target += "&time=1";
     client_options.stream_info = stream_info;
     client_options.ui_exit_func = [&ioc]() {
       ioc.stop();
@@ -15,9 +15,13 @@ extern "C" {
 #include <vector>
 
 #include "common/media/stream_video.h"
+#define NET_JSON_STREAM_IGNORE
+#define NET_JSON_STREAM_INFO_IGNORE
+#include "common/net/json.h"
 #include "common/net/packet.h"
 #include "common/util/log.h"
 #include "common/util/logext.h"
+#include "common/util/times.h"
 
 namespace client {
 
@@ -46,11 +50,24 @@ WsStreamClient::WsStreamClient(
     asio::io_context &ioc,
     const WsStreamClientOptions &opts)
   : WsClient<std::vector<uint8_t>>(ioc, opts.ws),
-    info_(opts.stream_info), recv_from_key_frame_(false),
+    options_(opts), info_(opts.stream_info), recv_from_key_frame_(false),
+    clock_offset_us_(0), clock_rtt_us_(-1), recv_time_us_(0),
     ui_wait_secs_(opts.ui_wait_secs), ui_ok_(false), ui_(nullptr),
     on_ui_exit_(opts.ui_exit_func) {
   if (ui_wait_secs_ <= 0) ui_wait_secs_ = 10;
 
+  InitOps();
+
+  ui_thread_ = std::thread(std::bind(&WsStreamClient::Run, this));
+}
+
+WsStreamClient::~WsStreamClient() {
+  ui_thread_.join();
+}
+
+void WsStreamClient::InitOps() {
+  auto &&opts = options_;
+  ops_.clear();
   for (auto &&e : info_.subs) {
     auto type = e.first;
     auto sub_info = e.second;
@@ -80,12 +97,6 @@ WsStreamClient::WsStreamClient(
       break;
     }
   }
-
-  ui_thread_ = std::thread(std::bind(&WsStreamClient::Run, this));
-}
-
-WsStreamClient::~WsStreamClient() {
-  ui_thread_.join();
 }
 
 void WsStreamClient::Run() {
@@ -113,19 +124,65 @@ void WsStreamClient::Run() {
   if (on_ui_exit_) on_ui_exit_();
 }
 
+void WsStreamClient::OnEventOpened() {
+  WsClient<std::vector<uint8_t>>::OnEventOpened();
+  // the clock offset, for the latencies from the ingest time
+  if (options_.latency_report_ms > 0) {
+    SendText(net::json{{"op", "clock"},
+        {"client_us", times::now<times::microseconds>()}}.dump());
+    latency_report_time_ = std::chrono::steady_clock::now();
+  }
+}
+
 void WsStreamClient::OnEventRecv(
     beast::flat_buffer &buffer, std::size_t bytes_n) {
-  auto t = logext::TimeRecord::Create("WsStreamClient::OnEventRecv");
   WsClient<std::vector<uint8_t>>::OnEventRecv(buffer, bytes_n);
+  recv_time_us_ = times::now<times::microseconds>();
 
-  t->Beg("FromBytes");
-  net::Data data;
+  if (ws_.got_text()) {
+    OnText(beast::buffers_to_string(buffer.data()));
+    buffer.consume(buffer.size());
+    return;
+  }
+
+  // a batch of datas, or one data
   auto buf = buffer.data();
-  data.FromBytes(buf);
+  auto ok = net::ForEachData(
+      reinterpret_cast<const uint8_t *>(buf.data()), buf.size(),
+      [this](const uint8_t *bytes, std::size_t bytes_n) {
+        OnData(bytes, bytes_n);
+      });
+  LOG_IF(ERROR, !ok) << "Stream[" << info_.id << "] batch broken, bytes_n="
+      << buf.size();
   buffer.consume(buf.size());
+}
+
+void WsStreamClient::OnData(const uint8_t *bytes, std::size_t bytes_n) {
+  if (net::DataInit::Is(bytes, bytes_n)) {
+    // the codec parameters, decode from the next key frame with them
+    decltype(info_.subs) subs;
+    auto status = net::DataInit::FromBytes(bytes, bytes_n, &subs);
+    if (status != net::Data::OK) {
+      LOG(ERROR) << "Stream[" << info_.id << "] init broken, status="
+          << status;
+      return;
+    }
+    LOG(INFO) << "Stream[" << info_.id << "] init, subs_n=" << subs.size();
+    ops_.clear();
+    info_.subs = std::move(subs);
+    InitOps();
+    recv_from_key_frame_ = false;
+    return;
+  }
+
+  auto t = logext::TimeRecord::Create("WsStreamClient::OnData");
+
+  t->Beg("FromBytes");
+  net::Data data;
+  data.FromBytes(bytes, bytes_n);
   t->End();
 
-  VLOG(2) << "buf_n=" << buf.size() << ", bytes_n=" << bytes_n
+  VLOG(2) << "bytes_n=" << bytes_n
       << ", type=" << data.type << ", packet_n=" << data.packet->size;
   if (!recv_from_key_frame_) {
     if ((data.packet->flags & AV_PKT_FLAG_KEY) == 0) {
@@ -136,7 +193,10 @@ void WsStreamClient::OnEventRecv(
     recv_from_key_frame_ = true;
   }
 
-  auto op = ops_[data.type];
+  auto it = ops_.find(data.type);
+  if (it == ops_.end()) return;
+  auto op = it->second;
+  auto time_us = data.time_us;
   t->Beg("GetFrame");
   auto frame = op->GetFrame(data.packet);
   t->End();
@@ -146,8 +206,12 @@ void WsStreamClient::OnEventRecv(
     VLOG(1) << " [v] frame size=" << frame->width << "x" << frame->height
         << ", fmt: " << frame->format;
     if (ui_ok_) {
-      std::lock_guard<std::mutex> _(ui_mutex_);
-      ui_->Update(frame);
+      {
+        std::lock_guard<std::mutex> _(ui_mutex_);
+        ui_->Update(frame);
+      }
+      // presented as updated, the frame of the packet if no decode delay
+      OnLatency(time_us, recv_time_us_, times::now<times::microseconds>());
     } else {
       std::unique_lock<std::mutex> lock(ui_mutex_);
       ui_ok_ = true;
@@ -158,3 +222,53 @@ void WsStreamClient::OnEventRecv(
 
   VLOG(2) << t->Log();
 }
+
+void WsStreamClient::OnText(const std::string &text) {
+  auto j = net::json::parse(text, nullptr, false);
+  if (j.is_discarded() || !j.is_object() || !j["op"].is_string()) {
+    LOG(WARNING) << "Stream[" << info_.id << "] text invalid: "
+        << text.substr(0, 64);
+    return;
+  }
+  VLOG(1) << "Stream[" << info_.id << "] text " << text.substr(0, 64);
+  if (j["op"] == "clock" && j["client_us"].is_number() &&
+      j["server_us"].is_number()) {
+    auto t0 = j["client_us"].get<int64_t>();
+    auto server_us = j["server_us"].get<int64_t>();
+    auto rtt = recv_time_us_ - t0;
+    if (clock_rtt_us_ < 0 || rtt < clock_rtt_us_) {
+      clock_rtt_us_ = rtt;
+      clock_offset_us_ = server_us - (t0 + recv_time_us_) / 2;
+    }
+    LOG(INFO) << "Stream[" << info_.id << "] clock offset="
+        << clock_offset_us_ * 0.001 << " ms, rtt=" << rtt * 0.001 << " ms";
+  }
+}
+
+void WsStreamClient::SendText(const std::string &text) {
+  Send(std::make_shared<std::vector<uint8_t>>(text.begin(), text.end()));
+}
+
+void WsStreamClient::OnLatency(
+    int64_t time_us, int64_t recv_us, int64_t present_us) {
+  if (time_us == 0 || clock_rtt_us_ < 0 || options_.latency_report_ms <= 0) {
+    return;
+  }
+  latency_recv_us_.push_back(recv_us + clock_offset_us_ - time_us);
+  latency_present_us_.push_back(present_us + clock_offset_us_ - time_us);
+
+  auto now = std::chrono::steady_clock::now();
+  if (now - latency_report_time_ <
+      std::chrono::milliseconds(options_.latency_report_ms)) {
+    return;
+  }
+  latency_report_time_ = now;
+  VLOG(1) << "Stream[" << info_.id << "] latency present="
+      << latency_present_us_.back() * 0.001 << " ms, recv="
+      << latency_recv_us_.back() * 0.001 << " ms";
+  SendText(net::json{{"op", "latency"},
+      {"recv_us", latency_recv_us_},
+      {"present_us", latency_present_us_}}.dump());
+  latency_recv_us_.clear();
+  latency_present_us_.clear();
+}
@@ -37,6 +37,10 @@ struct WsStreamClientOptions {
 
   int ui_wait_secs = 10;
   std::function<void()> ui_exit_func = nullptr;
+
+  // report the latencies from the ingest time, if the datas have it
+  //  requested by ?ver=2&time=1, disabled if <= 0
+  int latency_report_ms = 1000;
 };
 
 class WsStreamClient : public WsClient<std::vector<uint8_t>> {
@@ -49,12 +53,30 @@ class WsStreamClient : public WsClient<std::vector<uint8_t>> {
 
  protected:
   void Run();
+  void OnEventOpened() override;
   void OnEventRecv(beast::flat_buffer &buffer, std::size_t bytes_n) override;
+  void OnData(const uint8_t *bytes, std::size_t bytes_n);
+  // the text replies of the controls, e.g. the clock
+  void OnText(const std::string &text);
+  void SendText(const std::string &text);
+  // the latencies of the data by the server clock, reported in batch
+  void OnLatency(int64_t time_us, int64_t recv_us, int64_t present_us);
+  // the ops of info_.subs, again if the init received
+  void InitOps();
 
+  WsStreamClientOptions options_;
   StreamInfo info_;
   stream_ops_t ops_;
   bool recv_from_key_frame_;
 
+  // the server clock - the local one, by the round trip of the min rtt
+  int64_t clock_offset_us_;
+  int64_t clock_rtt_us_;  // < 0 if not synced
+  int64_t recv_time_us_;  // of the message, local
+  std::vector<int64_t> latency_recv_us_;
+  std::vector<int64_t> latency_present_us_;
+  std::chrono::steady_clock::time_point latency_report_time_;
+
   int ui_wait_secs_;
   bool ui_ok_;
   std::shared_ptr<GlfwFrame> ui_;
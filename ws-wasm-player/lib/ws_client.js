@@ -1,6 +1,7 @@
 const WsClientOptions = {
   // required on open
   url: null,
+  // not required if init=1 in url
   stream: null,
 
   decode_async: false,
@@ -26,6 +27,12 @@ const WsClientOptions = {
 
   ondata: null,
 
+  // the latencies from the ingest time of the server, if time=1 in url
+  //  reported back every interval, disabled if <= 0
+  latency_report_ms: 1000,
+  // called with { recv_us: [], present_us: [] } when reported
+  onlatency: null,
+
   dbg: false,
   log: console.log,
   wasm_log_v: 0,
@@ -36,6 +43,10 @@ class WsClient {
   #ws = null;
   #decoder = null;
   #t_onmsg = Date.now();
+  // the server clock - the local one, by the round trip of the min rtt
+  #clock = { offset_us: 0, rtt_us: -1 };
+  #t_recv_us = 0;
+  #latency = { recv_us: [], present_us: [], t: 0 };
 
   constructor(options) {
     this.#options = { ...WsClientOptions, ...options };
@@ -57,6 +68,10 @@ class WsClient {
     this.#options.dbg && this.#options.log(...args);
   }
 
+  static #nowUs() {
+    return Math.round((performance.timeOrigin + performance.now()) * 1000);
+  }
+
   isOpen() {
     return this.#ws != null;
   }
@@ -73,14 +88,17 @@ class WsClient {
       this.#log('ws open error: url is null');
       return;
     }
-    if (this.#options.stream == null) {
+    // the stream info could be null if init=1 in url,
+    //  as the codec parameters are sent first by the server
+    const init = /[?&]init=1(&|$)/.test(this.#options.url);
+    if (this.#options.stream == null && !init) {
       this.#log('ws open error: stream is null');
       return;
     }
 
     this.#decoder = new Module.Decoder();
     this.#decoder.open(
-        JSON.stringify(this.#options.stream),
+        JSON.stringify(this.#options.stream || { id: '' }),
         this.#options.decode_queue_size,
         this.#options.decode_thread_count,
         this.#options.decode_thread_type,
@@ -95,6 +113,26 @@ class WsClient {
     this.#ws = ws;
   }
 
+  // stop the datas, e.g. the tab hidden, then resumed at the next key frame
+  pause() {
+    this.#control({ op: 'pause' });
+  }
+
+  resume() {
+    this.#control({ op: 'resume' });
+  }
+
+  // 'key': the key frames only, e.g. the thumbnails, or 'all'
+  setMode(mode) {
+    this.#control({ op: 'mode', mode: mode });
+  }
+
+  #control(msg) {
+    if (this.#ws == null || this.#ws.readyState !== WebSocket.OPEN) return;
+    this.#logd(`ws control: ${JSON.stringify(msg)}`);
+    this.#ws.send(JSON.stringify(msg));
+  }
+
   close() {
     if (this.#ws != null) {
       this.#logd('ws close');
@@ -108,6 +146,13 @@ class WsClient {
 
   #onopen(e) {
     this.#logd(`ws open: ${this.#options.url}`);
+    // the clock offset, for the latencies from the ingest time
+    if (this.#options.latency_report_ms > 0 &&
+        /[?&]time=1(&|$)/.test(this.#options.url)) {
+      this.#clock = { offset_us: 0, rtt_us: -1 };
+      this.#latency = { recv_us: [], present_us: [], t: Date.now() };
+      this.#control({ op: 'clock', client_us: WsClient.#nowUs() });
+    }
     this.#options.onopen && this.#options.onopen(e);
   }
 
@@ -118,6 +163,13 @@ class WsClient {
           `, interval: ${t - this.#t_onmsg} ms`);
       this.#t_onmsg = t;
     }
+    this.#t_recv_us = WsClient.#nowUs();
+    // the text replies of the controls
+    if (typeof e.data === 'string') {
+      this.#logd(`ws control reply: ${e.data}`);
+      this.#onreply(e.data);
+      return;
+    }
     this.#options.dbg && console.time("ws onmessage");
 
     let data = new Uint8Array(e.data);
@@ -155,6 +207,7 @@ class WsClient {
         }
         player.render(frame);
       }
+      this.#onpresent(frame);
       this.#options.ondata && this.#options.ondata(frame);
       frame.delete();
     } else {
@@ -163,6 +216,43 @@ class WsClient {
     this.#options.dbg && console.timeEnd("ws ondecode");
   }
 
+  #onreply(text) {
+    let msg;
+    try {
+      msg = JSON.parse(text);
+    } catch (err) {
+      return;
+    }
+    if (msg.op === 'clock' && msg.client_us != null && msg.server_us != null) {
+      const rtt = this.#t_recv_us - msg.client_us;
+      if (this.#clock.rtt_us < 0 || rtt < this.#clock.rtt_us) {
+        this.#clock = {
+          offset_us: msg.server_us - (msg.client_us + this.#t_recv_us) / 2,
+          rtt_us: rtt,
+        };
+      }
+      this.#logd(`ws clock offset=${this.#clock.offset_us / 1000} ms` +
+          `, rtt=${rtt / 1000} ms`);
+    }
+  }
+
+  // the frame rendered, the latencies by the server clock
+  //  time_us is undefined if the decoder is older, 0 if not sent
+  #onpresent(frame) {
+    const time_us = frame.time_us;
+    if (!time_us || this.#clock.rtt_us < 0) return;
+    const offset = this.#clock.offset_us;
+    const l = this.#latency;
+    l.recv_us.push(Math.round(this.#t_recv_us + offset - time_us));
+    l.present_us.push(Math.round(WsClient.#nowUs() + offset - time_us));
+    const t = Date.now();
+    if (t - l.t < this.#options.latency_report_ms) return;
+    const report = { recv_us: l.recv_us, present_us: l.present_us };
+    this.#control({ op: 'latency', ...report });
+    this.#options.onlatency && this.#options.onlatency(report);
+    this.#latency = { recv_us: [], present_us: [], t: t };
+  }
+
   #onclose(e) {
     this.#logd(`ws close: ${this.#options.url}`);
     this.#options.onclose && this.#options.onclose(e);
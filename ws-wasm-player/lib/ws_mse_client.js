@@ -0,0 +1,184 @@
+const WsMseClientOptions = {
+  // required on open, ws://host:port/stream/<id>.mp4
+  url: null,
+  // required on open, the <video> element
+  video: null,
+
+  // remove the buffer behind the current time, seconds
+  buffer_keep_secs: 10,
+  // jump to the live edge if behind it more than, seconds
+  live_max_delay_secs: 1,
+
+  onopen: null,
+  onclose: null,
+  onerror: null,
+
+  dbg: false,
+  log: console.log,
+};
+
+// Play the fragmented mp4 by Media Source Extensions, hardware decoding
+//  the first message is the init segment, then the fragments
+class WsMseClient {
+  #options;
+  #ws = null;
+  #media_source = null;
+  #source_buffer = null;
+  #source_open = false;
+  #queue = [];
+
+  constructor(options) {
+    this.#options = { ...WsMseClientOptions, ...options };
+    this.#logd('ws mse options:')
+    this.#logd(this.#options);
+  }
+
+  static isSupported() {
+    return 'MediaSource' in window;
+  }
+
+  // the codecs of mime from the init segment, h264 only at present
+  static getCodec(data) {
+    for (let i = 0, n = data.length - 8; i < n; i++) {
+      // 'avcC', then version, profile, compatibility, level
+      if (data[i] === 0x61 && data[i+1] === 0x76 &&
+          data[i+2] === 0x63 && data[i+3] === 0x43) {
+        const hex = (b) => b.toString(16).padStart(2, '0');
+        return `avc1.${hex(data[i+5])}${hex(data[i+6])}${hex(data[i+7])}`;
+      }
+    }
+    return 'avc1.42e01e';
+  }
+
+  #log(...args) {
+    this.#options.log(...args);
+  }
+
+  #logd(...args) {
+    this.#options.dbg && this.#options.log(...args);
+  }
+
+  isOpen() {
+    return this.#ws != null;
+  }
+
+  open(options) {
+    if (this.#ws != null) {
+      this.#log('ws mse open error: already opened');
+      return;
+    }
+    this.#options = { ...this.#options, ...options };
+    if (this.#options.url == null) {
+      this.#log('ws mse open error: url is null');
+      return;
+    }
+    if (this.#options.video == null) {
+      this.#log('ws mse open error: video is null');
+      return;
+    }
+    if (!WsMseClient.isSupported()) {
+      this.#log('ws mse open error: MediaSource not supported');
+      return;
+    }
+
+    const ms = new MediaSource();
+    ms.addEventListener('sourceopen', () => {
+      this.#source_open = true;
+      this.#append();
+    });
+    this.#options.video.src = URL.createObjectURL(ms);
+    this.#media_source = ms;
+
+    const ws = new WebSocket(this.#options.url);
+    ws.binaryType = 'arraybuffer';
+    ws.onopen = (e) => this.#onopen(e);
+    ws.onmessage = (e) => this.#onmessage(e);
+    ws.onclose = (e) => this.#onclose(e);
+    ws.onerror = (e) => this.#onerror(e);
+    this.#ws = ws;
+  }
+
+  close() {
+    if (this.#ws != null) {
+      this.#logd('ws mse close');
+      this.#ws.close();
+      this.#ws = null;
+      const video = this.#options.video;
+      URL.revokeObjectURL(video.src);
+      video.removeAttribute('src');
+      video.load();
+      this.#media_source = null;
+      this.#source_buffer = null;
+      this.#source_open = false;
+      this.#queue = [];
+    }
+  }
+
+  #onopen(e) {
+    this.#logd(`ws mse open: ${this.#options.url}`);
+    this.#options.onopen && this.#options.onopen(e);
+  }
+
+  #onmessage(e) {
+    this.#queue.push(new Uint8Array(e.data));
+    this.#append();
+  }
+
+  #append() {
+    if (!this.#source_open || this.#queue.length === 0) return;
+    if (this.#source_buffer == null) {
+      // the init segment
+      const mime = `video/mp4; codecs="${WsMseClient.getCodec(this.#queue[0])}"`;
+      this.#logd(`ws mse mime: ${mime}`);
+      if (!MediaSource.isTypeSupported(mime)) {
+        this.#log(`ws mse error: ${mime} not supported`);
+        return;
+      }
+      const sb = this.#media_source.addSourceBuffer(mime);
+      // contiguous, as timestamps restart if the stream changed
+      sb.mode = 'sequence';
+      sb.addEventListener('updateend', () => {
+        this.#chase();
+        this.#append();
+      });
+      this.#source_buffer = sb;
+    }
+    const sb = this.#source_buffer;
+    if (sb.updating) return;
+    try {
+      sb.appendBuffer(this.#queue.shift());
+    } catch (err) {
+      this.#log(`ws mse append error: ${err}`);
+    }
+  }
+
+  // play at the live edge, and remove the buffer played
+  #chase() {
+    const video = this.#options.video;
+    const sb = this.#source_buffer;
+    if (sb.buffered.length === 0) return;
+    const beg = sb.buffered.start(0);
+    const end = sb.buffered.end(sb.buffered.length - 1);
+    if (end - video.currentTime > this.#options.live_max_delay_secs) {
+      this.#logd(`ws mse chase: ${video.currentTime} > ${end}`);
+      video.currentTime = end - 0.1;
+    }
+    if (video.paused) {
+      video.play().catch((err) => this.#logd(`ws mse play: ${err}`));
+    }
+    const keep = this.#options.buffer_keep_secs;
+    if (!sb.updating && video.currentTime - beg > keep * 2) {
+      sb.remove(beg, video.currentTime - keep);
+    }
+  }
+
+  #onclose(e) {
+    this.#logd(`ws mse close: ${this.#options.url}`);
+    this.#options.onclose && this.#options.onclose(e);
+  }
+
+  #onerror(e) {
+    this.#logd(`ws mse error: ${this.#options.url}, ${e}`);
+    this.#options.onerror && this.#options.onerror(e);
+  }
+}
@@ -4,6 +4,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -69,7 +70,64 @@ class Decoder {
     } else {
       decode_cb_ = nullptr;
     }
+    thread_count_ = thread_count;
+    thread_type_ = thread_type;
 
+    InitOps();
+  }
+
+  // embind doesn't support pointers to primitive types
+  //  https://stackoverflow.com/a/27364643
+  //  return the last frame if the message is a batch
+  std::shared_ptr<Frame> Decode(uintptr_t buf_p, int buf_size) {
+    const uint8_t *buf = reinterpret_cast<uint8_t *>(buf_p);
+    std::shared_ptr<Frame> f = nullptr;
+    auto ok = net::ForEachData(buf, buf_size,
+        [this, &f](const uint8_t *bytes, std::size_t bytes_n) {
+          if (net::DataInit::Is(bytes, bytes_n)) {
+            DecodeInit(bytes, bytes_n);
+            return;
+          }
+          auto frame = DecodeData(bytes, bytes_n);
+          if (frame != nullptr) f = frame;
+        });
+    LOG_IF(ERROR, !ok) << "decode batch broken, size=" << buf_size;
+    return f;
+  }
+
+  // not works well as clone frame not supported in frame.h
+  //  otherwise alloc more frames for decoding from packets when op->GetFrame()
+  void DecodeAsync(uintptr_t buf_p, int buf_size) {
+    ThreadStart();
+
+    const uint8_t *buf = reinterpret_cast<uint8_t *>(buf_p);
+    auto ok = net::ForEachData(buf, buf_size,
+        [this](const uint8_t *bytes, std::size_t bytes_n) {
+          if (net::DataInit::Is(bytes, bytes_n)) {
+            // the ops are used by the decode thread
+            ThreadStop();
+            decode_datas_.clear();
+            DecodeInit(bytes, bytes_n);
+            ThreadStart();
+            return;
+          }
+          DecodeDataAsync(bytes, bytes_n);
+        });
+    LOG_IF(ERROR, !ok) << "decode batch broken, size=" << buf_size;
+
+    if (!decode_results_.empty()) {
+      // callback results in main thread
+      std::lock_guard<std::mutex> lock(decode_results_mutex_);
+      for (auto &&f : decode_results_) {
+        if (decode_cb_) decode_cb_(f);
+      }
+      decode_results_.clear();
+    }
+  }
+
+ private:
+  void InitOps() {
+    stream_ops_.clear();
     for (auto &&e : stream_info_.subs) {
       auto type = e.first;
       auto sub_info = e.second;
@@ -77,8 +135,8 @@ class Decoder {
       case AVMEDIA_TYPE_VIDEO: {
         StreamVideoOptions options{};
         options.dec_name = "";
-        options.dec_thread_count = thread_count;
-        options.dec_thread_type = thread_type;
+        options.dec_thread_count = thread_count_;
+        options.dec_thread_type = thread_type_;
         options.sws_enable = true;
         if (sub_info->codecpar->format == AV_PIX_FMT_YUVJ420P || (
             sub_info->codecpar->format == AV_PIX_FMT_YUV420P &&
@@ -101,14 +159,27 @@ class Decoder {
     }
   }
 
-  // embind doesn't support pointers to primitive types
-  //  https://stackoverflow.com/a/27364643
-  std::shared_ptr<Frame> Decode(uintptr_t buf_p, int buf_size) {
-    const uint8_t *buf = reinterpret_cast<uint8_t *>(buf_p);
+  // the codec parameters, sent first and again if changed, ?init=1
+  void DecodeInit(const uint8_t *buf, std::size_t buf_size) {
+    decltype(stream_info_.subs) subs;
+    auto status = net::DataInit::FromBytes(buf, buf_size, &subs);
+    if (status != net::Data::OK) {
+      LOG(ERROR) << "decode init broken, status=" << status;
+      return;
+    }
+    VLOG(1) << "decode init, subs_n=" << subs.size();
+    stream_ops_.clear();
+    stream_info_.subs = std::move(subs);
+    InitOps();
+    decode_from_key_frame_ = false;
+  }
+
+  std::shared_ptr<Frame> DecodeData(const uint8_t *buf, std::size_t buf_size) {
     net::Data data;
     data.FromBytes(buf, buf_size);
     VLOG(1) << "decode packet type=" << av_get_media_type_string(data.type)
         << ", size=" << data.packet->size;
+    AddTime(data.packet->pts, data.time_us);
 
     if (!decode_from_key_frame_) {
       if ((data.packet->flags & AV_PKT_FLAG_KEY) == 0) {
@@ -118,8 +189,10 @@ class Decoder {
       decode_from_key_frame_ = true;
     }
 
+    auto it = stream_ops_.find(data.type);
+    if (it == stream_ops_.end()) return nullptr;
     try {
-      auto op = stream_ops_[data.type];
+      auto op = it->second;
       time_stat_->Beg();
       auto frame = op->GetFrame(data.packet);
       if (frame == nullptr) {
@@ -129,6 +202,7 @@ class Decoder {
       time_stat_->End();
       VLOG(2) << time_stat_->Log();
       auto f = std::make_shared<Frame>()->Alloc(data.type, frame);
+      f->set_time_us(GetTime(frame->pts));
       if (decode_cb_) decode_cb_(f);
       return f;
     } catch (const StreamError &err) {
@@ -137,12 +211,7 @@ class Decoder {
     }
   }
 
-  // not works well as clone frame not supported in frame.h
-  //  otherwise alloc more frames for decoding from packets when op->GetFrame()
-  void DecodeAsync(uintptr_t buf_p, int buf_size) {
-    ThreadStart();
-
-    const uint8_t *buf = reinterpret_cast<uint8_t *>(buf_p);
+  void DecodeDataAsync(const uint8_t *buf, std::size_t buf_size) {
     {
       std::lock_guard<std::mutex> _(decode_mutex_);
       auto data = std::make_shared<net::Data>();
@@ -169,18 +238,24 @@ class Decoder {
       }
     }
     decode_cond_.notify_one();
+  }
 
-    if (!decode_results_.empty()) {
-      // callback results in main thread
-      std::lock_guard<std::mutex> lock(decode_results_mutex_);
-      for (auto &&f : decode_results_) {
-        if (decode_cb_) decode_cb_(f);
-      }
-      decode_results_.clear();
+  // the ingest time of the packets recently decoded, by the pts
+  //  as the frames may be out after the later packets
+  void AddTime(int64_t pts, int64_t time_us) {
+    if (time_us == 0) return;
+    times_.emplace_back(pts, time_us);
+    if (times_.size() > 32) times_.pop_front();
+  }
+
+  double GetTime(int64_t pts) const {
+    for (auto it = times_.rbegin(); it != times_.rend(); ++it) {
+      if (it->first == pts) return static_cast<double>(it->second);
     }
+    // the latest one, if the pts not kept by the decoder
+    return times_.empty() ? 0 : static_cast<double>(times_.back().second);
   }
 
- private:
   void ThreadStart() {
     if (!decode_stop_) return;
     decode_stop_ = false;
@@ -215,7 +290,9 @@ class Decoder {
         VLOG(1) << "decode packet type="
             << av_get_media_type_string(data->type)
             << ", size=" << data->packet->size;
-        auto op = stream_ops_[data->type];
+        auto it = stream_ops_.find(data->type);
+        if (it == stream_ops_.end()) continue;
+        auto op = it->second;
         try {
           time_stat_->Beg();
           // note: return frame alloced once here
@@ -228,8 +305,9 @@ class Decoder {
           VLOG(2) << time_stat_->Log();
           {
             std::lock_guard<std::mutex> lock(decode_results_mutex_);
-            decode_results_.push_back(
-                std::make_shared<Frame>()->Alloc(data->type, frame));
+            auto f = std::make_shared<Frame>()->Alloc(data->type, frame);
+            f->set_time_us(data->time_us);
+            decode_results_.push_back(f);
           }
         } catch (const StreamError &err) {
           LOG(ERROR) << err.what();
@@ -243,6 +321,9 @@ class Decoder {
   stream_ops_t stream_ops_;
   decode_callback_t decode_cb_;
   bool decode_from_key_frame_{false};
+  std::deque<std::pair<int64_t, int64_t>> times_;  // pts, time_us
+  int thread_count_{0};
+  int thread_type_{0};
 
   std::atomic_bool decode_stop_{true};
   std::size_t decode_datas_maxsize_{2};
@@ -20,7 +20,7 @@ extern "C" {
 class Frame : public std::enable_shared_from_this<Frame> {
  public:
   Frame()
-    : type_(AVMEDIA_TYPE_UNKNOWN), frame_(nullptr) {
+    : type_(AVMEDIA_TYPE_UNKNOWN), frame_(nullptr), time_us_(0) {
     VLOG(2) << __func__;
   }
   ~Frame() {
@@ -56,6 +56,10 @@ class Frame : public std::enable_shared_from_this<Frame> {
   // int64_t in C++ results in UnboundTypeError
   //  https://github.com/emscripten-core/emscripten/issues/11140
   double pts() const { return frame_->pts; }
+  // the ingest wall clock of the server, us since epoch, 0 if not sent
+  //  exact in double, < 2^53
+  double time_us() const { return time_us_; }
+  void set_time_us(double t) { time_us_ = t; }
 
   int data_ptr() const { return (int)(frame_->data[0]); }  // NOLINT
   int size() const {
@@ -70,4 +74,5 @@ class Frame : public std::enable_shared_from_this<Frame> {
  private:
   int type_;
   AVFrame *frame_;
+  double time_us_;
 };
@@ -29,6 +29,7 @@ EMSCRIPTEN_BINDINGS(decoder) {
     .property("height", &Frame::height)
     .property("format", &Frame::format)
     .property("pts", &Frame::pts)
+    .property("time_us", &Frame::time_us)
     .property("size", &Frame::size)
     .function("getBytes", &Frame::GetBytes);
 